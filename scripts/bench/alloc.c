@@ -0,0 +1,29 @@
+// Allocation counting hook
+// The binary's malloc, calloc and realloc count calls while alloc_counting
+// is set and forward to glibc. free is left to glibc.
+
+#include "alloc.h"
+
+#ifdef ALLOC_HOOK
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+_Atomic int alloc_counting = 0;
+_Atomic long alloc_count = 0;
+
+void* malloc(size_t size) {
+    if (alloc_counting) alloc_count++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    if (alloc_counting) alloc_count++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (alloc_counting) alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+#endif
@@ -0,0 +1,274 @@
+// Reference implementations for the microbenchmarks
+// Copies of code the server replaced: the byte-at-a-time parser, the hash
+// lookup of the previous switch_http, the tree-per-bucket HashTab and the
+// flat table with unseeded FNV-1a. They are kept as they were, to reproduce
+// the before/after comparisons of the changes that replaced them.
+
+#include <stdlib.h>
+#include <string.h>
+#include "tree.h"
+#include "legacy.h"
+
+#define FLAT_MIN_SIZE 8
+#define FLAT_LOAD_NUM 7
+#define FLAT_LOAD_DEN 8
+#define FLAT_USED     0x80000000u
+
+typedef struct LegacyTab {
+    Tree** table;
+    size_t size;
+} LegacyTab;
+
+typedef struct flat_slot {
+    uint32_t hash; // Hash with FLAT_USED set, 0 if empty
+    char* key;
+    int32_t value;
+} flat_slot;
+
+typedef struct LegacyFlat {
+    size_t size;
+    size_t len;
+    flat_slot* table;
+} LegacyFlat;
+
+// Previous parser: walks every byte through a switch and copies the fields
+extern size_t legacy_parse(legacy_request* request, char* buffer, size_t size) {
+    size_t i = 0;
+    for (; i < size; ++i) {
+        switch(request->state) {
+            case 0:
+                if (buffer[i] == ' ' || request->ind == 15) {
+                    request->method[request->ind] = '\0';
+                    request->state += 1;
+                    request->ind = 0;
+                    continue;
+                }
+                request->method[request->ind] = buffer[i];
+            break;
+            case 1:
+                if (buffer[i] == ' ' || request->ind == LEGACY_PATH - 1) {
+                    request->path[request->ind] = '\0';
+                    request->state += 1;
+                    request->ind = 0;
+                    continue;
+                }
+                request->path[request->ind] = buffer[i];
+            break;
+            case 2:
+                if (buffer[i] == '\r') {
+                    continue;
+                }
+                if (buffer[i] == '\n' || request->ind == 15) {
+                    request->prot[request->ind] = '\0';
+                    request->state += 1;
+                    request->ind = 0;
+                    continue;
+                }
+                request->prot[request->ind] = buffer[i];
+            break;
+            case 3:
+                if (buffer[i] == '\r') {
+                    continue;
+                }
+                if (buffer[i] == '\n') {
+                    if (request->ind == 0) {
+                        request->state = 4;
+                        continue;
+                    }
+                    request->ind = 0;
+                    continue;
+                }
+                if (request->ind == 63) {
+                    continue;
+                }
+                request->hline[request->ind] = buffer[i];
+            break;
+            default: return i;
+        }
+        request->ind += 1;
+    }
+    return i;
+}
+
+// Route lookup of the previous switch_http: exact hash lookup, then a copy
+// of the path cut back to its last '/' and two more lookups
+// path must point to LEGACY_PATH bytes, the whole buffer is copied
+extern int32_t legacy_route(HashTab* tab, char* path) {
+    if (!in_hashtab(tab, string(path))) {
+        char buffer[LEGACY_PATH];
+        memcpy(buffer, path, LEGACY_PATH);
+        int32_t index = strlen(path);
+        if (index == 0) {
+            return -1;
+        }
+        index -= 1;
+        for (; index > 0 && buffer[index] != '/'; --index) {
+            buffer[index] = '\0';
+        }
+        if (!in_hashtab(tab, string(buffer))) {
+            return -1;
+        }
+        return get_hashtab(tab, string(buffer)).decimal;
+    }
+    return get_hashtab(tab, string(path)).decimal;
+}
+
+// Create the previous table with a fixed number of buckets
+extern LegacyTab* new_legacy_tab(size_t buckets) {
+    LegacyTab* tab = (LegacyTab*)malloc(sizeof(LegacyTab));
+    tab->table = (Tree**)malloc(buckets * sizeof(Tree*));
+    tab->size = buckets;
+    for (size_t i = 0; i < buckets; ++i) {
+        tab->table[i] = new_tree(STRING_TYPE, DECIMAL_TYPE);
+    }
+    return tab;
+}
+
+extern void free_legacy_tab(LegacyTab* tab) {
+    for (size_t i = 0; i < tab->size; ++i) {
+        free_tree(tab->table[i]);
+    }
+    free(tab->table);
+    free(tab);
+}
+
+// Bucket of a string key in the previous table
+static Tree* legacy_bucket(LegacyTab* tab, char* key) {
+    uint32_t hashval = 0;
+    for (; *key != '\0'; ++key) {
+        hashval = *key + 31 * hashval;
+    }
+    return tab->table[hashval % tab->size];
+}
+
+extern void set_legacy_tab(LegacyTab* tab, char* key, int32_t value) {
+    set_tree(legacy_bucket(tab, key), string(key), decimal(value));
+}
+
+extern int32_t get_legacy_tab(LegacyTab* tab, char* key) {
+    return get_tree(legacy_bucket(tab, key), string(key)).decimal;
+}
+
+extern int8_t in_legacy_tab(LegacyTab* tab, char* key) {
+    return in_tree(legacy_bucket(tab, key), string(key));
+}
+
+// Murmur3 finalizer of the flat table
+static uint32_t flat_mix(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+// FNV-1a string hash with a final mix of the low bits
+static uint32_t flat_hash(char* s) {
+    uint32_t hashval = 2166136261u;
+    for (; *s != '\0'; ++s) {
+        hashval = (hashval ^ (uint8_t)*s) * 16777619u;
+    }
+    return flat_mix(hashval) | FLAT_USED;
+}
+
+// Distance of the entry in a slot from its home slot
+static size_t flat_dist(LegacyFlat* flat, size_t index) {
+    size_t mask = flat->size - 1;
+    return (index - (flat->table[index].hash & mask)) & mask;
+}
+
+// Slot of a key, -1 if absent
+static int64_t flat_find(LegacyFlat* flat, char* key, uint32_t hash) {
+    size_t mask = flat->size - 1;
+    size_t index = hash & mask;
+    for (size_t dist = 0; ; ++dist) {
+        flat_slot* slot = &flat->table[index];
+        if (slot->hash == 0 || flat_dist(flat, index) < dist) {
+            return -1;
+        }
+        if (slot->hash == hash && strcmp(slot->key, key) == 0) {
+            return (int64_t)index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+// Place a new entry, taking slots from entries closer to their home
+static void flat_insert(LegacyFlat* flat, flat_slot entry) {
+    size_t mask = flat->size - 1;
+    size_t index = entry.hash & mask;
+    for (size_t dist = 0; ; ++dist) {
+        flat_slot* slot = &flat->table[index];
+        if (slot->hash == 0) {
+            *slot = entry;
+            return;
+        }
+        size_t other = flat_dist(flat, index);
+        if (other < dist) {
+            flat_slot temp = *slot;
+            *slot = entry;
+            entry = temp;
+            dist = other;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+// Double the slot array and move every entry to its new place
+static void flat_grow(LegacyFlat* flat) {
+    flat_slot* old = flat->table;
+    size_t size = flat->size;
+    flat->size = size << 1;
+    flat->table = (flat_slot*)calloc(flat->size, sizeof(flat_slot));
+    for (size_t i = 0; i < size; ++i) {
+        if (old[i].hash != 0) {
+            flat_insert(flat, old[i]);
+        }
+    }
+    free(old);
+}
+
+extern LegacyFlat* new_legacy_flat(void) {
+    LegacyFlat* flat = (LegacyFlat*)malloc(sizeof(LegacyFlat));
+    flat->size = FLAT_MIN_SIZE;
+    flat->len = 0;
+    flat->table = (flat_slot*)calloc(flat->size, sizeof(flat_slot));
+    return flat;
+}
+
+extern void free_legacy_flat(LegacyFlat* flat) {
+    for (size_t i = 0; i < flat->size; ++i) {
+        if (flat->table[i].hash != 0) {
+            free(flat->table[i].key);
+        }
+    }
+    free(flat->table);
+    free(flat);
+}
+
+extern void set_legacy_flat(LegacyFlat* flat, char* key, int32_t value) {
+    uint32_t hash = flat_hash(key);
+    int64_t found = flat_find(flat, key, hash);
+    if (found >= 0) {
+        flat->table[found].value = value;
+        return;
+    }
+    if ((flat->len + 1) * FLAT_LOAD_DEN > flat->size * FLAT_LOAD_NUM) {
+        flat_grow(flat);
+    }
+    size_t size = strlen(key);
+    flat_slot entry = { .hash = hash, .key = (char*)malloc(size + 1), .value = value };
+    memcpy(entry.key, key, size + 1);
+    flat_insert(flat, entry);
+    flat->len += 1;
+}
+
+extern int32_t get_legacy_flat(LegacyFlat* flat, char* key) {
+    int64_t found = flat_find(flat, key, flat_hash(key));
+    return found >= 0 ? flat->table[found].value : 0;
+}
+
+extern int8_t in_legacy_flat(LegacyFlat* flat, char* key) {
+    return flat_find(flat, key, flat_hash(key)) >= 0;
+}
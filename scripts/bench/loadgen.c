@@ -0,0 +1,490 @@
+// HTTP load generator
+// Each thread drives its share of the connections with ppoll. Closed loop:
+// every connection keeps `depth` requests in flight and sends the next one as
+// soon as a response arrives. Open loop: requests fall due at a constant rate
+// whatever the server does, and a request's latency counts from the time it
+// was due, not sent. A stall then shows up in every request scheduled during
+// it (coordinated-omission correction).
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "net.h"
+#include "metrics.h"
+
+#define LOAD_CONNS    64
+#define LOAD_SECONDS  10
+#define LOAD_MAXDEPTH 256        // Pipelined requests per connection
+#define LOAD_RBUF     (16 << 10) // Response heads must fit, bodies are skipped
+#define LOAD_WAIT     5000       // Ms to wait for the server to come up
+#define LOAD_REQUEST  512
+
+// What to run, from the command line
+typedef struct LoadOptions {
+    char* address;
+    char* path;
+    int32_t conns;
+    int32_t threads;
+    int32_t depth;      // Requests in flight per connection
+    int32_t seconds;
+    double rate;        // Requests per second of all threads, 0 for closed loop
+    int8_t keepalive;   // 0: one request per connection, then close
+    char request[LOAD_REQUEST];
+    size_t reqlen;
+} LoadOptions;
+
+// Client connection and the requests it has in flight
+typedef struct LoadConn {
+    int fd;             // -1 while disconnected
+    int64_t due[LOAD_MAXDEPTH]; // Ns each request in flight was due, oldest first
+    int32_t first;      // Index of the oldest request in due
+    int32_t inflight;
+    char* out;          // Request bytes the socket did not take yet
+    size_t outlen;
+    size_t outcap;
+    char rbuf[LOAD_RBUF];
+    size_t rlen;
+    uint8_t body;       // Skipping the body of a response
+    uint8_t closing;    // The server announced Connection: close
+    size_t left;        // Body bytes left to skip
+    int code;           // Status of the response being read
+    size_t size;        // Bytes of the response being read
+} LoadConn;
+
+// Thread driving a share of the connections, with its own results
+typedef struct LoadThread {
+    pthread_t thread;
+    LoadOptions* opt;
+    LoadConn* conns;
+    int32_t nconns;
+    double rate;        // Requests per second of this thread, 0 for closed loop
+    Histogram* latency; // Microseconds from due to the last response byte
+    uint64_t requests;  // Responses received
+    uint64_t sent;
+    uint64_t due;       // Open loop: requests that fell due
+    uint64_t bytes;
+    uint64_t errors;    // Refused connections and requests lost with theirs
+    uint64_t retried;   // Requests resent after the server closed a connection
+    uint64_t status[5];
+} LoadThread;
+
+// Monotonic time in nanoseconds
+static int64_t load_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Append the bytes of one request to the send buffer
+static void queue_load(LoadOptions* opt, LoadConn* conn) {
+    if (conn->outlen + opt->reqlen > conn->outcap) {
+        conn->outcap = (conn->outlen + opt->reqlen) * 2;
+        conn->out = (char*)realloc(conn->out, conn->outcap);
+    }
+    memcpy(conn->out + conn->outlen, opt->request, opt->reqlen);
+    conn->outlen += opt->reqlen;
+}
+
+// Connect a client socket: non-blocking, without Nagle delays for pipelining
+// Requests carried over from a connection the server closed are resent with
+// their original due times. Returns -1 if the server refused it
+static int open_load(LoadThread* t, LoadConn* conn) {
+    int fd = connect_net(t->opt->address);
+    if (fd < 0) {
+        t->errors += 1;
+        return -1;
+    }
+    nodelay_net(fd, 1);
+    nonblock_net(fd);
+    conn->fd = fd;
+    conn->outlen = 0;
+    conn->rlen = 0;
+    conn->body = 0;
+    conn->closing = 0;
+    for (int32_t i = 0; i < conn->inflight; ++i) {
+        queue_load(t->opt, conn);
+    }
+    return 0;
+}
+
+// Close a connection. Requests in flight after a Connection: close are kept
+// for the next one, on any other close they are lost
+static void close_load(LoadThread* t, LoadConn* conn) {
+    if (conn->closing) {
+        t->retried += conn->inflight;
+    } else {
+        t->errors += conn->inflight;
+        conn->first = 0;
+        conn->inflight = 0;
+    }
+    close_net(conn->fd);
+    conn->fd = -1;
+}
+
+// Queue a request due at the given time
+static void send_load(LoadThread* t, LoadConn* conn, int64_t due) {
+    queue_load(t->opt, conn);
+    conn->due[(conn->first + conn->inflight) % LOAD_MAXDEPTH] = due;
+    conn->inflight += 1;
+    t->sent += 1;
+}
+
+// Write queued requests, returns -1 if the connection failed
+static int flush_load(LoadConn* conn) {
+    size_t off = 0;
+    while (off < conn->outlen) {
+        int n = send_net(conn->fd, conn->out + off, conn->outlen - off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        off += (size_t)n;
+    }
+    memmove(conn->out, conn->out + off, conn->outlen - off);
+    conn->outlen -= off;
+    return 0;
+}
+
+// Value of a header in a response head, NULL without one
+static char* header_load(char* head, size_t size, const char* name) {
+    size_t len = strlen(name);
+    char* end = head + size;
+    for (char* p = head; p + len + 1 < end; ++p) {
+        if (p[0] == '\n' && strncasecmp(p + 1, name, len) == 0 && p[len + 1] == ':') {
+            char* value = p + len + 2;
+            while (*value == ' ') {
+                ++value;
+            }
+            return value;
+        }
+    }
+    return NULL;
+}
+
+// Take a complete response: latency from its due time, status class, size
+static void done_load(LoadThread* t, LoadConn* conn, int64_t now) {
+    int64_t due = conn->due[conn->first];
+    conn->first = (conn->first + 1) % LOAD_MAXDEPTH;
+    conn->inflight -= 1;
+    record_histogram(t->latency, (uint64_t)(now - due) / 1000);
+    t->requests += 1;
+    t->bytes += conn->size;
+    if (conn->code >= 100 && conn->code < 600) {
+        t->status[conn->code / 100 - 1] += 1;
+    }
+}
+
+// Parse the responses in the receive buffer, returns -1 on a response that
+// cannot be framed
+static int parse_load(LoadThread* t, LoadConn* conn, int64_t now) {
+    size_t pos = 0;
+    while (pos < conn->rlen) {
+        if (conn->body) {
+            size_t take = conn->rlen - pos < conn->left ? conn->rlen - pos : conn->left;
+            pos += take;
+            conn->left -= take;
+            if (conn->left > 0) {
+                break;
+            }
+            conn->body = 0;
+            done_load(t, conn, now);
+            continue;
+        }
+        char* head = conn->rbuf + pos;
+        char* end = memmem(head, conn->rlen - pos, "\r\n\r\n", 4);
+        if (end == NULL) {
+            if (pos == 0 && conn->rlen == sizeof(conn->rbuf)) {
+                return -1; // Head larger than the buffer
+            }
+            break;
+        }
+        size_t headlen = (size_t)(end - head) + 4;
+        char* value = header_load(head, headlen, "content-length");
+        long length = value != NULL ? strtol(value, NULL, 10) : -1;
+        if (headlen < 12 || memcmp(head, "HTTP/1.", 7) != 0 || length < 0 || conn->inflight == 0) {
+            return -1;
+        }
+        value = header_load(head, headlen, "connection");
+        if (value != NULL && strncasecmp(value, "close", 5) == 0) {
+            conn->closing = 1;
+        }
+        conn->code = (head[9] - '0') * 100 + (head[10] - '0') * 10 + (head[11] - '0');
+        conn->size = headlen + (size_t)length;
+        conn->left = (size_t)length;
+        conn->body = 1;
+        pos += headlen;
+    }
+    if (conn->body && conn->left == 0) {
+        conn->body = 0;
+        done_load(t, conn, now);
+    }
+    memmove(conn->rbuf, conn->rbuf + pos, conn->rlen - pos);
+    conn->rlen -= pos;
+    return 0;
+}
+
+// Read everything available, returns -1 once the connection is gone
+static int read_load(LoadThread* t, LoadConn* conn) {
+    while (1) {
+        int n = recv_net(conn->fd, conn->rbuf + conn->rlen, sizeof(conn->rbuf) - conn->rlen);
+        if (n == 0) {
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        conn->rlen += (size_t)n;
+        if (parse_load(t, conn, load_now()) != 0) {
+            return -1;
+        }
+    }
+}
+
+// Fill the free pipeline slots: now in closed loop, with the requests that
+// fell due in open loop, spread over the connections with room
+static void fill_load(LoadThread* t, int64_t start, int64_t now) {
+    LoadOptions* opt = t->opt;
+    int32_t depth = opt->keepalive ? opt->depth : 1;
+    if (t->rate > 0) {
+        double interval = 1e9 / t->rate;
+        t->due = (uint64_t)((double)(now - start) / interval) + 1;
+        for (int32_t i = 0; i < t->nconns && t->sent < t->due; ++i) {
+            LoadConn* conn = &t->conns[(t->sent + i) % t->nconns];
+            if ((conn->fd < 0 && open_load(t, conn) != 0) || conn->closing) {
+                continue;
+            }
+            while (conn->inflight < depth && t->sent < t->due) {
+                send_load(t, conn, start + (int64_t)((double)t->sent * interval));
+            }
+        }
+        return;
+    }
+    for (int32_t i = 0; i < t->nconns; ++i) {
+        LoadConn* conn = &t->conns[i];
+        if ((conn->fd < 0 && open_load(t, conn) != 0) || conn->closing) {
+            continue;
+        }
+        while (conn->inflight < depth) {
+            send_load(t, conn, now);
+        }
+    }
+}
+
+// Thread body: run the connections until the duration is over
+static void* run_load(void* arg) {
+    LoadThread* t = (LoadThread*)arg;
+    LoadOptions* opt = t->opt;
+    struct pollfd* fds = (struct pollfd*)malloc((size_t)t->nconns * sizeof(struct pollfd));
+    int64_t start = load_now();
+    int64_t end = start + (int64_t)opt->seconds * 1000000000;
+    int64_t now = start;
+    while (now < end) {
+        fill_load(t, start, now);
+        for (int32_t i = 0; i < t->nconns; ++i) {
+            LoadConn* conn = &t->conns[i];
+            if (conn->fd >= 0 && conn->outlen > 0 && flush_load(conn) != 0) {
+                close_load(t, conn);
+            }
+            fds[i].fd = conn->fd;
+            fds[i].events = POLLIN | (conn->outlen > 0 ? POLLOUT : 0);
+            fds[i].revents = 0;
+        }
+        int64_t wake = end;
+        if (t->rate > 0) {
+            int64_t next = start + (int64_t)((double)t->due * 1e9 / t->rate);
+            wake = next < wake ? next : wake;
+        }
+        int64_t wait = wake > now ? wake - now : 0;
+        struct timespec timeout = { wait / 1000000000, wait % 1000000000 };
+        if (ppoll(fds, (nfds_t)t->nconns, &timeout, NULL) < 0 && errno != EINTR) {
+            break;
+        }
+        for (int32_t i = 0; i < t->nconns; ++i) {
+            LoadConn* conn = &t->conns[i];
+            if (conn->fd < 0 || fds[i].revents == 0) {
+                continue;
+            }
+            if (read_load(t, conn) != 0) {
+                close_load(t, conn);
+            } else if ((conn->closing || !opt->keepalive) && conn->inflight == 0) {
+                close_load(t, conn); // Response complete, next request on a new connection
+            }
+        }
+        now = load_now();
+    }
+    for (int32_t i = 0; i < t->nconns; ++i) {
+        if (t->conns[i].fd >= 0) {
+            close_net(t->conns[i].fd); // Requests in flight at the end are not counted
+        }
+        free(t->conns[i].out);
+    }
+    free(fds);
+    return NULL;
+}
+
+// Wait until the server accepts connections, returns -1 after LOAD_WAIT ms
+static int wait_load(char* address) {
+    for (int i = 0; i < LOAD_WAIT / 10; ++i) {
+        int fd = connect_net(address);
+        if (fd >= 0) {
+            close_net(fd);
+            return 0;
+        }
+        usleep(10000);
+    }
+    return -1;
+}
+
+// Print the results of all threads
+static void report_load(LoadOptions* opt, LoadThread* threads, int64_t elapsed) {
+    uint64_t counts[HIST_BUCKETS] = {0};
+    uint64_t sum = 0;
+    uint64_t requests = 0, bytes = 0, errors = 0, retried = 0, sent = 0, due = 0;
+    uint64_t status[5] = {0};
+    for (int32_t i = 0; i < opt->threads; ++i) {
+        merge_histogram(counts, &sum, threads[i].latency);
+        requests += threads[i].requests;
+        bytes += threads[i].bytes;
+        errors += threads[i].errors;
+        retried += threads[i].retried;
+        sent += threads[i].sent;
+        due += threads[i].due;
+        for (int c = 0; c < 5; ++c) {
+            status[c] += threads[i].status[c];
+        }
+    }
+    double seconds = (double)elapsed / 1e9;
+    printf("%s  %s%s  connections %d  threads %d  depth %d  keep-alive %s  duration %d s\n",
+        opt->rate > 0 ? "open-loop" : "closed-loop", opt->address, opt->path, (int)opt->conns,
+        (int)opt->threads, (int)opt->depth, opt->keepalive ? "on" : "off", (int)opt->seconds);
+    if (opt->rate > 0) {
+        printf("  target     %.0f req/s  due %llu  sent %llu\n", opt->rate,
+            (unsigned long long)due, (unsigned long long)sent);
+    }
+    printf("  requests   %llu  throughput %.1f req/s  transfer %.2f MB/s\n", (unsigned long long)requests,
+        (double)requests / seconds, (double)bytes / seconds / (1 << 20));
+    printf("  responses  1xx %llu  2xx %llu  3xx %llu  4xx %llu  5xx %llu  errors %llu  retried %llu\n",
+        (unsigned long long)status[0], (unsigned long long)status[1], (unsigned long long)status[2],
+        (unsigned long long)status[3], (unsigned long long)status[4], (unsigned long long)errors,
+        (unsigned long long)retried);
+    printf("  latency    mean %.0f us  p50 %llu us  p90 %llu us  p99 %llu us  p999 %llu us  max %llu us\n",
+        requests > 0 ? (double)sum / (double)requests : 0.0,
+        (unsigned long long)quantile_histogram(counts, 0.5), (unsigned long long)quantile_histogram(counts, 0.9),
+        (unsigned long long)quantile_histogram(counts, 0.99), (unsigned long long)quantile_histogram(counts, 0.999),
+        (unsigned long long)quantile_histogram(counts, 1.0));
+}
+
+// Print the command line options
+static void usage_load(char* name) {
+    fprintf(stderr, "usage: %s [options] host:port\n"
+        "  -c N     connections (default %d)\n"
+        "  -t N     threads (default one per online CPU)\n"
+        "  -d S     duration in seconds (default %d)\n"
+        "  -p N     pipelined requests per connection (default 1, at most %d)\n"
+        "  -r R     open loop at R requests per second (default closed loop)\n"
+        "  -k 0|1   keep-alive, 0 opens a connection per request (default 1)\n"
+        "  -u PATH  request target (default /)\n"
+        "Latencies are log-bucketed and reported as bucket maxima, within 1/%d.\n",
+        name, LOAD_CONNS, LOAD_SECONDS, LOAD_MAXDEPTH, HIST_SUB);
+}
+
+// Entry point: parse options, run the threads, report
+int main(int argc, char** argv) {
+    LoadOptions opt = { .path = "/", .conns = LOAD_CONNS, .threads = 0, .depth = 1,
+        .seconds = LOAD_SECONDS, .rate = 0, .keepalive = 1 };
+    for (int i = 1; i < argc; ++i) {
+        char* arg = argv[i];
+        char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (arg[0] != '-') {
+            opt.address = arg;
+            continue;
+        }
+        if (value == NULL || arg[2] != '\0') {
+            usage_load(argv[0]);
+            return 2;
+        }
+        switch (arg[1]) {
+            case 'c': opt.conns = atoi(value); break;
+            case 't': opt.threads = atoi(value); break;
+            case 'd': opt.seconds = atoi(value); break;
+            case 'p': opt.depth = atoi(value); break;
+            case 'r': opt.rate = atof(value); break;
+            case 'k': opt.keepalive = atoi(value) != 0; break;
+            case 'u': opt.path = value; break;
+            default: usage_load(argv[0]); return 2;
+        }
+        i += 1;
+    }
+    if (opt.address == NULL || opt.conns <= 0 || opt.seconds <= 0 || opt.depth <= 0
+        || opt.depth > LOAD_MAXDEPTH || opt.rate < 0) {
+        usage_load(argv[0]);
+        return 2;
+    }
+    if (opt.threads <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        opt.threads = ncpu > 0 ? (int32_t)ncpu : 1;
+    }
+    opt.threads = opt.threads < opt.conns ? opt.threads : opt.conns;
+    int len = snprintf(opt.request, sizeof(opt.request), "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n",
+        opt.path, opt.address, opt.keepalive ? "" : "Connection: close\r\n");
+    if (len < 0 || (size_t)len >= sizeof(opt.request)) {
+        fprintf(stderr, "%s: request target too long\n", argv[0]);
+        return 2;
+    }
+    opt.reqlen = (size_t)len;
+    if (wait_load(opt.address) != 0) {
+        fprintf(stderr, "%s: %s not reachable\n", argv[0], opt.address);
+        return 1;
+    }
+    LoadThread* threads = (LoadThread*)calloc((size_t)opt.threads, sizeof(LoadThread));
+    LoadConn* conns = (LoadConn*)calloc((size_t)opt.conns, sizeof(LoadConn));
+    int32_t given = 0;
+    for (int32_t i = 0; i < opt.threads; ++i) {
+        LoadThread* t = &threads[i];
+        t->opt = &opt;
+        t->nconns = opt.conns / opt.threads + (i < opt.conns % opt.threads);
+        t->conns = conns + given;
+        given += t->nconns;
+        t->rate = opt.rate / opt.threads;
+        t->latency = (Histogram*)calloc(1, sizeof(Histogram));
+        for (int32_t c = 0; c < t->nconns; ++c) {
+            t->conns[c].fd = -1;
+        }
+    }
+    int64_t start = load_now();
+    int32_t started = 0;
+    for (; started < opt.threads; ++started) {
+        if (pthread_create(&threads[started].thread, NULL, run_load, &threads[started]) != 0) {
+            break;
+        }
+    }
+    for (int32_t i = 0; i < started; ++i) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    opt.threads = started;
+    report_load(&opt, threads, load_now() - start);
+    uint64_t requests = 0;
+    for (int32_t i = 0; i < started; ++i) {
+        requests += threads[i].requests;
+        free(threads[i].latency);
+    }
+    free(conns);
+    free(threads);
+    return requests > 0 ? 0 : 1;
+}
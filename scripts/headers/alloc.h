@@ -0,0 +1,19 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+#include <stdlib.h>
+
+// Allocation counting for the test and microbenchmark binaries.
+// scripts/bench/alloc.c replaces the malloc family of glibc; it is built and
+// linked only with -DALLOC_HOOK, never into the server. The hook is left out
+// where glibc is missing or a sanitizer owns malloc.
+
+#if defined(ALLOC_HOOK) && (!defined(__GLIBC__) || defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__))
+#undef ALLOC_HOOK
+#endif
+
+#ifdef ALLOC_HOOK
+extern _Atomic int alloc_counting; // Calls are counted while set
+extern _Atomic long alloc_count;   // Calls counted so far
+#endif
+
+#endif /* ALLOC_H */
@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stdint.h>
+#include <stddef.h>
+
+// Bump allocator for memory that lives as long as one request
+// Everything allocated from an arena is released at once by reset_arena.
+typedef struct Arena Arena;
+
+// Free list of reset arenas, one per worker
+typedef struct ArenaPool ArenaPool;
+
+extern Arena* new_arena(size_t size);
+extern void free_arena(Arena* arena);
+extern void* alloc_arena(Arena* arena, size_t size);
+extern void reset_arena(Arena* arena);
+extern size_t used_arena(Arena* arena);
+
+extern ArenaPool* new_pool(size_t size, size_t keep);
+extern void free_pool(ArenaPool* pool);
+extern Arena* get_pool(ArenaPool* pool);
+extern void put_pool(ArenaPool* pool, Arena* arena);
+
+#endif /* ARENA_H */
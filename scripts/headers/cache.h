@@ -0,0 +1,38 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+typedef struct Cache Cache;
+
+// Cached static file with its response header blocks ready to send
+typedef struct CacheEntry {
+    char* path;         // Key the entry is stored under
+    char* body;         // File contents
+    size_t size;        // Body length
+    char* head;         // Entity headers following the status and Date lines (keep-alive)
+    size_t headsz;
+    char* hclose;       // Same headers with "Connection: close"
+    size_t hclosesz;
+    int32_t refs;       // Holders: the cache itself and queued responses
+    int32_t slot;       // Index in the cache slot array, -1 once dropped
+    int wd;             // inotify watch descriptor, -1 if not watched
+    uint64_t dev;       // File identity and version for stat revalidation
+    uint64_t ino;
+    struct timespec mtime;
+    int64_t checked;    // Last stat revalidation, monotonic seconds
+    struct CacheEntry* prev; // LRU neighbours, most recently used first
+    struct CacheEntry* next;
+} CacheEntry;
+
+extern Cache* new_cache(size_t budget);
+extern void free_cache(Cache* cache);
+extern CacheEntry* get_cache(Cache* cache, char* path);
+extern void hold_cache(CacheEntry* entry);
+extern void release_cache(CacheEntry* entry);
+extern int fd_cache(Cache* cache);
+extern void events_cache(Cache* cache);
+extern size_t used_cache(Cache* cache);
+
+#endif /* CACHE_H */
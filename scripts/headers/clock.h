@@ -0,0 +1,16 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+#include <stdint.h>
+#include <stddef.h>
+
+// Wall clock shared by all threads
+// The Date header and log timestamp strings are formatted once per second by
+// whichever thread first sees the second change; everyone else copies them.
+#define CLOCK_DATE  30 // "Sun, 06 Nov 1994 08:49:37 GMT" and the terminator
+#define CLOCK_STAMP 20 // "1994-11-06 09:49:37" local time and the terminator
+
+extern int64_t now_clock(void);
+extern size_t date_clock(char* buf);
+extern size_t stamp_clock(char* buf);
+
+#endif /* CLOCK_H */
@@ -0,0 +1,51 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+#include <stdint.h>
+#include <stddef.h>
+#include "logger.h"
+
+#define CONFIG_FILE   "setings.yaml" // Read at startup unless another file is given
+#define CONFIG_HOST   64
+#define CONFIG_NAME   64
+#define CONFIG_PATH   256
+#define CONFIG_ROUTES 32
+
+// Route of the routes list, handler names a function registered by main
+typedef struct ConfigRoute {
+    char path[CONFIG_PATH];
+    char handler[CONFIG_NAME];
+} ConfigRoute;
+
+// Server configuration, see setings.yaml for the meaning of each value
+// Keys missing from the file keep the defaults of default_config
+typedef struct Config {
+    char host[CONFIG_HOST];
+    int32_t port;
+    int32_t backlog;           // Pending connections per listener, 0 for SOMAXCONN
+    int32_t timeout;           // Seconds to receive a request or send a response
+    int32_t workers;           // Worker threads, 0 for one per online CPU
+    int8_t backend;            // HTTP_EPOLL or HTTP_URING
+    int32_t max_connections;   // Open connections of the server, 0 for no limit
+    int32_t queue_delay;       // Ms a request may queue before others are shed, 0 never sheds
+    int32_t retry_after;       // Retry-After seconds of shed requests
+    size_t buffer_size;        // Receive buffer of a connection
+    size_t max_request_size;   // Request line and headers
+    size_t max_body_size;
+    size_t cache_size;         // Asset cache per worker, 0 disables it
+    int8_t keep_alive;
+    int32_t keep_alive_timeout;
+    int32_t max_keep_alive_requests;
+    char server_header[CONFIG_NAME]; // Server header of responses, empty for none
+    size_t max_uri_length;
+    int32_t max_headers;
+    int8_t disable_trace;
+    log_level_t log_level;
+    char log_file[CONFIG_PATH];
+    ConfigRoute routes[CONFIG_ROUTES];
+    int32_t nroutes;
+} Config;
+
+extern void default_config(Config* config);
+extern int8_t load_config(Config* config, const char* path);
+
+#endif /* CONFIG_H */
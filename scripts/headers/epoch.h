@@ -0,0 +1,31 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Epoch-based reclamation for data published by an atomic pointer swap.
+// Readers wrap every access in enter_epoch/leave_epoch, two stores with no
+// loop or lock, so lookups are wait-free. A writer swaps the pointer, then
+// hands the old object to retire_epoch; it is destroyed once no reader can
+// still hold it. Writers must be serialized by the caller. Read sections do
+// not nest.
+
+typedef struct Epoch Epoch;
+
+// Reader record of one thread, see reader_epoch
+typedef struct EpochReader {
+    _Atomic uint64_t epoch;   // Epoch seen on entering, 0 outside a read section
+    struct EpochReader* next; // Records of the other threads
+    void* owner;              // Thread the record belongs to
+} EpochReader;
+
+extern Epoch* new_epoch(void);
+extern void free_epoch(Epoch* epoch);
+extern EpochReader* reader_epoch(Epoch* epoch);
+extern void enter_epoch(Epoch* epoch, EpochReader* reader);
+extern void leave_epoch(EpochReader* reader);
+extern void retire_epoch(Epoch* epoch, void* ptr, void (*destroy)(void*));
+extern size_t reclaim_epoch(Epoch* epoch);
+
+#endif /* EPOCH_H */
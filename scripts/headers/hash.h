@@ -8,13 +8,16 @@
 #include "type.h"
 
 typedef struct HashTab HashTab;
+typedef struct Intern Intern;
 
 extern HashTab *new_hashtab(size_t size, vtype_t key, vtype_t value);
 extern void free_hashtab(HashTab *hashtab);
 extern value_t get_hashtab(HashTab *hashtab, void *key);
 extern int8_t set_hashtab(HashTab *hashtab, void *key, void *value);
+extern int8_t set_real_hashtab(HashTab *hashtab, void *key, double value);
 extern void del_hashtab(HashTab *hashtab, void *key);
 extern bool in_hashtab(HashTab *hashtab, void *key);
+extern int8_t intern_hashtab(HashTab *hashtab, Intern *intern);
 extern bool eq_hashtab(HashTab *x, HashTab *y);
 extern size_t size_hashtab(HashTab *hashtab);
 extern size_t sizeof_hashtab(void);
@@ -23,4 +26,9 @@ extern void println_hashtab(HashTab *hashtab);
 extern void print_hashtab_format(HashTab *hashtab);
 extern void println_hashtab_format(HashTab *hashtab);
 
+extern Intern *new_intern(size_t size);
+extern void free_intern(Intern *intern);
+extern char *get_intern(Intern *intern, char *string);
+extern size_t size_intern(Intern *intern);
+
 #endif /* EXTCLIB_HASHTAB_H_ */
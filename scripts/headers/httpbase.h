@@ -3,19 +3,110 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#define PARSE_DONE  5 // HTTPrequests.state once the request head is parsed
+#define PARSE_ERROR 6 // HTTPrequests.state for a malformed request, see error
+#define BODY_DONE   7 // HTTPrequests.bstate once the whole body was read
+#define BODY_ERROR  8 // HTTPrequests.bstate for bad chunk framing or a body over the limit
+#define HTTP_HEADERS 32 // Header fields kept per request
+#define HTTP_PARAMS  8  // ":name" route parameters kept per request
+#define HTTP_EPOLL 0    // Readiness event loop, see backend_http
+#define HTTP_URING 1    // io_uring completion loop
+
 typedef struct HTTP HTTP;
+
+// Response being built by a handler, see start_response
+typedef struct HTTPresponse HTTPresponse;
+
+// Bytes of the raw request in the receive buffer, not NUL-terminated
+typedef struct HTTPview{
+    char* ptr;
+    size_t len;
+} HTTPview;
+
+// Header field as views into the raw request
+typedef struct HTTPheader{
+    HTTPview name;
+    HTTPview value;
+} HTTPheader;
+
+// Parser limits, see security and performance sections of setings.yaml
+typedef struct HTTPlimits{
+    size_t uri;      // Maximum request-target length
+    size_t headers;  // Maximum number of header fields
+    size_t head;     // Maximum size of request line and headers
+    size_t body;     // Maximum request body size, checked while it streams
+} HTTPlimits;
+
+// Parsed request, valid while the receive buffer is left untouched
 typedef struct HTTPrequests{
-    char method[16]; // Reserve 16 bytes for HTTP method
-    char path[2048]; // Reserve 2048 bytes for path (not 2MB!)
-    char prot[16];
+    HTTPview method;
+    HTTPview path;
+    HTTPview prot;
+    char* base;      // Buffer the views point into, moved views are rebased
+    const HTTPlimits* limits; // NULL for the setings.yaml defaults
     uint8_t state;
-    size_t ind;
+    uint8_t nheaders;
+    uint8_t nparams;
+    int8_t conn;     // Connection header: -1 close, 1 keep-alive, 0 absent
+    uint8_t chunked; // Transfer-Encoding: chunked
+    uint8_t length;  // A Content-Length header was given, clen holds it
+    uint8_t bstate;  // Body decoder state, see body_request
+    uint16_t error;  // Status to answer with in PARSE_ERROR or BODY_ERROR
+    size_t ind;      // Scan position from the request start
+    size_t mark;     // Start of the token being scanned
+    size_t clen;     // Content-Length of the body
+    size_t left;     // Bytes left in the body or the current chunk
+    size_t body;     // Body bytes decoded so far
+    // Set by a handler to receive the body as it arrives. Called once per
+    // received piece, whose bytes are valid during the call only, then once
+    // with an empty view when bstate is BODY_DONE or BODY_ERROR
+    void (*onbody)(int connect, struct HTTPrequests* request, HTTPview data);
+    void* user;      // Handler state kept while the body streams
+    HTTPheader params[HTTP_PARAMS];   // Route parameters, set by switch_http
+    HTTPheader headers[HTTP_HEADERS]; // Only the first nheaders are set
 } HTTPrequests;
 
 extern HTTP* new_http(char* address);
 extern void freehttp(HTTP* http);
+extern void workers_http(HTTP* http, int32_t workers);
+extern void keepalive_http(HTTP* http, int32_t idle, int32_t maxreq);
+extern void cache_http(HTTP* http, size_t budget);
+extern void backlog_http(HTTP* http, int32_t backlog);
+extern void timeout_http(HTTP* http, int32_t timeout);
+extern void connections_http(HTTP* http, int32_t maxconn);
+extern void overload_http(HTTP* http, int32_t delay, int32_t retry);
+extern void buffers_http(HTTP* http, size_t size);
+extern void server_http(HTTP* http, char* name);
+extern void trace_http(HTTP* http, int8_t allow);
+extern int8_t backend_http(HTTP* http, int8_t backend);
+extern void stats_http(HTTP* http, uint64_t* requests, uint64_t* calls);
+extern void admission_http(HTTP* http, uint64_t* admitted, uint64_t* shed);
+extern void limits_http(HTTP* http, size_t uri, size_t headers, size_t head, size_t body);
 extern void handle_http(HTTP* http, char* path, void(*)(int, HTTPrequests*));
-extern int8_t listen(HTTP* http);
+extern int8_t unhandle_http(HTTP* http, char* path);
+extern int8_t listen_http(HTTP* http);
+extern void* alloc_http(int connect, size_t size);
+extern void send_http(int connect, char* buf, size_t size);
+extern int8_t closing_http(int connect);
 extern void htmlparse_http(int connect, char* name);
+extern void metrics_http(int connect);
+extern void status_http(int connect);
+
+extern HTTPresponse* start_response(int connect, int code, char* reason);
+extern void status_response(HTTPresponse* res, int code, char* reason);
+extern void header_response(HTTPresponse* res, char* name, char* value);
+extern void data_response(HTTPresponse* res, char* ptr, size_t size);
+extern void static_response(HTTPresponse* res, char* ptr, size_t size);
+extern void range_response(HTTPresponse* res, int file, size_t off, size_t size);
+extern int8_t file_response(HTTPresponse* res, char* path);
+extern void end_response(HTTPresponse* res);
+
+extern void reset_request(HTTPrequests* request, const HTTPlimits* limits);
+extern size_t parse_request(HTTPrequests* request, char* buffer, size_t size);
+extern size_t body_request(HTTPrequests* request, char* buffer, size_t size, HTTPview* data);
+extern HTTPview header_request(HTTPrequests* request, char* name);
+extern HTTPview param_request(HTTPrequests* request, char* name);
+extern int8_t equal_view(HTTPview view, char* str);
+extern int8_t switch_http(HTTP* http, int conn, HTTPrequests* request);
 
 #endif /* HTTP_BASE_H */
\ No newline at end of file
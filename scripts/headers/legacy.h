@@ -0,0 +1,46 @@
+#ifndef LEGACY_H
+#define LEGACY_H
+#include <stddef.h>
+#include <stdint.h>
+#include "hash.h"
+
+// Implementations the server replaced, kept in scripts/bench/legacy.c so the
+// microbenchmarks can run the current ones against them. Never linked into
+// the server.
+
+#define LEGACY_PATH 2048 // Route key buffer of the previous switch_http
+
+// Request state of the byte-at-a-time parser the server used before
+typedef struct legacy_request {
+    char method[16];
+    char path[LEGACY_PATH];
+    char prot[16];
+    char hline[64];
+    uint8_t state;
+    size_t ind;
+} legacy_request;
+
+// Hash table the server used before the flat one: a search tree per bucket
+typedef struct LegacyTab LegacyTab;
+
+// Flat Robin Hood table as it was before seeded hashing: unseeded FNV-1a
+// over string keys, decimal values
+typedef struct LegacyFlat LegacyFlat;
+
+extern size_t legacy_parse(legacy_request* request, char* buffer, size_t size);
+
+extern int32_t legacy_route(HashTab* tab, char* path);
+
+extern LegacyTab* new_legacy_tab(size_t buckets);
+extern void free_legacy_tab(LegacyTab* tab);
+extern void set_legacy_tab(LegacyTab* tab, char* key, int32_t value);
+extern int32_t get_legacy_tab(LegacyTab* tab, char* key);
+extern int8_t in_legacy_tab(LegacyTab* tab, char* key);
+
+extern LegacyFlat* new_legacy_flat(void);
+extern void free_legacy_flat(LegacyFlat* flat);
+extern void set_legacy_flat(LegacyFlat* flat, char* key, int32_t value);
+extern int32_t get_legacy_flat(LegacyFlat* flat, char* key);
+extern int8_t in_legacy_flat(LegacyFlat* flat, char* key);
+
+#endif /* LEGACY_H */
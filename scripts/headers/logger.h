@@ -1,14 +1,22 @@
 #ifndef LOGGER_H
 #define LOGGER_H
+#include <stddef.h>
 
 // Log level enumeration
 typedef enum { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR } log_level_t;
 
-// Initialize logger with file and minimum log level
+// What a thread does when its log ring is full
+typedef enum { LOG_DROP, LOG_BLOCK } log_policy_t;
+
+// Set overflow policy and per-thread ring size (messages), before log_init
+void log_config(log_policy_t policy, size_t slots);
+// Initialize logger with file and minimum log level, starts the flush thread
 void log_init(const char *filename, log_level_t min_level);
 // Write a log message with specified level and format
 void log_write(log_level_t level, const char *fmt, ...);
-// Close the logger and file
+// Number of messages dropped because a ring was full
+unsigned long log_dropped(void);
+// Flush pending messages, stop the flush thread and close the file
 void log_close(void);
 
 // Convenience macros for each log level
@@ -17,4 +25,4 @@ void log_close(void);
 #define LOG_WARN(...)  log_write(LOG_WARN, __VA_ARGS__)
 #define LOG_ERROR(...) log_write(LOG_ERROR, __VA_ARGS__)
 
-#endif // LOGGER_H
\ No newline at end of file
+#endif // LOGGER_H
@@ -0,0 +1,21 @@
+#ifndef LOOP_H
+#define LOOP_H
+#include <stdint.h>
+#include <stddef.h>
+
+// Readiness flags reported for a registered descriptor
+#define LOOP_READ  0x01
+#define LOOP_WRITE 0x02
+#define LOOP_CLOSE 0x04 // Peer hung up or socket error
+
+typedef struct Loop Loop;
+
+extern Loop* new_loop(size_t cap);
+extern void free_loop(Loop* loop);
+extern int add_loop(Loop* loop, int fd, uint8_t flags, void* data);
+extern int del_loop(Loop* loop, int fd);
+extern int wait_loop(Loop* loop, int timeout);
+extern void* data_loop(Loop* loop, int index);
+extern uint8_t flags_loop(Loop* loop, int index);
+
+#endif /* LOOP_H */
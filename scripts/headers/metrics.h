@@ -0,0 +1,41 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Log-bucketed histogram in the style of HdrHistogram: every power of two is
+// split into HIST_SUB linear buckets, so a recorded value is known to within
+// 1/HIST_SUB of itself from 1 up to 2^HIST_TOP. Larger values land in the
+// last bucket.
+#define HIST_SHIFT   3 // log2 of HIST_SUB
+#define HIST_SUB     (1 << HIST_SHIFT)
+#define HIST_TOP     36
+#define HIST_BUCKETS ((HIST_TOP - HIST_SHIFT + 1) * HIST_SUB)
+
+// Histogram with a single writer, see record_histogram
+// Readers on other threads may see a value in sum before its bucket
+typedef struct Histogram {
+    _Atomic uint64_t counts[HIST_BUCKETS];
+    _Atomic uint64_t sum;
+} Histogram;
+
+// Text being built for a response, see print_text
+typedef struct Text {
+    char* buf;
+    size_t len;
+    size_t cap;
+} Text;
+
+extern void record_histogram(Histogram* hist, uint64_t value);
+extern void merge_histogram(uint64_t* counts, uint64_t* sum, Histogram* hist);
+extern size_t bucket_histogram(uint64_t value);
+extern uint64_t below_histogram(const uint64_t* counts, uint32_t power);
+extern uint64_t quantile_histogram(const uint64_t* counts, double q);
+extern void bump_counter(_Atomic uint64_t* counter, uint64_t n);
+
+extern void print_text(Text* text, const char* fmt, ...);
+extern void label_text(Text* text, const char* value);
+extern void free_text(Text* text);
+
+#endif /* METRICS_H */
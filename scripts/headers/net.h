@@ -2,11 +2,28 @@
 #define NET_H
 #include <stddef.h>
 
-extern int listen_net(char* address);
+#ifdef __linux__
+#include <sys/uio.h>
+#else
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+#endif
+
+extern int listen_net(char* address, int backlog);
+extern int listen_reuseport_net(char* address, int backlog);
 extern int accept_net(int listener);
+extern int accept_nonblock_net(int listener);
+extern int nonblock_net(int connect);
 extern int connect_net(char* address);
 extern int close_net(int connect);
 extern int send_net(int connect, char* buf, size_t size);
 extern int recv_net(int connect, char* buf, size_t size); 
+extern int writev_net(int connect, struct iovec* iov, int count);
+extern int sendfile_net(int connect, int file, size_t* offset, size_t size);
+extern int cork_net(int connect, int on);
+extern int nodelay_net(int connect, int on);
+extern int timeout_net(int connect, int seconds);
 
 #endif /* NET_H*/
\ No newline at end of file
@@ -0,0 +1,28 @@
+#ifndef RING_H
+#define RING_H
+#include <stdint.h>
+#include <stddef.h>
+
+// Completion-based I/O on io_uring, the counterpart of loop.h
+// Requests are queued as SQEs and submitted in batches with one system call
+// that also waits for completions. Sockets live in a table of registered
+// descriptors and receives pick buffers from a ring shared with the kernel.
+#ifdef __linux__
+#include <linux/io_uring.h>
+
+typedef struct Ring Ring;
+
+extern Ring* new_ring(uint32_t entries, uint32_t files);
+extern void free_ring(Ring* ring);
+extern struct io_uring_sqe* sqe_ring(Ring* ring);
+extern uint32_t space_ring(Ring* ring);
+extern int submit_ring(Ring* ring, uint32_t wait, int timeout);
+extern struct io_uring_cqe* cqe_ring(Ring* ring);
+extern void seen_ring(Ring* ring);
+extern int bufs_ring(Ring* ring, uint32_t count, uint32_t size);
+extern char* buf_ring(Ring* ring, uint32_t bid);
+extern void recycle_ring(Ring* ring, uint32_t bid);
+extern uint64_t calls_ring(Ring* ring);
+#endif
+
+#endif /* RING_H */
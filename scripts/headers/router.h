@@ -0,0 +1,18 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+#include <stdint.h>
+#include <stddef.h>
+#include "httpbase.h"
+
+// Compressed radix tree mapping route patterns to values
+// A pattern is matched exactly, a pattern ending with '/' also matches every
+// path below it (longest prefix wins) and a ":name" segment matches any
+// non-empty segment, its value is reported as a parameter.
+typedef struct Router Router;
+
+extern Router* new_router(void);
+extern void free_router(Router* router);
+extern int8_t add_router(Router* router, char* pattern, int32_t value);
+extern int32_t match_router(Router* router, HTTPview path, HTTPheader* params, uint8_t* nparams);
+
+#endif /* ROUTER_H */
@@ -7,12 +7,15 @@
 #include "type.h"
 
 typedef struct Tree Tree;
+typedef struct Intern Intern;
 
 extern Tree *new_tree(vtype_t key, vtype_t value);
 extern void free_tree(Tree *tree);
+extern int8_t intern_tree(Tree *tree, Intern *intern);
 
 extern value_t get_tree(Tree *tree, void *key);
 extern int8_t set_tree(Tree *tree, void *key, void *value);
+extern int8_t set_real_tree(Tree *tree, void *key, double value);
 extern void del_tree(Tree *tree, void *key);
 extern _Bool in_tree(Tree *tree, void *key);
 
@@ -17,6 +17,8 @@ typedef union value_t {
 
 extern void *decimal(int32_t x);
 extern void *string(char *x);
+// real() boxes the double on the heap; set_tree and set_hashtab free the
+// box. set_real_tree and set_real_hashtab store a double without one
 extern void *real(double x);
 
 #endif /* EXTCLIB_TYPE_H_ */
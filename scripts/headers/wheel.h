@@ -0,0 +1,30 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+#include <stdint.h>
+#include <stddef.h>
+
+// Hierarchical timer wheel: O(1) arm, re-arm and cancel, expiry without
+// scanning the armed timers. Deadlines are absolute milliseconds on the
+// caller's monotonic clock, rounded up to WHEEL_TICK.
+#define WHEEL_TICK 16 // Milliseconds per tick of the lowest level
+
+// Timer embedded in the object it times out, see expire_wheel
+typedef struct Timer {
+    struct Timer* next;
+    struct Timer* prev;
+    int64_t expires;    // Tick the timer fires at
+    uint16_t where;     // 1 + level * slots + slot while armed, 0 otherwise
+} Timer;
+
+typedef struct Wheel Wheel;
+
+extern Wheel* new_wheel(int64_t now);
+extern void free_wheel(Wheel* wheel);
+extern void init_timer(Timer* timer);
+extern void add_wheel(Wheel* wheel, Timer* timer, int64_t deadline);
+extern void del_wheel(Wheel* wheel, Timer* timer);
+extern Timer* expire_wheel(Wheel* wheel, int64_t now);
+extern int wait_wheel(Wheel* wheel, int64_t now);
+extern size_t count_wheel(Wheel* wheel);
+
+#endif /* WHEEL_H */
@@ -0,0 +1,154 @@
+// Request arenas: bump allocation from chunks, released all at once
+// The first chunk is part of the arena itself. Requests needing more get extra
+// chunks, which are kept until the arena goes back to its pool.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 16 // Alignment of every allocation
+
+// Block of arena memory, the bytes follow the header
+typedef struct ArenaChunk {
+    struct ArenaChunk* next; // Next chunk to bump into once this one is full
+    size_t size;             // Usable bytes
+    size_t used;             // Bytes handed out
+} ArenaChunk;
+
+// Arena structure: chunks in use order, the first one is embedded
+typedef struct Arena {
+    ArenaChunk* cur;    // Chunk allocations are bumped from
+    struct Arena* next; // Next arena in the pool free list
+    ArenaChunk first;   // Embedded chunk, its bytes follow the arena
+} Arena;
+
+// Pool structure: stack of arenas ready for a new request
+typedef struct ArenaPool {
+    Arena* free;        // Reset arenas, linked through next
+    size_t count;       // Number of arenas in free
+    size_t keep;        // Arenas kept at most, the rest are freed
+    size_t size;        // First chunk size of new arenas
+} ArenaPool;
+
+// Function prototypes for internal arena operations
+static char* bytes_chunk(ArenaChunk* chunk);
+static size_t align_size(size_t size);
+
+// Create an arena whose first chunk holds size bytes
+extern Arena* new_arena(size_t size) {
+    size = align_size(size);
+    // The embedded chunk's bytes start where bytes_chunk expects them
+    Arena* arena = (Arena*)malloc(offsetof(Arena, first) + align_size(sizeof(ArenaChunk)) + size);
+    arena->first.next = NULL;
+    arena->first.size = size;
+    arena->first.used = 0;
+    arena->cur = &arena->first;
+    arena->next = NULL;
+    return arena;
+}
+
+// Free an arena and all its chunks
+extern void free_arena(Arena* arena) {
+    ArenaChunk* chunk = arena->first.next;
+    while (chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+// Allocate size bytes, aligned to ARENA_ALIGN, valid until the next reset
+extern void* alloc_arena(Arena* arena, size_t size) {
+    size = align_size(size);
+    ArenaChunk* chunk = arena->cur;
+    while (chunk->size - chunk->used < size) {
+        if (chunk->next == NULL || chunk->next->size < size) {
+            // Only requests outgrowing the kept chunks get here
+            size_t bytes = chunk->size > size ? chunk->size : size;
+            ArenaChunk* grown = (ArenaChunk*)malloc(align_size(sizeof(ArenaChunk)) + bytes);
+            grown->size = bytes;
+            grown->next = chunk->next;
+            chunk->next = grown;
+        }
+        chunk = chunk->next;
+        chunk->used = 0;
+    }
+    arena->cur = chunk;
+    void* ptr = bytes_chunk(chunk) + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+// Release every allocation at once, chunks stay for reuse
+// Later chunks are cleared when allocation moves into them
+extern void reset_arena(Arena* arena) {
+    arena->first.used = 0;
+    arena->cur = &arena->first;
+}
+
+// Bytes handed out since the last reset
+extern size_t used_arena(Arena* arena) {
+    size_t used = 0;
+    for (ArenaChunk* chunk = &arena->first; ; chunk = chunk->next) {
+        used += chunk->used;
+        if (chunk == arena->cur) {
+            return used;
+        }
+    }
+}
+
+// Create a pool keeping at most keep arenas of size bytes each
+extern ArenaPool* new_pool(size_t size, size_t keep) {
+    ArenaPool* pool = (ArenaPool*)malloc(sizeof(ArenaPool));
+    pool->free = NULL;
+    pool->count = 0;
+    pool->keep = keep;
+    pool->size = size;
+    return pool;
+}
+
+// Free the pool and the arenas it holds
+extern void free_pool(ArenaPool* pool) {
+    while (pool->free != NULL) {
+        Arena* next = pool->free->next;
+        free_arena(pool->free);
+        pool->free = next;
+    }
+    free(pool);
+}
+
+// Take a reset arena from the pool, creating one if it is empty
+extern Arena* get_pool(ArenaPool* pool) {
+    Arena* arena = pool->free;
+    if (arena == NULL) {
+        return new_arena(pool->size);
+    }
+    pool->free = arena->next;
+    pool->count -= 1;
+    arena->next = NULL;
+    return arena;
+}
+
+// Reset an arena and give it back to the pool
+// Extra chunks a large request needed are kept with it, unless the pool is full
+extern void put_pool(ArenaPool* pool, Arena* arena) {
+    if (pool->count >= pool->keep) {
+        free_arena(arena);
+        return;
+    }
+    reset_arena(arena);
+    arena->next = pool->free;
+    pool->free = arena;
+    pool->count += 1;
+}
+
+// First usable byte of a chunk
+static char* bytes_chunk(ArenaChunk* chunk) {
+    return (char*)chunk + align_size(sizeof(ArenaChunk));
+}
+
+// Round a size up to ARENA_ALIGN
+static size_t align_size(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
@@ -0,0 +1,354 @@
+// Static asset cache: file bodies kept in memory with prebuilt response headers
+// Entries are looked up by path, bounded by a byte budget with LRU eviction
+// and invalidated through inotify (or a stat check once a second without it)
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "cache.h"
+
+#define CACHE_SLOTS   64 // Initial size of slot array and hash tables
+#define CACHE_SHARE   4  // A single file may use at most budget/CACHE_SHARE
+#define CACHE_RECHECK 1  // Seconds between stat revalidations of unwatched entries
+#define WATCH_MASK    (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF)
+
+// Cache structure: entries live in a slot array indexed from the hash tables
+typedef struct Cache {
+    size_t budget;      // Maximum bytes of bodies and headers kept
+    size_t used;        // Bytes currently kept
+    HashTab* paths;     // Path to slot index
+    HashTab* watches;   // inotify watch descriptor to slot index
+    CacheEntry** slots; // Entries, NULL for free slots
+    int32_t* free;      // Stack of free slot indices
+    int32_t nfree;      // Number of free slot indices
+    int32_t len;        // Number of slots handed out so far
+    int32_t cap;        // Capacity of slots and free arrays
+    CacheEntry* head;   // Most recently used entry
+    CacheEntry* tail;   // Least recently used entry
+    int fd;             // inotify descriptor, -1 if unavailable
+} Cache;
+
+// Function prototypes for internal cache operations
+static CacheEntry* load_entry(Cache* cache, char* path);
+static void drop_entry(Cache* cache, CacheEntry* entry);
+static void link_entry(Cache* cache, CacheEntry* entry);
+static void unlink_entry(Cache* cache, CacheEntry* entry);
+static int8_t stale_entry(CacheEntry* entry);
+static int32_t alloc_slot(Cache* cache);
+static char* mime_type(char* path);
+static int64_t now_sec(void);
+
+// Create a new cache keeping at most budget bytes
+extern Cache* new_cache(size_t budget) {
+    Cache* cache = (Cache*)malloc(sizeof(Cache));
+    cache->budget = budget;
+    cache->used = 0;
+    cache->paths = new_hashtab(CACHE_SLOTS, STRING_TYPE, DECIMAL_TYPE);
+    cache->watches = new_hashtab(CACHE_SLOTS, DECIMAL_TYPE, DECIMAL_TYPE);
+    cache->cap = CACHE_SLOTS;
+    cache->len = 0;
+    cache->nfree = 0;
+    cache->slots = (CacheEntry**)malloc(cache->cap * sizeof(CacheEntry*));
+    cache->free = (int32_t*)malloc(cache->cap * sizeof(int32_t));
+    cache->head = NULL;
+    cache->tail = NULL;
+#ifdef __linux__
+    cache->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+    cache->fd = -1;
+#endif
+    return cache;
+}
+
+// Free the cache, entries still referenced by queued responses outlive it
+extern void free_cache(Cache* cache) {
+    while (cache->head != NULL) {
+        drop_entry(cache, cache->head);
+    }
+#ifdef __linux__
+    if (cache->fd >= 0) {
+        close(cache->fd);
+    }
+#endif
+    free_hashtab(cache->paths);
+    free_hashtab(cache->watches);
+    free(cache->slots);
+    free(cache->free);
+    free(cache);
+}
+
+// Get a cached file, loading it on a miss
+// Returns NULL if the file is missing, not regular or too large to cache
+extern CacheEntry* get_cache(Cache* cache, char* path) {
+    if (in_hashtab(cache->paths, string(path))) {
+        CacheEntry* entry = cache->slots[get_hashtab(cache->paths, string(path)).decimal];
+        if (!stale_entry(entry)) {
+            unlink_entry(cache, entry);
+            link_entry(cache, entry);
+            return entry;
+        }
+        drop_entry(cache, entry);
+    }
+    return load_entry(cache, path);
+}
+
+// Take a reference on an entry so it survives eviction
+extern void hold_cache(CacheEntry* entry) {
+    entry->refs += 1;
+}
+
+// Drop a reference, the entry is freed with its last holder
+extern void release_cache(CacheEntry* entry) {
+    entry->refs -= 1;
+    if (entry->refs > 0) {
+        return;
+    }
+    free(entry->path);
+    free(entry->body);
+    free(entry->head);
+    free(entry->hclose);
+    free(entry);
+}
+
+// Descriptor that becomes readable when cached files change, -1 if none
+extern int fd_cache(Cache* cache) {
+    return cache->fd;
+}
+
+// Drop entries whose files changed according to pending inotify events
+extern void events_cache(Cache* cache) {
+#ifdef __linux__
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (cache->fd >= 0) {
+        ssize_t n = read(cache->fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return; // EAGAIN: no more events
+        }
+        for (char* ptr = buf; ptr < buf + n; ) {
+            struct inotify_event* ev = (struct inotify_event*)ptr;
+            if (in_hashtab(cache->watches, decimal(ev->wd))) {
+                int32_t slot = get_hashtab(cache->watches, decimal(ev->wd)).decimal;
+                drop_entry(cache, cache->slots[slot]);
+            }
+            ptr += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+#else
+    (void)cache;
+#endif
+}
+
+// Get the number of bytes kept by the cache
+extern size_t used_cache(Cache* cache) {
+    return cache->used;
+}
+
+// Read a file into a new entry and insert it, evicting old entries if needed
+static CacheEntry* load_entry(Cache* cache, char* path) {
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(file, &st) != 0 || !S_ISREG(st.st_mode) ||
+        (size_t)st.st_size > cache->budget / CACHE_SHARE) {
+        close(file);
+        return NULL;
+    }
+    CacheEntry* entry = (CacheEntry*)malloc(sizeof(CacheEntry));
+    entry->size = (size_t)st.st_size;
+    entry->body = (char*)malloc(entry->size ? entry->size : 1);
+    size_t got = 0;
+    while (got < entry->size) {
+        ssize_t n = read(file, entry->body + got, entry->size - got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    close(file);
+    if (got != entry->size) {
+        free(entry->body);
+        free(entry);
+        return NULL; // File changed while reading
+    }
+    entry->path = (char*)malloc(strlen(path) + 1);
+    strcpy(entry->path, path);
+    // Both header variants are built once, responses only pick one
+    // The status and Date lines change every second and are sent before them
+    char head[256];
+    char* mime = mime_type(path);
+    int len = snprintf(head, sizeof(head),
+        "Content-Type: %s\r\nContent-Length: %zu\r\n\r\n", mime, entry->size);
+    entry->head = (char*)malloc(len + 1);
+    memcpy(entry->head, head, len + 1);
+    entry->headsz = len;
+    len = snprintf(head, sizeof(head),
+        "Content-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        mime, entry->size);
+    entry->hclose = (char*)malloc(len + 1);
+    memcpy(entry->hclose, head, len + 1);
+    entry->hclosesz = len;
+    entry->refs = 1;
+    entry->dev = (uint64_t)st.st_dev;
+    entry->ino = (uint64_t)st.st_ino;
+#ifdef __linux__
+    entry->mtime = st.st_mtim;
+#else
+    entry->mtime.tv_sec = st.st_mtime;
+    entry->mtime.tv_nsec = 0;
+#endif
+    entry->checked = now_sec();
+    entry->wd = -1;
+    entry->prev = NULL;
+    entry->next = NULL;
+    entry->slot = alloc_slot(cache);
+    cache->slots[entry->slot] = entry;
+    set_hashtab(cache->paths, string(path), decimal(entry->slot));
+#ifdef __linux__
+    if (cache->fd >= 0) {
+        int wd = inotify_add_watch(cache->fd, path, WATCH_MASK);
+        // A second path to the same inode shares its watch, fall back to stat
+        if (wd >= 0 && !in_hashtab(cache->watches, decimal(wd))) {
+            entry->wd = wd;
+            set_hashtab(cache->watches, decimal(wd), decimal(entry->slot));
+        }
+    }
+#endif
+    link_entry(cache, entry);
+    cache->used += entry->size + entry->headsz + entry->hclosesz;
+    while (cache->used > cache->budget && cache->tail != entry) {
+        drop_entry(cache, cache->tail);
+    }
+    return entry;
+}
+
+// Remove an entry from the cache and drop the cache's reference
+static void drop_entry(Cache* cache, CacheEntry* entry) {
+    del_hashtab(cache->paths, string(entry->path));
+#ifdef __linux__
+    if (entry->wd >= 0) {
+        del_hashtab(cache->watches, decimal(entry->wd));
+        inotify_rm_watch(cache->fd, entry->wd);
+    }
+#endif
+    unlink_entry(cache, entry);
+    cache->slots[entry->slot] = NULL;
+    cache->free[cache->nfree++] = entry->slot;
+    entry->slot = -1;
+    cache->used -= entry->size + entry->headsz + entry->hclosesz;
+    release_cache(entry);
+}
+
+// Insert an entry at the most recently used end
+static void link_entry(Cache* cache, CacheEntry* entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+// Remove an entry from the LRU list
+static void unlink_entry(Cache* cache, CacheEntry* entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+// Revalidate an unwatched entry against the file, at most once a second
+static int8_t stale_entry(CacheEntry* entry) {
+    if (entry->wd >= 0) {
+        return 0; // inotify reports changes
+    }
+    int64_t now = now_sec();
+    if (now - entry->checked < CACHE_RECHECK) {
+        return 0;
+    }
+    entry->checked = now;
+    struct stat st;
+    if (stat(entry->path, &st) != 0) {
+        return 1;
+    }
+#ifdef __linux__
+    int8_t same_time = st.st_mtim.tv_sec == entry->mtime.tv_sec &&
+        st.st_mtim.tv_nsec == entry->mtime.tv_nsec;
+#else
+    int8_t same_time = st.st_mtime == entry->mtime.tv_sec;
+#endif
+    return !same_time || (uint64_t)st.st_ino != entry->ino ||
+        (uint64_t)st.st_dev != entry->dev || (size_t)st.st_size != entry->size;
+}
+
+// Get a free slot index, growing the slot array if needed
+static int32_t alloc_slot(Cache* cache) {
+    if (cache->nfree > 0) {
+        return cache->free[--cache->nfree];
+    }
+    if (cache->len == cache->cap) {
+        cache->cap <<= 1;
+        cache->slots = (CacheEntry**)realloc(cache->slots, cache->cap * sizeof(CacheEntry*));
+        cache->free = (int32_t*)realloc(cache->free, cache->cap * sizeof(int32_t));
+    }
+    return cache->len++;
+}
+
+// Guess the Content-Type from the file extension
+static char* mime_type(char* path) {
+    char* ext = strrchr(path, '.');
+    if (ext == NULL) {
+        return "application/octet-stream";
+    }
+    if (strcmp(ext, ".html") == 0 || strcmp(ext, ".htm") == 0) {
+        return "text/html";
+    } else if (strcmp(ext, ".css") == 0) {
+        return "text/css";
+    } else if (strcmp(ext, ".js") == 0) {
+        return "application/javascript";
+    } else if (strcmp(ext, ".json") == 0) {
+        return "application/json";
+    } else if (strcmp(ext, ".txt") == 0) {
+        return "text/plain";
+    } else if (strcmp(ext, ".png") == 0) {
+        return "image/png";
+    } else if (strcmp(ext, ".svg") == 0) {
+        return "image/svg+xml";
+    }
+    return "application/octet-stream";
+}
+
+// Current monotonic time in seconds
+static int64_t now_sec(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (int64_t)ts.tv_sec;
+}
@@ -0,0 +1,117 @@
+// Cached wall clock for Date headers and log timestamps
+// Strings are published under a sequence lock: the writer makes the sequence
+// odd while it stores them, readers retry when the sequence is odd or changed
+// during their copy. The text is kept in atomic words so copies never race.
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "clock.h"
+
+#define CLOCK_WORDS 7 // Date in words 0-3, timestamp in words 4-6
+#define STAMP_WORD  4
+
+#ifdef CLOCK_REALTIME_COARSE
+#define WALL_CLOCK CLOCK_REALTIME_COARSE // Read from the vDSO without a syscall
+#else
+#define WALL_CLOCK CLOCK_REALTIME
+#endif
+
+static _Atomic uint32_t clock_seq = 0;    // Odd while the strings are rewritten
+static _Atomic int64_t clock_sec = -1;    // Second the strings were formatted for
+static atomic_flag clock_busy = ATOMIC_FLAG_INIT; // Held by the formatting thread
+static _Atomic uint64_t clock_words[CLOCK_WORDS];
+
+// Names used by the HTTP date format, independent of the locale
+static const char* day_names[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char* month_names[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+// Function prototypes for internal clock operations
+static void update_clock(int64_t sec);
+static void read_clock(uint64_t* words);
+
+// Current wall clock time in seconds
+// Formats the cached strings again when the second has changed
+extern int64_t now_clock(void) {
+    struct timespec ts;
+    clock_gettime(WALL_CLOCK, &ts);
+    int64_t sec = (int64_t)ts.tv_sec;
+    if (atomic_load_explicit(&clock_sec, memory_order_relaxed) != sec) {
+        update_clock(sec);
+    }
+    return sec;
+}
+
+// Copy the RFC 7231 date of the current second into buf (CLOCK_DATE bytes)
+// Returns the length without the terminator
+extern size_t date_clock(char* buf) {
+    uint64_t words[CLOCK_WORDS];
+    now_clock();
+    read_clock(words);
+    memcpy(buf, words, CLOCK_DATE);
+    return CLOCK_DATE - 1;
+}
+
+// Copy the local time log timestamp into buf (CLOCK_STAMP bytes)
+// Returns the length without the terminator
+extern size_t stamp_clock(char* buf) {
+    uint64_t words[CLOCK_WORDS];
+    now_clock();
+    read_clock(words);
+    memcpy(buf, &words[STAMP_WORD], CLOCK_STAMP);
+    return CLOCK_STAMP - 1;
+}
+
+// Format both strings for sec and publish them
+// Threads losing the race keep reading the previous second for a moment
+static void update_clock(int64_t sec) {
+    if (atomic_flag_test_and_set_explicit(&clock_busy, memory_order_acquire)) {
+        return;
+    }
+    if (atomic_load_explicit(&clock_sec, memory_order_relaxed) != sec) {
+        uint64_t words[CLOCK_WORDS] = {0};
+        char* text = (char*)words;
+        time_t now = (time_t)sec;
+        struct tm t;
+        gmtime_r(&now, &t);
+        char date[64]; // Wide enough for any year, only the fixed width is kept
+        snprintf(date, sizeof(date), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+            day_names[t.tm_wday], t.tm_mday, month_names[t.tm_mon], t.tm_year + 1900,
+            t.tm_hour, t.tm_min, t.tm_sec);
+        memcpy(text, date, CLOCK_DATE - 1);
+        localtime_r(&now, &t);
+        strftime((char*)&words[STAMP_WORD], CLOCK_STAMP, "%Y-%m-%d %H:%M:%S", &t);
+        uint32_t seq = atomic_load_explicit(&clock_seq, memory_order_relaxed);
+        atomic_store_explicit(&clock_seq, seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (int i = 0; i < CLOCK_WORDS; ++i) {
+            atomic_store_explicit(&clock_words[i], words[i], memory_order_relaxed);
+        }
+        atomic_store_explicit(&clock_seq, seq + 2, memory_order_release);
+        atomic_store_explicit(&clock_sec, sec, memory_order_release);
+    }
+    atomic_flag_clear_explicit(&clock_busy, memory_order_release);
+}
+
+// Copy a consistent version of the published strings
+static void read_clock(uint64_t* words) {
+    while (1) {
+        uint32_t seq = atomic_load_explicit(&clock_seq, memory_order_acquire);
+        if ((seq & 1) || seq == 0) {
+            continue; // Writer in progress or nothing published yet
+        }
+        for (int i = 0; i < CLOCK_WORDS; ++i) {
+            words[i] = atomic_load_explicit(&clock_words[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&clock_seq, memory_order_relaxed) == seq) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,352 @@
+// Configuration loader for setings.yaml
+// Reads the subset of YAML the file uses: nested mappings by indentation,
+// scalars (plain or quoted), comments and a list of route mappings. Known keys
+// are looked up by their dotted path in a table and parsed by type; unknown
+// keys are skipped so the file can carry settings other tools read.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "config.h"
+#include "httpbase.h"
+
+#define CONFIG_LINE  512 // Longest line of the file
+#define CONFIG_DEPTH 8   // Nested mappings
+
+// Value types of the key table
+#define TYPE_STRING  0
+#define TYPE_INT     1
+#define TYPE_SIZE    2 // Byte count, with an optional KB, MB or GB suffix
+#define TYPE_BOOL    3
+#define TYPE_LEVEL   4 // Log level name
+#define TYPE_BACKEND 5 // Event loop name
+
+// Known key: dotted path, type and where the value goes
+typedef struct ConfigKey {
+    char* path;
+    uint8_t type;
+    size_t offset;  // Into Config, or into ConfigRoute for "routes." keys
+    size_t size;    // Bytes of a string field
+} ConfigKey;
+
+#define KEY(path, type, field) { path, type, offsetof(Config, field), sizeof(((Config*)0)->field) }
+#define ROUTE_KEY(path, field) { path, TYPE_STRING, offsetof(ConfigRoute, field), sizeof(((ConfigRoute*)0)->field) }
+
+static const ConfigKey keys[] = {
+    KEY("server.network.host", TYPE_STRING, host),
+    KEY("server.network.port", TYPE_INT, port),
+    KEY("server.network.backlog", TYPE_INT, backlog),
+    KEY("server.network.timeout", TYPE_INT, timeout),
+    KEY("server.performance.workers", TYPE_INT, workers),
+    KEY("server.performance.backend", TYPE_BACKEND, backend),
+    KEY("server.performance.max_connections", TYPE_INT, max_connections),
+    KEY("server.performance.queue_delay", TYPE_INT, queue_delay),
+    KEY("server.performance.retry_after", TYPE_INT, retry_after),
+    KEY("server.performance.buffer_size", TYPE_SIZE, buffer_size),
+    KEY("server.performance.max_request_size", TYPE_SIZE, max_request_size),
+    KEY("server.performance.max_body_size", TYPE_SIZE, max_body_size),
+    KEY("server.performance.cache_size", TYPE_SIZE, cache_size),
+    KEY("server.http.keep_alive", TYPE_BOOL, keep_alive),
+    KEY("server.http.keep_alive_timeout", TYPE_INT, keep_alive_timeout),
+    KEY("server.http.max_keep_alive_requests", TYPE_INT, max_keep_alive_requests),
+    KEY("server.http.server_header", TYPE_STRING, server_header),
+    KEY("server.logging.level", TYPE_LEVEL, log_level),
+    KEY("server.logging.file", TYPE_STRING, log_file),
+    KEY("server.security.max_uri_length", TYPE_SIZE, max_uri_length),
+    KEY("server.security.max_headers", TYPE_INT, max_headers),
+    KEY("server.security.disable_trace", TYPE_BOOL, disable_trace),
+};
+
+static const ConfigKey route_keys[] = {
+    ROUTE_KEY("routes.path", path),
+    ROUTE_KEY("routes.handler", handler),
+};
+
+// Function prototypes for internal parsing helpers
+static char* strip_line(char* line);
+static char* scalar_value(char* value);
+static int8_t set_value(const ConfigKey* key, void* base, char* value);
+static int8_t parse_size(char* value, size_t* size);
+static const ConfigKey* find_key(const ConfigKey* table, size_t count, char* path);
+
+// Fill config with the values the server uses without a file
+extern void default_config(Config* config) {
+    memset(config, 0, sizeof(*config));
+    strcpy(config->host, "127.0.0.1");
+    config->port = 8080;
+    config->backlog = 0;
+    config->timeout = 30;
+    config->workers = 0;
+    config->backend = HTTP_EPOLL;
+    config->max_connections = 0;
+    config->queue_delay = 50;
+    config->retry_after = 1;
+    config->buffer_size = 8192;
+    config->max_request_size = 4096;
+    config->max_body_size = 1 << 20;
+    config->cache_size = 64 << 20;
+    config->keep_alive = 1;
+    config->keep_alive_timeout = 5;
+    config->max_keep_alive_requests = 100;
+    config->max_uri_length = 1024;
+    config->max_headers = 32;
+    config->disable_trace = 0;
+    config->log_level = LOG_INFO;
+    strcpy(config->log_file, "app.log");
+    config->nroutes = 0;
+}
+
+// Read a configuration file over the values already in config
+// Returns 0 on success, 1 if the file cannot be opened, 2 if it is invalid
+// (the reason goes to stderr with the line number)
+extern int8_t load_config(Config* config, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return 1;
+    }
+    char line[CONFIG_LINE];
+    char parents[CONFIG_DEPTH][CONFIG_NAME]; // Mapping keys enclosing the line
+    int indents[CONFIG_DEPTH];
+    int depth = 0;
+    ConfigRoute* route = NULL; // Item of the routes list being filled
+    int number = 0;
+    int8_t rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), file) != NULL) {
+        number += 1;
+        if (strchr(line, '\n') == NULL && !feof(file)) {
+            fprintf(stderr, "%s:%d: line too long\n", path, number);
+            rc = 2;
+            break;
+        }
+        char* text = strip_line(line);
+        if (*text == '\0') {
+            continue;
+        }
+        int indent = (int)(text - line);
+        if (strchr(line, '\t') != NULL && strchr(line, '\t') < text) {
+            fprintf(stderr, "%s:%d: tabs are not allowed in indentation\n", path, number);
+            rc = 2;
+            break;
+        }
+        int8_t item = 0;
+        if (text[0] == '-' && (text[1] == ' ' || text[1] == '\0')) {
+            // List item: its first key sits two columns further in
+            item = 1;
+            text += text[1] == ' ' ? 2 : 1;
+            while (*text == ' ') {
+                ++text;
+            }
+            indent = (int)(text - line);
+        }
+        while (depth > 0 && indents[depth-1] >= indent) {
+            depth -= 1; // Leave the mappings this line is not nested in
+        }
+        char* colon = strchr(text, ':');
+        if (colon == NULL || (colon[1] != ' ' && colon[1] != '\0')) {
+            fprintf(stderr, "%s:%d: expected \"key: value\"\n", path, number);
+            rc = 2;
+            break;
+        }
+        *colon = '\0';
+        int8_t nested = colon[1] == '\0'; // Trailing spaces are already cut
+        char* value = scalar_value(colon + 1);
+        if (value == NULL) {
+            fprintf(stderr, "%s:%d: unterminated quoted value\n", path, number);
+            rc = 2;
+            break;
+        }
+        char full[CONFIG_PATH] = "";
+        size_t len = 0;
+        for (int i = 0; i < depth; ++i) {
+            len += snprintf(full + len, sizeof(full) - len, "%s.", parents[i]);
+        }
+        snprintf(full + len, sizeof(full) - len, "%s", text);
+        int8_t routes = depth == 1 && strcmp(parents[0], "routes") == 0;
+        if (item && routes) {
+            if (config->nroutes == CONFIG_ROUTES) {
+                fprintf(stderr, "%s:%d: more than %d routes\n", path, number, CONFIG_ROUTES);
+                rc = 2;
+                break;
+            }
+            route = &config->routes[config->nroutes++];
+            memset(route, 0, sizeof(*route));
+        }
+        if (nested) {
+            if (strlen(text) >= CONFIG_NAME || depth == CONFIG_DEPTH) {
+                fprintf(stderr, "%s:%d: key too long or nested too deep\n", path, number);
+                rc = 2;
+                break;
+            }
+            // Key without a value opens a nested mapping or a list
+            strcpy(parents[depth], text);
+            indents[depth] = indent;
+            depth += 1;
+            continue;
+        }
+        const ConfigKey* key;
+        void* base = config;
+        if (routes) {
+            key = find_key(route_keys, sizeof(route_keys) / sizeof(route_keys[0]), full);
+            base = route;
+        } else {
+            key = find_key(keys, sizeof(keys) / sizeof(keys[0]), full);
+        }
+        if (key == NULL || base == NULL) {
+            continue; // Not a setting of the server
+        }
+        if (set_value(key, base, value) != 0) {
+            fprintf(stderr, "%s:%d: invalid value \"%s\" for %s\n", path, number, value, full);
+            rc = 2;
+        }
+    }
+    fclose(file);
+    if (rc == 0 && (config->port <= 0 || config->port > 65535)) {
+        fprintf(stderr, "%s: port %d out of range\n", path, config->port);
+        rc = 2;
+    }
+    for (int32_t i = 0; rc == 0 && i < config->nroutes; ++i) {
+        if (config->routes[i].path[0] != '/' || config->routes[i].handler[0] == '\0') {
+            fprintf(stderr, "%s: route %d needs a path starting with / and a handler\n", path, i + 1);
+            rc = 2;
+        }
+    }
+    return rc;
+}
+
+// Cut the comment and line break off a line, returns its first non-space byte
+// A # starts a comment at the line start or after a space, outside quotes
+static char* strip_line(char* line) {
+    char quote = 0;
+    for (char* p = line; *p != '\0'; ++p) {
+        if (quote != 0) {
+            quote = *p == quote ? 0 : quote;
+        } else if (*p == '"' || *p == '\'') {
+            quote = *p;
+        } else if (*p == '#' && (p == line || p[-1] == ' ' || p[-1] == '\t')) {
+            *p = '\0';
+            break;
+        }
+    }
+    size_t len = strlen(line);
+    while (len > 0 && isspace((unsigned char)line[len-1])) {
+        line[--len] = '\0';
+    }
+    char* text = line;
+    while (*text == ' ' || *text == '\t') {
+        ++text;
+    }
+    return text;
+}
+
+// Value after the colon without surrounding spaces and quotes
+// Returns NULL for a quote that is not closed
+static char* scalar_value(char* value) {
+    while (*value == ' ') {
+        ++value;
+    }
+    if (*value != '"' && *value != '\'') {
+        return value;
+    }
+    char* end = strrchr(value + 1, *value);
+    if (end == NULL) {
+        return NULL;
+    }
+    *end = '\0';
+    return value + 1;
+}
+
+// Parse value by the key's type into its field
+static int8_t set_value(const ConfigKey* key, void* base, char* value) {
+    void* field = (char*)base + key->offset;
+    switch (key->type) {
+    case TYPE_STRING:
+        if (strlen(value) >= key->size) {
+            return -1;
+        }
+        strcpy((char*)field, value);
+        return 0;
+    case TYPE_INT: {
+        char* end;
+        errno = 0;
+        long n = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || errno != 0 || n < 0 || n > INT32_MAX) {
+            return -1;
+        }
+        *(int32_t*)field = (int32_t)n;
+        return 0;
+    }
+    case TYPE_SIZE:
+        return parse_size(value, (size_t*)field);
+    case TYPE_BOOL:
+        if (strcmp(value, "true") == 0 || strcmp(value, "yes") == 0 || strcmp(value, "on") == 0) {
+            *(int8_t*)field = 1;
+        } else if (strcmp(value, "false") == 0 || strcmp(value, "no") == 0 || strcmp(value, "off") == 0) {
+            *(int8_t*)field = 0;
+        } else {
+            return -1;
+        }
+        return 0;
+    case TYPE_LEVEL: {
+        static const char* names[] = { "debug", "info", "warning", "error" };
+        for (int i = 0; i < 4; ++i) {
+            if (strcmp(value, names[i]) == 0 || (i == LOG_WARN && strcmp(value, "warn") == 0)) {
+                *(log_level_t*)field = (log_level_t)i;
+                return 0;
+            }
+        }
+        return -1;
+    }
+    case TYPE_BACKEND:
+        if (strcmp(value, "epoll") == 0) {
+            *(int8_t*)field = HTTP_EPOLL;
+        } else if (strcmp(value, "io_uring") == 0) {
+            *(int8_t*)field = HTTP_URING;
+        } else {
+            return -1;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+// Parse "512", "64KB", "64MB" or "1GB" into bytes
+static int8_t parse_size(char* value, size_t* size) {
+    char* end;
+    errno = 0;
+    unsigned long long n = strtoull(value, &end, 10);
+    if (end == value || errno != 0 || *value == '-') {
+        return -1;
+    }
+    while (*end == ' ') {
+        ++end;
+    }
+    unsigned shift = 0;
+    if (*end == 'K' || *end == 'k') {
+        shift = 10;
+    } else if (*end == 'M' || *end == 'm') {
+        shift = 20;
+    } else if (*end == 'G' || *end == 'g') {
+        shift = 30;
+    }
+    end += shift != 0;
+    if (*end == 'B' || *end == 'b') {
+        ++end;
+    }
+    if (*end != '\0' || n > (SIZE_MAX >> shift)) {
+        return -1;
+    }
+    *size = (size_t)n << shift;
+    return 0;
+}
+
+// Entry of a key table by dotted path, NULL if the key is unknown
+static const ConfigKey* find_key(const ConfigKey* table, size_t count, char* path) {
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(table[i].path, path) == 0) {
+            return &table[i];
+        }
+    }
+    return NULL;
+}
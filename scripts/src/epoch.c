@@ -0,0 +1,134 @@
+// Epoch-based reclamation
+// A reader announces the global epoch before it loads a published pointer.
+// A writer swaps the pointer first, then advances the epoch and tags the old
+// object with the new value. A reader that announced an older epoch may hold
+// the old object; one that announced the new epoch or later loaded the
+// pointer after the swap. So an object can be destroyed once every reader is
+// outside a read section or announced at least its tag. All of this relies
+// on sequentially consistent atomics: the announcement must be visible
+// before the pointer load, the swap before the epoch advance.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "epoch.h"
+
+// Object waiting for the readers that may hold it
+typedef struct EpochRetired {
+    struct EpochRetired* next;
+    void* ptr;
+    void (*destroy)(void*);
+    uint64_t epoch;     // Epoch the object was retired at
+} EpochRetired;
+
+// Reclamation domain: the epoch, the reader records and the retired objects
+typedef struct Epoch {
+    _Atomic uint64_t epoch;  // Current epoch, starts at 1
+    _Atomic(EpochReader*) readers; // Records of every thread that read
+    EpochRetired* retired;   // Objects not destroyed yet, writer side only
+    uint64_t serial;         // Tells domains apart in the per-thread cache
+} Epoch;
+
+// Serial of the next domain
+static _Atomic uint64_t epoch_serials = 1;
+// Record of the domain this thread used last
+static _Thread_local uint64_t cached_serial = 0;
+static _Thread_local EpochReader* cached_reader = NULL;
+
+// Create a domain with no readers
+extern Epoch* new_epoch(void) {
+    Epoch* epoch = (Epoch*)malloc(sizeof(Epoch));
+    atomic_init(&epoch->epoch, 1);
+    atomic_init(&epoch->readers, NULL);
+    epoch->retired = NULL;
+    epoch->serial = atomic_fetch_add(&epoch_serials, 1);
+    return epoch;
+}
+
+// Free the domain, destroying every retired object
+// No thread may read through it any more
+extern void free_epoch(Epoch* epoch) {
+    while (epoch->retired != NULL) {
+        EpochRetired* next = epoch->retired->next;
+        epoch->retired->destroy(epoch->retired->ptr);
+        free(epoch->retired);
+        epoch->retired = next;
+    }
+    EpochReader* reader = atomic_load(&epoch->readers);
+    while (reader != NULL) {
+        EpochReader* next = reader->next;
+        free(reader);
+        reader = next;
+    }
+    free(epoch);
+}
+
+// Reader record of the calling thread, registered on its first call
+// Records stay registered until free_epoch; a thread that ended leaves one
+// outside a read section, which a later thread may take over
+extern EpochReader* reader_epoch(Epoch* epoch) {
+    if (cached_serial == epoch->serial) {
+        return cached_reader;
+    }
+    EpochReader* reader = atomic_load(&epoch->readers);
+    while (reader != NULL && reader->owner != (void*)&cached_reader) {
+        reader = reader->next;
+    }
+    if (reader == NULL) {
+        reader = (EpochReader*)aligned_alloc(64, 64); // No line shared with other readers
+        atomic_init(&reader->epoch, 0);
+        reader->owner = (void*)&cached_reader;
+        reader->next = atomic_load(&epoch->readers);
+        while (!atomic_compare_exchange_weak(&epoch->readers, &reader->next, reader));
+    }
+    cached_serial = epoch->serial;
+    cached_reader = reader;
+    return reader;
+}
+
+// Start a read section: published pointers loaded from here on stay valid
+// until leave_epoch
+extern void enter_epoch(Epoch* epoch, EpochReader* reader) {
+    atomic_store(&reader->epoch, atomic_load(&epoch->epoch));
+}
+
+// End a read section
+extern void leave_epoch(EpochReader* reader) {
+    atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+// Retire an object already unpublished, it is destroyed by a later
+// reclaim_epoch once no reader can hold it
+extern void retire_epoch(Epoch* epoch, void* ptr, void (*destroy)(void*)) {
+    EpochRetired* retired = (EpochRetired*)malloc(sizeof(EpochRetired));
+    retired->ptr = ptr;
+    retired->destroy = destroy;
+    retired->epoch = atomic_fetch_add(&epoch->epoch, 1) + 1;
+    retired->next = epoch->retired;
+    epoch->retired = retired;
+}
+
+// Destroy the retired objects no reader can hold any more
+// Returns the number still waiting for readers
+extern size_t reclaim_epoch(Epoch* epoch) {
+    uint64_t oldest = UINT64_MAX;
+    for (EpochReader* r = atomic_load(&epoch->readers); r != NULL; r = r->next) {
+        uint64_t seen = atomic_load(&r->epoch);
+        if (seen != 0 && seen < oldest) {
+            oldest = seen;
+        }
+    }
+    size_t waiting = 0;
+    EpochRetired** link = &epoch->retired;
+    while (*link != NULL) {
+        EpochRetired* retired = *link;
+        if (retired->epoch <= oldest) {
+            *link = retired->next;
+            retired->destroy(retired->ptr);
+            free(retired);
+        } else {
+            link = &retired->next;
+            waiting += 1;
+        }
+    }
+    return waiting;
+}
@@ -1,32 +1,90 @@
 /*
  * BORROWED CODE - Hash Table Implementation
- * This file contains a hash table implementation using binary search trees
- * for collision resolution, borrowed from external library code.
+ * The interface comes from external library code; the table behind it is a
+ * flat open-addressing array with Robin Hood probing. Capacity is a power of
+ * two, every slot keeps the full hash of its key and the table doubles once
+ * it is 7/8 full. Hashes are seeded with a random value drawn once per
+ * process, so colliding keys cannot be prepared offline.
+ * The interning table at the end keeps one immutable copy of every string
+ * added to it, so tables and trees holding the same keys can share them.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
 
 #include "hash.h"
-#include "tree.h"
 #include "type.h"
 
-// Hash table structure containing type information and array of trees
+#define HASH_MIN_SIZE 8         // Smallest slot array
+#define HASH_LOAD_NUM 7         // Grow when entries exceed size * NUM / DEN
+#define HASH_LOAD_DEN 8
+#define HASH_USED     0x80000000u // Set in every stored hash, 0 marks an empty slot
+#define INTERN_CHUNK  4096      // Bytes of interned strings allocated at a time
+
+// Slot of the table: an entry with its hash, or empty
+typedef struct hash_slot {
+    uint32_t hash;      // Hash of the key with HASH_USED set, 0 if empty
+    value_t key;        // Key (strings are owned copies)
+    value_t value;      // Value (strings are owned copies)
+} hash_slot;
+
+// Hash table structure containing type information and the slot array
 typedef struct HashTab {
     struct {
         vtype_t key;    // Type of key values
         vtype_t value;  // Type of value data
     } type;
-    size_t size;        // Size of the hash table (number of buckets)
-    Tree **table;       // Array of binary search trees for collision resolution
+    size_t size;        // Number of slots, a power of two
+    size_t len;         // Number of stored entries
+    uint64_t seed;      // Process hash seed, see _get_seed
+    hash_slot *table;   // Slots, entries sit at or after their home slot
+    Intern *intern;     // Shared copies of string keys, NULL if keys are owned
 } HashTab;
 
+// Block of interned strings, freed with the table
+typedef struct intern_chunk {
+    struct intern_chunk *next; // Previously allocated chunk
+    size_t size;               // Bytes in data
+    char data[];
+} intern_chunk;
+
+// Interning table: a set of strings with linear probing, never shrinking
+typedef struct Intern {
+    size_t size;          // Number of slots, a power of two
+    size_t len;           // Number of strings
+    uint64_t seed;        // Process hash seed
+    uint32_t *hashes;     // Hash of every slot with HASH_USED set, 0 if empty
+    char **strings;       // String of every slot
+    intern_chunk *chunks; // Newest chunk first
+    size_t used;          // Bytes taken from the newest chunk
+} Intern;
+
 // Function prototypes for internal hash operations
 static uint32_t _get_hash(HashTab *hashtab, void *key);
-static uint32_t _strhash(char *s, size_t size);
+static uint32_t _strhash(const char *s, uint64_t seed);
+static uint64_t _wymix(uint64_t a, uint64_t b);
+static uint32_t _mix(uint32_t x);
+static uint64_t _get_seed(void);
+static size_t _dist(HashTab *hashtab, size_t index);
+static int64_t _find(HashTab *hashtab, void *key, uint32_t hash);
+static _Bool _eq_key(HashTab *hashtab, hash_slot *slot, void *key);
+static void _set_value(HashTab *hashtab, hash_slot *slot, void *value);
+static void _free_slot(HashTab *hashtab, hash_slot *slot);
+static void _insert(HashTab *hashtab, hash_slot entry);
+static void _grow(HashTab *hashtab);
+static void _print_slot(HashTab *hashtab, hash_slot *slot);
+static void _grow_intern(Intern *intern);
+static int8_t _put_hashtab(HashTab *hashtab, void *key, void *value);
 
 // Create a new hash table with specified size and key/value types
+// size is a hint for the number of entries, the table grows past it
 extern HashTab *new_hashtab(size_t size, vtype_t key, vtype_t value) {
     // Validate key type - only decimal and string types are supported
     switch(key){
@@ -39,53 +97,130 @@ extern HashTab *new_hashtab(size_t size, vtype_t key, vtype_t value) {
     }
     // Validate value type - decimal, real, and string types are supported
     switch(value) {
-        case DECIMAL_TYPE: 
-        case REAL_TYPE: 
-        case STRING_TYPE: 
+        case DECIMAL_TYPE:
+        case REAL_TYPE:
+        case STRING_TYPE:
             break;
         default:
             fprintf(stderr, "%s\n", "value type not supported");
             return NULL;
     }
-    // Allocate and initialize hash table structure
-    HashTab *hashtab = (HashTab*)malloc(sizeof(HashTab));
-    hashtab->table = (Tree**)malloc(size * sizeof(Tree*));
-    // Initialize each bucket with an empty binary search tree
-    for (size_t i = 0; i < size; ++i) {
-        hashtab->table[i] = new_tree(key, value);
+    // Smallest power of two holding size entries below the load factor
+    size_t slots = HASH_MIN_SIZE;
+    while (slots * HASH_LOAD_NUM / HASH_LOAD_DEN < size) {
+        slots <<= 1;
     }
-    hashtab->size = size;
+    // Allocate the table structure and its zeroed (empty) slots
+    HashTab *hashtab = (HashTab*)malloc(sizeof(HashTab));
+    hashtab->table = (hash_slot*)calloc(slots, sizeof(hash_slot));
+    hashtab->size = slots;
+    hashtab->len = 0;
+    hashtab->seed = _get_seed();
+    hashtab->intern = NULL;
     hashtab->type.key = key;
     hashtab->type.value = value;
     return hashtab;
 }
 
 // Delete a key-value pair from the hash table
+// Later entries of the probe run shift back, so no tombstones are left
 extern void del_hashtab(HashTab *hashtab, void *key) {
-    uint32_t hash = _get_hash(hashtab, key);
-    del_tree(hashtab->table[hash], key);
+    int64_t found = _find(hashtab, key, _get_hash(hashtab, key));
+    if (found < 0) {
+        return;
+    }
+    size_t mask = hashtab->size - 1;
+    size_t index = (size_t)found;
+    _free_slot(hashtab, &hashtab->table[index]);
+    size_t next = (index + 1) & mask;
+    while (hashtab->table[next].hash != 0 && _dist(hashtab, next) > 0) {
+        hashtab->table[index] = hashtab->table[next];
+        index = next;
+        next = (next + 1) & mask;
+    }
+    hashtab->table[index].hash = 0;
+    hashtab->len -= 1;
 }
 
 // Check if a key exists in the hash table
 extern _Bool in_hashtab(HashTab *hashtab, void *key) {
-    uint32_t hash = _get_hash(hashtab, key);
-    return in_tree(hashtab->table[hash], key);
+    return _find(hashtab, key, _get_hash(hashtab, key)) >= 0;
 }
 
 // Get value associated with a key from the hash table
 extern value_t get_hashtab(HashTab *hashtab, void *key) {
-    uint32_t hash = _get_hash(hashtab, key);
-    return get_tree(hashtab->table[hash], key);
+    int64_t found = _find(hashtab, key, _get_hash(hashtab, key));
+    if (found < 0) {
+        fprintf(stderr, "%s\n", "value undefined");
+        value_t none = {
+            .decimal = 0,
+        };
+        return none;
+    }
+    return hashtab->table[found].value;
 }
 
 // Set or update a key-value pair in the hash table
+// A real value comes boxed from real() and the box is freed here
 extern int8_t set_hashtab(HashTab *hashtab, void *key, void *value) {
+    int8_t rc = _put_hashtab(hashtab, key, value);
+    if (hashtab->type.value == REAL_TYPE) {
+        free(value);
+    }
+    return rc;
+}
+
+// Set or update a real value without boxing it
+extern int8_t set_real_hashtab(HashTab *hashtab, void *key, double value) {
+    if (hashtab->type.value != REAL_TYPE) {
+        fprintf(stderr, "%s\n", "value type is not real");
+        return 1;
+    }
+    return _put_hashtab(hashtab, key, &value);
+}
+
+// Store a pair, a real value is read through a pointer it does not own
+static int8_t _put_hashtab(HashTab *hashtab, void *key, void *value) {
     uint32_t hash = _get_hash(hashtab, key);
-    set_tree(hashtab->table[hash], key, value);
+    int64_t found = _find(hashtab, key, hash);
+    if (found >= 0) {
+        // Key already exists - update value, freeing the old string
+        // only after the copy since value may point into it
+        char *old = NULL;
+        if (hashtab->type.value == STRING_TYPE) {
+            old = hashtab->table[found].value.string;
+        }
+        _set_value(hashtab, &hashtab->table[found], value);
+        free(old);
+        return 0;
+    }
+    if ((hashtab->len + 1) * HASH_LOAD_DEN > hashtab->size * HASH_LOAD_NUM) {
+        _grow(hashtab);
+    }
+    hash_slot entry = { .hash = hash };
+    switch(hashtab->type.key) {
+        case DECIMAL_TYPE:
+            entry.key.decimal = (int32_t)(intptr_t)key;
+        break;
+        case STRING_TYPE: {
+            if (hashtab->intern != NULL) {
+                entry.key.string = get_intern(hashtab->intern, (char*)key);
+                break;
+            }
+            size_t size = strlen((char*)key);
+            entry.key.string = (char*)malloc(sizeof(char)*size+1);
+            memcpy(entry.key.string, (char*)key, size+1);
+        }
+        break;
+        default: ;
+    }
+    _set_value(hashtab, &entry, value);
+    _insert(hashtab, entry);
+    hashtab->len += 1;
     return 0;
 }
 
-// Compare two hash tables for equality
+// Compare two hash tables for equality: same types and the same entries
 extern _Bool eq_hashtab(HashTab *x, HashTab *y) {
     if (x->type.key != y->type.key) {
         return 0;
@@ -93,22 +228,49 @@ extern _Bool eq_hashtab(HashTab *x, HashTab *y) {
     if (x->type.value != y->type.value) {
         return 0;
     }
-    if (x->size != y->size) {
+    if (x->len != y->len) {
         return 0;
     }
-    // Compare each bucket (tree) for equality
+    // Look up every entry of x in y
     for (size_t i = 0; i < x->size; ++i) {
-        if (size_tree(x->table[i]) != size_tree(y->table[i])) {
-            return 0;
+        hash_slot *slot = &x->table[i];
+        if (slot->hash == 0) {
+            continue;
         }
-        if (eq_tree(x->table[i], y->table[i]) != 0) {
+        void *key = x->type.key == STRING_TYPE ? (void*)slot->key.string : (void*)(intptr_t)slot->key.decimal;
+        int64_t found = _find(y, key, slot->hash);
+        if (found < 0) {
             return 0;
         }
+        value_t other = y->table[found].value;
+        switch(x->type.value) {
+            case DECIMAL_TYPE:
+                if (slot->value.decimal != other.decimal) return 0;
+            break;
+            case REAL_TYPE:
+                if (slot->value.real != other.real) return 0;
+            break;
+            case STRING_TYPE:
+                if (strcmp(slot->value.string, other.string) != 0) return 0;
+            break;
+            default: ;
+        }
     }
     return 1;
 }
 
-// Get the size of the hash table (number of buckets)
+// Take string keys from an interning table instead of copying them
+// The table must outlive the hash table; only an empty one can switch
+extern int8_t intern_hashtab(HashTab *hashtab, Intern *intern) {
+    if (hashtab->type.key != STRING_TYPE || hashtab->len != 0) {
+        fprintf(stderr, "%s\n", "hash table can not intern keys");
+        return 1;
+    }
+    hashtab->intern = intern;
+    return 0;
+}
+
+// Get the size of the hash table (number of slots)
 extern size_t size_hashtab(HashTab *hashtab) {
     return hashtab->size;
 }
@@ -120,9 +282,11 @@ extern size_t sizeof_hashtab(void) {
 
 // Free all memory allocated for the hash table
 extern void free_hashtab(HashTab *hashtab) {
-    // Free each binary search tree in the table
+    // Free owned keys and values of every entry
     for (size_t i = 0; i < hashtab->size; ++i) {
-        free_tree(hashtab->table[i]);
+        if (hashtab->table[i].hash != 0) {
+            _free_slot(hashtab, &hashtab->table[i]);
+        }
     }
     free(hashtab->table);
     free(hashtab);
@@ -132,11 +296,11 @@ extern void free_hashtab(HashTab *hashtab) {
 extern void print_hashtab(HashTab *hashtab) {
     printf("#H[ ");
     for (size_t i = 0; i < hashtab->size; ++i) {
-        if (size_tree(hashtab->table[i]) == 0) {
+        if (hashtab->table[i].hash == 0) {
             continue;
         }
         printf("(%u :: ", (uint32_t)i);
-        print_tree(hashtab->table[i]);
+        _print_slot(hashtab, &hashtab->table[i]);
         printf(") ");
     }
     putchar(']');
@@ -152,11 +316,11 @@ extern void println_hashtab(HashTab *hashtab) {
 extern void print_hashtab_format(HashTab *hashtab) {
     printf("#H[\n");
     for (size_t i = 0; i < hashtab->size; ++i) {
-        if (size_tree(hashtab->table[i]) == 0) {
+        if (hashtab->table[i].hash == 0) {
             continue;
         }
         printf("\t(%u :: ", (uint32_t)i);
-        print_tree(hashtab->table[i]);
+        _print_slot(hashtab, &hashtab->table[i]);
         printf(")\n");
     }
     putchar(']');
@@ -168,28 +332,346 @@ extern void println_hashtab_format(HashTab *hashtab) {
     putchar('\n');
 }
 
-// Calculate hash value for a key based on its type
+// Calculate hash value for a key based on its type, HASH_USED is always set
 static uint32_t _get_hash(HashTab *hashtab, void *key) {
     uint32_t hash = 0;
     switch(hashtab->type.key) {
         case DECIMAL_TYPE:
-            // Use modulo for integer keys
-            hash = (uint32_t)(intptr_t)key % hashtab->size;
+            // Mix seeded integer keys, the low bits pick the slot. The mix
+            // is a bijection, so distinct keys keep distinct hashes
+            hash = _mix((uint32_t)(intptr_t)key ^ (uint32_t)hashtab->seed);
         break;
         case STRING_TYPE:
             // Use string hash function for string keys
-            hash = _strhash((char*)key, hashtab->size);
+            hash = _strhash((char*)key, hashtab->seed);
+        break;
+        default: ;
+    }
+    return hash | HASH_USED;
+}
+
+// Constants of wyhash
+static const uint64_t _wyp[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+};
+
+// Load 8 or 4 bytes from any alignment
+static uint64_t _read8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t _read4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// wyhash of a string: 8 or 16 bytes per step folded with 64x64->128-bit
+// multiplies, three independent lanes above 48 bytes. Lengths up to 16 take
+// a fixed handful of overlapping loads whatever the length
+static uint32_t _strhash(const char *s, uint64_t seed) {
+    const uint8_t *p = (const uint8_t*)s;
+    size_t len = strlen(s);
+    uint64_t a, b;
+    seed ^= _wymix(seed ^ _wyp[0], _wyp[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (_read4(p) << 32) | _read4(p + ((len >> 3) << 2));
+            b = (_read4(p + len - 4) << 32) | _read4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = _wymix(_read8(p) ^ _wyp[1], _read8(p + 8) ^ seed);
+                see1 = _wymix(_read8(p + 16) ^ _wyp[2], _read8(p + 24) ^ see1);
+                see2 = _wymix(_read8(p + 32) ^ _wyp[3], _read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = _wymix(_read8(p) ^ _wyp[1], _read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = _read8(p + i - 16);
+        b = _read8(p + i - 8);
+    }
+    a ^= _wyp[1];
+    b ^= seed;
+    __uint128_t r = (__uint128_t)a * b;
+    uint64_t h = _wymix((uint64_t)r ^ _wyp[0] ^ len, (uint64_t)(r >> 64) ^ _wyp[1]);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// Multiply to 128 bits and fold the halves together
+static uint64_t _wymix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+// Murmur3 finalizer: every input bit affects every output bit
+static uint32_t _mix(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+// Hash seed of the process, drawn from the kernel on first use
+// Every table shares it, eq_hashtab looks keys of one table up in another
+static uint64_t _get_seed(void) {
+    static _Atomic uint64_t shared = 0;
+    uint64_t seed = atomic_load_explicit(&shared, memory_order_acquire);
+    if (seed != 0) {
+        return seed;
+    }
+#ifdef __linux__
+    if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != (ssize_t)sizeof(seed)) {
+        seed = 0;
+    }
+#endif
+    if (seed == 0) {
+        // No entropy source: the clock and the address space layout
+        seed = _wymix((uint64_t)time(NULL) ^ _wyp[2], (uint64_t)clock() ^ (uint64_t)(uintptr_t)&seed);
+    }
+    seed |= 1; // 0 means not drawn yet
+    uint64_t none = 0;
+    if (!atomic_compare_exchange_strong(&shared, &none, seed)) {
+        seed = none; // Another thread drew it first
+    }
+    return seed;
+}
+
+// Distance of the entry in a slot from its home slot
+static size_t _dist(HashTab *hashtab, size_t index) {
+    size_t mask = hashtab->size - 1;
+    return (index - (hashtab->table[index].hash & mask)) & mask;
+}
+
+// Find the slot of a key, -1 if absent
+// Robin Hood order lets a miss stop at the first entry closer to its home
+static int64_t _find(HashTab *hashtab, void *key, uint32_t hash) {
+    size_t mask = hashtab->size - 1;
+    size_t index = hash & mask;
+    for (size_t dist = 0; ; ++dist) {
+        hash_slot *slot = &hashtab->table[index];
+        if (slot->hash == 0 || _dist(hashtab, index) < dist) {
+            return -1;
+        }
+        // Full hashes are compared first, keys only on a hash match
+        if (slot->hash == hash && _eq_key(hashtab, slot, key)) {
+            return (int64_t)index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+// Compare a key with the key stored in a slot
+static _Bool _eq_key(HashTab *hashtab, hash_slot *slot, void *key) {
+    switch(hashtab->type.key) {
+        case DECIMAL_TYPE:
+            return slot->key.decimal == (int32_t)(intptr_t)key;
+        case STRING_TYPE:
+            return strcmp(slot->key.string, (char*)key) == 0;
+        default: ;
+    }
+    return 0;
+}
+
+// Set the value of a slot, strings are copied
+static void _set_value(HashTab *hashtab, hash_slot *slot, void *value) {
+    switch(hashtab->type.value) {
+        case DECIMAL_TYPE:
+            slot->value.decimal = (int32_t)(intptr_t)value;
+        break;
+        case REAL_TYPE:
+            slot->value.real = *(double*)value;
+        break;
+        case STRING_TYPE: {
+            size_t size = strlen((char*)value);
+            slot->value.string = (char*)malloc(sizeof(char)*size+1);
+            memcpy(slot->value.string, (char*)value, size+1);
+        }
+        break;
+        default: ;
+    }
+}
+
+// Free memory owned by the entry of a slot
+static void _free_slot(HashTab *hashtab, hash_slot *slot) {
+    if (hashtab->type.key == STRING_TYPE && hashtab->intern == NULL) {
+        free(slot->key.string);
+    }
+    if (hashtab->type.value == STRING_TYPE) {
+        free(slot->value.string);
+    }
+}
+
+// Place a new entry, taking slots from entries closer to their home
+static void _insert(HashTab *hashtab, hash_slot entry) {
+    size_t mask = hashtab->size - 1;
+    size_t index = entry.hash & mask;
+    for (size_t dist = 0; ; ++dist) {
+        hash_slot *slot = &hashtab->table[index];
+        if (slot->hash == 0) {
+            *slot = entry;
+            return;
+        }
+        size_t other = _dist(hashtab, index);
+        if (other < dist) {
+            hash_slot temp = *slot;
+            *slot = entry;
+            entry = temp;
+            dist = other;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+// Double the slot array and move every entry to its new place
+static void _grow(HashTab *hashtab) {
+    hash_slot *old = hashtab->table;
+    size_t size = hashtab->size;
+    hashtab->size = size << 1;
+    hashtab->table = (hash_slot*)calloc(hashtab->size, sizeof(hash_slot));
+    for (size_t i = 0; i < size; ++i) {
+        if (old[i].hash != 0) {
+            _insert(hashtab, old[i]);
+        }
+    }
+    free(old);
+}
+
+// Print a single entry
+static void _print_slot(HashTab *hashtab, hash_slot *slot) {
+    putchar('{');
+    switch(hashtab->type.key) {
+        case DECIMAL_TYPE:
+            printf("%d", slot->key.decimal);
+        break;
+        case STRING_TYPE:
+            printf("'%s'", slot->key.string);
         break;
         default: ;
     }
-    return hash;
+    printf(" => ");
+    switch(hashtab->type.value) {
+        case DECIMAL_TYPE:
+            printf("%d", slot->value.decimal);
+        break;
+        case REAL_TYPE:
+            printf("%lf", slot->value.real);
+        break;
+        case STRING_TYPE:
+            printf("'%s'", slot->value.string);
+        break;
+        default: ;
+    }
+    printf("} ");
+}
+
+// Create an empty interning table, size is a hint for the number of strings
+extern Intern *new_intern(size_t size) {
+    size_t slots = HASH_MIN_SIZE;
+    while (slots * HASH_LOAD_NUM / HASH_LOAD_DEN < size) {
+        slots <<= 1;
+    }
+    Intern *intern = (Intern*)malloc(sizeof(Intern));
+    intern->size = slots;
+    intern->len = 0;
+    intern->seed = _get_seed();
+    intern->hashes = (uint32_t*)calloc(slots, sizeof(uint32_t));
+    intern->strings = (char**)malloc(slots * sizeof(char*));
+    intern->chunks = NULL;
+    intern->used = 0;
+    return intern;
+}
+
+// Free an interning table and every string it handed out
+extern void free_intern(Intern *intern) {
+    while (intern->chunks != NULL) {
+        intern_chunk *next = intern->chunks->next;
+        free(intern->chunks);
+        intern->chunks = next;
+    }
+    free(intern->hashes);
+    free(intern->strings);
+    free(intern);
 }
 
-// Simple string hash function using polynomial rolling hash
-static uint32_t _strhash(char *s, size_t size) {
-    uint32_t hashval;
-    for (hashval = 0; *s != '\0'; ++s) {
-        hashval = *s + 31 * hashval;
+// Shared copy of a string, added on first use
+// The copy is immutable and lives as long as the table
+extern char *get_intern(Intern *intern, char *string) {
+    uint32_t hash = _strhash(string, intern->seed) | HASH_USED;
+    size_t mask = intern->size - 1;
+    size_t index = hash & mask;
+    while (intern->hashes[index] != 0) {
+        if (intern->hashes[index] == hash && strcmp(intern->strings[index], string) == 0) {
+            return intern->strings[index];
+        }
+        index = (index + 1) & mask;
+    }
+    // Copy the string into the newest chunk, a long one gets a chunk of its own
+    size_t size = strlen(string) + 1;
+    if (intern->chunks == NULL || intern->chunks->size - intern->used < size) {
+        size_t bytes = size > INTERN_CHUNK ? size : INTERN_CHUNK;
+        intern_chunk *chunk = (intern_chunk*)malloc(sizeof(intern_chunk) + bytes);
+        chunk->size = bytes;
+        chunk->next = intern->chunks;
+        intern->chunks = chunk;
+        intern->used = 0;
+    }
+    char *copy = intern->chunks->data + intern->used;
+    memcpy(copy, string, size);
+    intern->used += size;
+    intern->hashes[index] = hash;
+    intern->strings[index] = copy;
+    intern->len += 1;
+    if (intern->len * HASH_LOAD_DEN > intern->size * HASH_LOAD_NUM) {
+        _grow_intern(intern);
+    }
+    return copy;
+}
+
+// Get the number of strings in an interning table
+extern size_t size_intern(Intern *intern) {
+    return intern->len;
+}
+
+// Double the slots of an interning table, the strings stay in place
+static void _grow_intern(Intern *intern) {
+    uint32_t *hashes = intern->hashes;
+    char **strings = intern->strings;
+    size_t size = intern->size;
+    intern->size = size << 1;
+    intern->hashes = (uint32_t*)calloc(intern->size, sizeof(uint32_t));
+    intern->strings = (char**)malloc(intern->size * sizeof(char*));
+    size_t mask = intern->size - 1;
+    for (size_t i = 0; i < size; ++i) {
+        if (hashes[i] == 0) {
+            continue;
+        }
+        size_t index = hashes[i] & mask;
+        while (intern->hashes[index] != 0) {
+            index = (index + 1) & mask;
+        }
+        intern->hashes[index] = hashes[i];
+        intern->strings[index] = strings[i];
     }
-    return hashval % size;
+    free(hashes);
+    free(strings);
 }
@@ -1,202 +1,2618 @@
 // HTTP server implementation with routing and request handling
 // Provides a simple HTTP server with path-based routing
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <poll.h>
+#elif __WIN32
+#include <io.h>
+#endif
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "hash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include "router.h"
+#include "epoch.h"
 #include "net.h"
+#include "loop.h"
+#include "ring.h"
+#include "wheel.h"
+#include "cache.h"
+#include "arena.h"
+#include "clock.h"
+#include "metrics.h"
 #include "httpbase.h"
 
 // Buffer size constants for HTTP parsing
-#define METHOD_SIZE 16
-#define PATH_SIZE   2048
-#define PROTO_SIZE  16
+#define RBUF_SIZE   8192 // Initial receive buffer of a connection, see buffers_http
+
+// Parser limit defaults (security and performance sections of setings.yaml)
+#define LIMIT_URI     1024
+#define LIMIT_HEADERS 32
+#define LIMIT_HEAD    4096
+#define LIMIT_BODY    (1 << 20)
+
+// Event loop constants
+#define LOOP_EVENTS 256 // Events handled per wait_loop call
+#define ACCEPT_RETRY 100 // Ms between accepts while out of descriptors
+#define WBUF_LIMIT  (1 << 20) // Stop reading pipelined requests above this backlog
+#define SEGS_LIMIT  64        // ... or above this many queued output segments
+#define IOV_BATCH   64        // Memory segments gathered into one writev
+
+// io_uring backend, available on Linux unless built with URING=0
+#if defined(__linux__) && !defined(HTTP_NO_URING)
+#define HTTP_RING 1
+#define RING_ENTRIES 1024      // Submission queue entries per worker
+#define RING_FILES   8192      // Registered socket slots, connections per worker
+#define RING_BUFS    1024      // Provided receive buffers (power of two)
+#define RING_BUFSIZE 4096
+#define BOUNCE_SIZE  (64 << 10) // File bytes read per send of an uncached range
+
+// Operation of a ring request, kept in the low bits of its user data
+#define OP_ACCEPT 1  // Multishot accept into a registered slot
+#define OP_RECV   2  // Multishot receive into provided buffers
+#define OP_SEND   3  // sendmsg of queued memory segments
+#define OP_READ   4  // Read of a file range into the bounce buffer
+#define OP_FILE   5  // Send of the bounce buffer
+#define OP_CLOSE  6  // Close of the registered slot
+#define OP_CANCEL 7  // Cancel of the receive or of everything on the slot
+#define OP_CACHE  8  // Multishot poll of the asset cache inotify descriptor
+#define OP_MASK   15
+#endif
+
+// Response builder initial sizes, both grow inside the request arena
+#define RESPONSE_HEAD  256 // Bytes of header fields
+#define RESPONSE_PARTS 8   // Body segments
+
+// Static asset cache default, per worker
+#define CACHE_BUDGET (64 << 20)
+
+// Per-worker recycling of request and connection memory
+#define ARENA_SIZE 8192      // First chunk of a request arena
+#define ARENA_KEEP 256       // Reset arenas a worker keeps for new requests
+#define CONN_KEEP  256       // Closed connections a worker keeps for new clients
+#define RBUF_KEEP  4 // Receive buffers grown past this many initial sizes are freed
+#define WBUF_KEEP  (1 << 16)
+
+// Keep-alive defaults
+#define KEEPALIVE_TIMEOUT  5   // Seconds an idle connection is kept open
+#define KEEPALIVE_REQUESTS 100 // Requests served before the connection is closed
+#define REQUEST_TIMEOUT    30  // Seconds to receive a request or send its response
+#define SERVER_NAME        64  // Longest Server header value
+
+// Overload shedding defaults, see overload_http
+#define QUEUE_DELAY  50   // Ms a request may queue in a worker before others are shed
+#define RETRY_AFTER  1    // Seconds a shed client is told to wait
+#define LIMIT_MIN    4    // Requests a worker always admits per batch of events
+#define LIMIT_MAX    4096 // Starting and largest per-batch limit
+#define LIMIT_WINDOW 100  // Ms between adjustments of the limit
+#define BUSY_SIZE    (128 + SERVER_NAME) // Precomputed 503 response
+
+// Route metrics, one slot per pattern ever registered
+#define ROUTE_PAGE  8    // Slots per metrics page, about 52 KB
+#define ROUTE_PAGES 1024 // Pages of a worker's metrics block
+#define ROUTE_SLOTS (ROUTE_PAGE * ROUTE_PAGES)
+
+// Metrics of one route on one worker, only that worker writes them
+typedef struct HTTProute {
+    _Atomic uint64_t requests;
+    _Atomic uint64_t bytes_in;  // Request heads and decoded bodies
+    _Atomic uint64_t bytes_out; // Responses as queued, headers included
+    _Atomic uint64_t status[5]; // Responses by status class, 1xx to 5xx
+    Histogram parse;    // Us from the first byte of a request to its dispatch
+    Histogram handler;  // Us the handler ran
+    Histogram send;     // Us from the end of the handler until the output drained
+} HTTProute;
+
+// Metrics block of a worker: a slot for requests no route took (404, parse
+// errors, shed and refused requests) and one per pattern ever registered,
+// in pages the worker allocates as its requests reach them
+typedef struct HTTPmetrics {
+    struct HTTPmetrics* next; // Blocks of the other workers
+    HTTProute unmatched;
+    _Atomic(HTTProute*) pages[ROUTE_PAGES];
+} HTTPmetrics;
+
+// Route table published to the workers, never changed once published
+// Routes are replaced by publishing a new table, see publish_http
+typedef struct HTTPtable {
+    Router* router;     // Route patterns to indexes of funcs and slots
+    void(**funcs)(int, HTTPrequests*); // Handler of each route
+    int32_t* slots;     // Metrics slot of each route
+    int32_t len;        // Number of routes
+    char** labels;      // Pattern of each metrics slot, removed routes included
+    int32_t nslots;     // Number of metrics slots
+} HTTPtable;
 
 // HTTP server structure containing routing information
 typedef struct HTTP{
     char* host;         // Server host address
-    int32_t len;        // Number of registered routes
-    int32_t cap;        // Capacity of routes array
-    void(**funcs)(int, HTTPrequests*); // Array of route handler functions
-    HashTab* tab;       // Hash table mapping paths to handler indices
+    _Atomic(HTTPtable*) table; // Current routes, read in epoch read sections
+    Epoch* epoch;       // Reclaims the tables replaced while workers read
+    atomic_flag writing; // Held while a route change builds its table
+    char** labels;      // Route patterns ever registered, owned here
+    int32_t nslots;     // Number of labels
+    int32_t workers;    // Number of worker threads (0 = one per online CPU)
+    int32_t idle;       // Idle timeout of a connection in seconds
+    int32_t maxreq;     // Requests served per connection before closing it
+    int8_t backend;     // Worker event loop, HTTP_EPOLL or HTTP_URING
+    _Atomic uint64_t requests; // Requests served, published by the workers
+    _Atomic uint64_t calls;    // System calls of the worker loops
+    int32_t backlog;    // Pending connections per listener, 0 for SOMAXCONN
+    int32_t timeout;    // Request timeout in seconds, idle applies between requests
+    int32_t maxconn;    // Open connections of the server, 0 for no limit
+    int32_t delay;      // Queueing latency target in ms, 0 admits every request
+    int32_t retry;      // Retry-After seconds of shed requests
+    _Atomic uint64_t admitted; // Requests admitted to their handlers
+    _Atomic uint64_t shed;     // Requests answered with 503 under overload
+    size_t rbuf;        // Initial receive buffer of a connection
+    char server[SERVER_NAME]; // Server header value, empty for none
+    int8_t trace;       // Whether TRACE requests reach the handlers
+    size_t cache;       // Static asset cache budget per worker in bytes, 0 disables
+    HTTPlimits limits;  // Request parser limits
+    _Atomic(HTTPmetrics*) metrics; // Metrics blocks of the workers started
+    int64_t since;      // Monotonic ms listen_http was called
 } HTTP;
 
+// Worker thread owning its own listener and event loop
+typedef struct HTTPworker {
+    HTTP* http;         // Shared server, read-only while serving
+    int32_t id;         // Worker number, also the CPU it is pinned to
+    int32_t maxconn;    // Share of the connection limit, 0 for no limit
+    int8_t status;      // Exit status of the worker loop
+} HTTPworker;
+
+// Piece of queued output: memory (output buffer or a cached blob) or a file range
+typedef struct HTTPseg {
+    int file;           // File streamed with sendfile, -1 for memory
+    char* ptr;          // Blob to send, NULL for bytes of the output buffer
+    CacheEntry* ref;    // Cache entry kept alive while ptr points into it
+    size_t off;         // Offset of the next byte to send
+    size_t len;         // Bytes left to send
+} HTTPseg;
+
+// Body segment of a response being built: memory or a file range
+typedef struct HTTPpart {
+    int file;           // File to stream, -1 for memory
+    char* ptr;          // Memory to send
+    CacheEntry* ref;    // Cache entry owning ptr, held until the part is queued
+    uint8_t copy;       // ptr is only valid until end_response, copy it
+    size_t off;         // File offset of the range
+    size_t len;
+} HTTPpart;
+
+// Send state of a connection on the io_uring backend
+// The kernel reads the header and iovecs until the send completes
+typedef struct HTTPsend {
+#ifdef __linux__
+    struct msghdr msg;
+#endif
+    struct iovec iov[IOV_BATCH];
+    char* bounce;       // File bytes being sent, BOUNCE_SIZE
+    size_t len;         // Bytes of the send in flight
+} HTTPsend;
+
+// Client connection state kept by the event loop between readiness events
+typedef struct HTTPconn {
+    int fd;             // Client socket
+    HTTPrequests* req;  // Request being parsed, NULL between requests
+    Arena* arena;       // Memory of the request and its handler, NULL with req
+    char* rbuf;         // Received bytes, requests are parsed in place
+    size_t rstart;      // Start of the request being parsed
+    size_t rlen;        // Number of bytes received in rbuf
+    size_t rcap;        // Capacity of rbuf
+    size_t head;        // Head length of the request whose body is read
+    size_t bpos;        // Offset of the body bytes not decoded yet
+    char* wbuf;         // Response bytes referenced by memory segments
+    size_t wlen;        // Number of bytes stored in wbuf
+    size_t wcap;        // Capacity of wbuf
+    HTTPseg* segs;      // Output queue in send order
+    size_t shead;       // Index of the first segment not fully sent
+    size_t slen;        // Number of segments queued
+    size_t scap;        // Capacity of segs
+    uint8_t done;       // Last response is queued, close after flush
+    uint8_t paused;     // Reading stopped until queued output drains
+    uint8_t close;      // Response being built is the last one
+    uint8_t body;       // Handler ran, the request body is being read
+    uint8_t corked;     // TCP_CORK is on until the queued file ranges are sent
+    uint8_t fixed;      // fd is a registered io_uring slot, not a descriptor
+    uint8_t recving;    // io_uring: multishot receive armed
+    uint8_t sending;    // io_uring: send or file read in flight
+    uint8_t closing;    // io_uring: 1 close wanted, 2 close submitted, 3 closed
+    int32_t inflight;   // io_uring: requests not completed yet
+    HTTPsend* send;     // io_uring: send state, allocated on the first send
+    int32_t served;     // Requests served on this connection
+    int64_t started;    // Monotonic us the request in progress started
+    int32_t route;      // Metrics slot of the dispatched request
+    uint16_t code;      // Status of its response, 0 until the status line is queued
+    size_t out;         // Bytes queued for its response
+    int64_t waiting;    // Us the oldest unsent response was queued, 0 if none
+    int32_t waitroute;  // Metrics slot of that response
+    Timer timer;        // Timeout of the current phase, see arm_conn
+    struct HTTPconn* next; // Next spare connection of the worker
+} HTTPconn;
+
+// Response under construction, the status line is written when it ends
+// Lives in the request arena, or in its own arena for a blocking socket
+typedef struct HTTPresponse {
+    int connect;        // Client socket
+    struct HTTPconn* conn; // Event loop connection, NULL for a blocking socket
+    Arena* arena;       // Memory of the response
+    Arena* own;         // Arena to free at the end, NULL for the request arena
+    int code;           // Status code and reason phrase
+    char* reason;
+    char* head;         // Header fields added so far
+    size_t headlen;
+    size_t headcap;
+    HTTPpart* parts;    // Body segments in send order
+    size_t nparts;
+    size_t partcap;
+    size_t length;      // Body bytes, becomes Content-Length
+} HTTPresponse;
+
+// Connection currently dispatched to a handler on this thread
+static _Thread_local HTTPconn* current_conn = NULL;
+// Static asset cache of the worker running on this thread
+static _Thread_local Cache* worker_cache = NULL;
+// Request arenas of the worker running on this thread
+static _Thread_local ArenaPool* worker_arenas = NULL;
+// Closed connections kept for reuse with their buffers, linked through next
+static _Thread_local HTTPconn* worker_conns = NULL;
+static _Thread_local int32_t worker_spare = 0;
+// Server the worker on this thread serves
+static _Thread_local HTTP* worker_http = NULL;
+// Open connections of the worker and its share of the connection limit
+static _Thread_local int32_t worker_open = 0;
+static _Thread_local int32_t worker_maxconn = 0;
+// Timeouts of the worker's connections
+static _Thread_local Wheel* worker_wheel = NULL;
+// Metrics of the worker, registered in HTTP.metrics
+static _Thread_local HTTPmetrics* worker_metrics = NULL;
+// Counters of the worker on this thread, added to HTTP by publish_worker
+static _Thread_local uint64_t worker_calls = 0;
+static _Thread_local uint64_t worker_served = 0;
+static _Thread_local uint64_t worker_admitted = 0;
+static _Thread_local uint64_t worker_shed = 0;
+// Adaptive limit of requests admitted per batch of ready events, see admit_conn
+static _Thread_local int64_t worker_wake = 0;   // Us the current batch started, 0 outside a loop
+static _Thread_local int32_t worker_batch = 0;  // Requests admitted in the current batch
+static _Thread_local int32_t worker_peak = 0;   // Largest batch of the window
+static _Thread_local int32_t worker_limit = LIMIT_MAX;
+static _Thread_local int64_t worker_worst = 0;  // Longest queueing delay of the window, us
+static _Thread_local int64_t worker_window = 0; // Us the limit is adjusted next
+static _Thread_local uint8_t worker_full = 0;   // Requests were shed in the window
+// 503 of shed requests, built by start_worker, the date is patched in
+static _Thread_local char worker_busy[BUSY_SIZE];
+static _Thread_local size_t worker_busylen = 0;
+static _Thread_local size_t worker_busydate = 0;
+
+// Count a system call of the worker loop
+#define COUNTED(call) (worker_calls += 1, (call))
+
+// Free a route table, the labels it points to are owned by HTTP
+static void free_table(void* ptr) {
+    HTTPtable* table = (HTTPtable*)ptr;
+    free_router(table->router);
+    free(table->funcs);
+    free(table->slots);
+    free(table->labels);
+    free(table);
+}
+
+// Index of the route with a metrics slot in a table, -1 if absent
+static int32_t find_table(HTTPtable* table, int32_t slot) {
+    for (int32_t i = 0; i < table->len; ++i) {
+        if (table->slots[i] == slot) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// New route table: the routes of from (NULL for none) with the route of a
+// metrics slot set to handle, or left out when handle is NULL
+// Returns NULL if the router rejects a pattern
+static HTTPtable* build_table(HTTPtable* from, char** labels, int32_t nslots, int32_t slot,
+    void(*handle)(int, HTTPrequests*)) {
+    int32_t cap = (from != NULL ? from->len : 0) + 1;
+    HTTPtable* table = (HTTPtable*)malloc(sizeof(HTTPtable));
+    table->router = new_router();
+    table->funcs = (void(**)(int, HTTPrequests*))malloc(cap * sizeof(void(*)(int, HTTPrequests*)));
+    table->slots = (int32_t*)malloc(cap * sizeof(int32_t));
+    table->len = 0;
+    table->labels = (char**)malloc((nslots > 0 ? nslots : 1) * sizeof(char*));
+    if (nslots > 0) {
+        memcpy(table->labels, labels, nslots * sizeof(char*));
+    }
+    table->nslots = nslots;
+    int8_t placed = 0;
+    for (int32_t i = 0; from != NULL && i < from->len; ++i) {
+        if (from->slots[i] == slot) {
+            placed = 1;
+            if (handle == NULL) {
+                continue;
+            }
+            table->funcs[table->len] = handle;
+        } else {
+            table->funcs[table->len] = from->funcs[i];
+        }
+        table->slots[table->len] = from->slots[i];
+        table->len += 1;
+    }
+    if (!placed && handle != NULL) {
+        table->funcs[table->len] = handle;
+        table->slots[table->len] = slot;
+        table->len += 1;
+    }
+    for (int32_t i = 0; i < table->len; ++i) {
+        if (add_router(table->router, labels[table->slots[i]], i) != 0) {
+            free_table(table);
+            return NULL;
+        }
+    }
+    return table;
+}
+
+// Publish a new route table with path routed to handle, or removed when
+// handle is NULL. Workers go on reading the old table until they leave
+// their read section; a later change frees it once none can hold it
+// Returns 0 on success, -1 for a missing route or a rejected pattern
+static int8_t publish_http(HTTP* http, char* path, void(*handle)(int, HTTPrequests*)) {
+    while (atomic_flag_test_and_set_explicit(&http->writing, memory_order_acquire));
+    HTTPtable* old = atomic_load(&http->table);
+    int32_t slot = 0;
+    while (slot < http->nslots && strcmp(http->labels[slot], path) != 0) {
+        ++slot;
+    }
+    HTTPtable* table = NULL;
+    if (slot < http->nslots) {
+        if (handle != NULL || find_table(old, slot) >= 0) {
+            table = build_table(old, http->labels, http->nslots, slot, handle);
+        }
+    } else if (handle != NULL && slot == ROUTE_SLOTS) {
+        fprintf(stderr, "http: more than %d route patterns: %s\n", ROUTE_SLOTS, path);
+    } else if (handle != NULL) {
+        // A new pattern gets the next metrics slot, kept if the router takes it
+        http->labels = (char**)realloc(http->labels, (slot + 1) * sizeof(char*));
+        http->labels[slot] = (char*)malloc(strlen(path) + 1);
+        strcpy(http->labels[slot], path);
+        table = build_table(old, http->labels, slot + 1, slot, handle);
+        if (table != NULL) {
+            http->nslots += 1;
+        } else {
+            free(http->labels[slot]);
+        }
+    }
+    if (table != NULL) {
+        atomic_store(&http->table, table);
+        retire_epoch(http->epoch, old, free_table);
+        reclaim_epoch(http->epoch);
+    }
+    atomic_flag_clear_explicit(&http->writing, memory_order_release);
+    return table != NULL ? 0 : -1;
+}
+
+// Point the parameter names of a matched request into the pattern label of
+// its route instead of the router, which a route change may free. The k-th
+// parameter is the k-th ":name" segment of the pattern
+static void rebase_params(HTTPrequests* request, char* label) {
+    char* p = label;
+    for (uint8_t i = 0; i < request->nparams; ++i) {
+        p = strchr(p, ':');
+        if (p == NULL) {
+            return;
+        }
+        request->params[i].name.ptr = p + 1;
+        p += 1 + request->params[i].name.len;
+    }
+}
+
 // Create a new HTTP server instance
 extern HTTP* new_http(char* address){
     HTTP* http = (HTTP*)malloc(sizeof(HTTP));
-    http->cap = 1000;   // Initial capacity for routes
-    http->len = 0;      // No routes initially
     // Allocate and copy host address
     http->host = (char*)malloc(sizeof(char) * strlen(address) + 1);
     strcpy(http->host, address);
-    // Create hash table for path-to-handler mapping
-    http->tab = new_hashtab(http->cap, STRING_TYPE, DECIMAL_TYPE);
-    // Allocate array for handler functions
-    http->funcs = (void(*)(int, HTTPrequests*))malloc(http->cap * sizeof(void(*)(int, HTTPrequests*)));
+    // Publish an empty route table
+    atomic_init(&http->table, build_table(NULL, NULL, 0, -1, NULL));
+    http->epoch = new_epoch();
+    atomic_flag_clear(&http->writing);
+    http->labels = NULL;
+    http->nslots = 0;
+    http->workers = 0;
+    http->idle = KEEPALIVE_TIMEOUT;
+    http->maxreq = KEEPALIVE_REQUESTS;
+    http->cache = CACHE_BUDGET;
+    http->backend = HTTP_EPOLL;
+    atomic_init(&http->requests, 0);
+    atomic_init(&http->calls, 0);
+    http->backlog = 0;
+    http->timeout = REQUEST_TIMEOUT;
+    http->maxconn = 0;
+    http->delay = QUEUE_DELAY;
+    http->retry = RETRY_AFTER;
+    atomic_init(&http->admitted, 0);
+    atomic_init(&http->shed, 0);
+    http->rbuf = RBUF_SIZE;
+    http->server[0] = '\0';
+    http->trace = 1;
+    http->limits = (HTTPlimits){ .uri = LIMIT_URI, .headers = LIMIT_HEADERS, .head = LIMIT_HEAD, .body = LIMIT_BODY };
+    atomic_init(&http->metrics, NULL);
+    http->since = 0;
     return http;
 }
 
 // Free all memory allocated for HTTP server
 extern void freehttp(HTTP* http){
-    free_hashtab(http->tab);
+    free_epoch(http->epoch);
+    free_table(atomic_load(&http->table));
     free(http->host);
-    free(http->funcs);
+    for (int32_t i = 0; i < http->nslots; ++i) {
+        free(http->labels[i]);
+    }
+    free(http->labels);
+    HTTPmetrics* metrics = atomic_load(&http->metrics);
+    while (metrics != NULL) {
+        HTTPmetrics* next = metrics->next;
+        for (int32_t i = 0; i < ROUTE_PAGES; ++i) {
+            free(atomic_load(&metrics->pages[i]));
+        }
+        free(metrics);
+        metrics = next;
+    }
     free(http);
 }
 
-// Register a new route handler for a specific path
+// Set the number of worker threads, 0 means one per online CPU
+extern void workers_http(HTTP* http, int32_t workers){
+    http->workers = workers < 0 ? 0 : workers;
+}
+
+// Set keep-alive idle timeout in seconds and requests served per connection
+extern void keepalive_http(HTTP* http, int32_t idle, int32_t maxreq){
+    http->idle = idle > 0 ? idle : KEEPALIVE_TIMEOUT;
+    http->maxreq = maxreq > 0 ? maxreq : KEEPALIVE_REQUESTS;
+}
+
+// Set the listen backlog of each worker's listener, 0 for SOMAXCONN
+extern void backlog_http(HTTP* http, int32_t backlog){
+    http->backlog = backlog < 0 ? 0 : backlog;
+}
+
+// Set the seconds a client has to send a request and read its response
+// Between requests the keep-alive idle timeout applies instead
+extern void timeout_http(HTTP* http, int32_t timeout){
+    http->timeout = timeout > 0 ? timeout : REQUEST_TIMEOUT;
+}
+
+// Limit the open connections of the server, 0 for no limit
+// Each worker keeps its share; at its share a worker stops accepting and new
+// clients wait in the listen backlog until a connection closes
+extern void connections_http(HTTP* http, int32_t maxconn){
+    http->maxconn = maxconn < 0 ? 0 : maxconn;
+}
+
+// Shed requests with 503 once they queue longer than delay ms in a worker,
+// telling clients to retry after retry seconds. delay 0 admits every request
+extern void overload_http(HTTP* http, int32_t delay, int32_t retry){
+    http->delay = delay < 0 ? 0 : delay;
+    http->retry = retry > 0 ? retry : RETRY_AFTER;
+}
+
+// Set the initial receive buffer of a connection in bytes
+extern void buffers_http(HTTP* http, size_t size){
+    http->rbuf = size >= 1024 ? size : RBUF_SIZE;
+}
+
+// Set the Server header of responses, NULL or "" for none (cut to 63 bytes)
+extern void server_http(HTTP* http, char* name){
+    snprintf(http->server, sizeof(http->server), "%s", name != NULL ? name : "");
+}
+
+// Allow or refuse TRACE requests, refused ones get 501 without a handler
+extern void trace_http(HTTP* http, int8_t allow){
+    http->trace = allow != 0;
+}
+
+// Choose the event loop of the workers, HTTP_EPOLL or HTTP_URING
+// Returns -1 and keeps epoll if this kernel or build has no usable io_uring
+extern int8_t backend_http(HTTP* http, int8_t backend){
+    if (backend != HTTP_URING) {
+        http->backend = HTTP_EPOLL;
+        return 0;
+    }
+#ifdef HTTP_RING
+    Ring* ring = new_ring(8, 8);
+    if (ring != NULL) {
+        free_ring(ring);
+        http->backend = HTTP_URING;
+        return 0;
+    }
+#endif
+    http->backend = HTTP_EPOLL;
+    return -1;
+}
+
+// Requests served and system calls made by the worker loops so far
+// Workers publish their counts once per loop iteration
+extern void stats_http(HTTP* http, uint64_t* requests, uint64_t* calls){
+    *requests = atomic_load_explicit(&http->requests, memory_order_relaxed);
+    *calls = atomic_load_explicit(&http->calls, memory_order_relaxed);
+}
+
+// Requests admitted to their handlers and requests shed with 503 so far
+// Workers publish their counts once per loop iteration
+extern void admission_http(HTTP* http, uint64_t* admitted, uint64_t* shed){
+    *admitted = atomic_load_explicit(&http->admitted, memory_order_relaxed);
+    *shed = atomic_load_explicit(&http->shed, memory_order_relaxed);
+}
+
+// Set per-worker static asset cache budget in bytes, 0 disables caching
+extern void cache_http(HTTP* http, size_t budget){
+    http->cache = budget;
+}
+
+// Set request parser limits: target length, header count, head and body size
+extern void limits_http(HTTP* http, size_t uri, size_t headers, size_t head, size_t body){
+    http->limits.uri = uri > 0 ? uri : LIMIT_URI;
+    http->limits.headers = headers > 0 && headers <= HTTP_HEADERS ? headers : HTTP_HEADERS;
+    http->limits.head = head > 0 ? head : LIMIT_HEAD;
+    http->limits.body = body > 0 ? body : LIMIT_BODY;
+}
+
+// Register a route handler for a path pattern, replacing the handler of a
+// pattern registered before. Safe while the server runs, see publish_http
+// "/a" matches only /a, "/a/" also everything below it, "/a/:id" any one segment
 extern void handle_http(HTTP* http, char* path, void(*handle)(int, HTTPrequests*)){
-    // Store path-to-index mapping in hash table
-    set_hashtab(http->tab, string(path), decimal(http->len));
-    // Store handler function in array
-    http->funcs[http->len] = handle;
-    http->len += 1;
-    // Expand capacity if needed
-    if (http->len == http->cap) {
-        http->cap <<= 1; // Double the capacity
-        http->funcs = (void(**)(int, HTTPrequests*))realloc(http->funcs, 
-            http->cap * (sizeof (void(*)(int, HTTPrequests*))));
-    }
-}
-
-// Create a new empty HTTP request structure
-static HTTPrequests new_request(void) {
-    return (HTTPrequests){
-        .method = {0},  // Initialize method buffer
-        .path = {0},    // Initialize path buffer
-        .prot = {0},    // Initialize protocol buffer
-        .state = 0,     // Initial parsing state
-        .ind = 0,       // Initial character index
-    };
-}
-
-// Reset request parsing state for next field
-static void null_request(HTTPrequests *request) {
-    request->state += 1; // Move to next parsing state
-    request->ind = 0;    // Reset character index
-}
-
-// Parse HTTP request line (method, path, protocol)
-static void parse_request(HTTPrequests *request, char *buffer, size_t size) {
-    for (size_t i = 0; i < size; ++i) {
-        switch(request->state) {
-            case 0: // Parsing HTTP method
-                if (buffer[i] == ' ' || request->ind == METHOD_SIZE-1) {
-                    request->method[request->ind] = '\0';
-                    null_request(request);
-                    continue;
-                }
-                request->method[request->ind] = buffer[i];
-            break;
-            case 1: // Parsing request path
-                if (buffer[i] == ' ' || request->ind == PATH_SIZE-1) {
-                    request->path[request->ind] = '\0';
-                    null_request(request);
-                    continue;
-                }
-                request->path[request->ind] = buffer[i];
-            break;
-            case 2: // Parsing HTTP protocol
-                if (buffer[i] == '\n' || request->ind == PROTO_SIZE-1) {
-                    request->prot[request->ind] = '\0';
-                    null_request(request);
-                    continue;
-                }
-                request->prot[request->ind] = buffer[i];
-            break;
-            default: return; // Parsing complete
-        }
-        request->ind += 1;
+    publish_http(http, path, handle);
+}
+
+// Remove the route of a pattern, also while the server runs
+// Returns 0 once removed, -1 if no route has that pattern
+extern int8_t unhandle_http(HTTP* http, char* path){
+    return publish_http(http, path, NULL);
+}
+
+// Whether the connection may serve another request after this one
+static int8_t keepalive_request(HTTPrequests *request) {
+    if (request->conn != 0) {
+        return request->conn > 0;
     }
+    return equal_view(request->prot, "HTTP/1.1"); // Persistent by default since 1.1
+}
+
+// Send a short plain response with the given status and reason as body
+static void status_html(int connect, int code, char* reason){
+    HTTPresponse* res = start_response(connect, code, reason);
+    header_response(res, "Content-Type", "text/plain");
+    static_response(res, reason, strlen(reason));
+    end_response(res);
 }
 
 // Send 404 Not Found response
 static void page404_html(int connect){
-    char* header = "HTML/1.1 404 Not Found\n\nnot found";
-    size_t headsz = strlen(header);
-    send_net(connect, header, headsz);
+    status_html(connect, 404, "Not Found");
+}
+
+// Answer a request the parser rejected
+static void error_html(int connect, uint16_t code){
+    switch (code) {
+        case 414: status_html(connect, 414, "URI Too Long"); break;
+        case 413: status_html(connect, 413, "Payload Too Large"); break;
+        case 431: status_html(connect, 431, "Request Header Fields Too Large"); break;
+        case 501: status_html(connect, 501, "Not Implemented"); break;
+        default: status_html(connect, 400, "Bad Request"); break;
+    }
+}
+
+// Run the handler of the route matching a request, or answer 404
+// The table is only read inside an epoch read section; the handler runs
+// after it, with parameter names rebased onto the pattern labels, which
+// live as long as the server. Returns the metrics slot of the route, -1
+// after answering 404
+static int32_t route_http(HTTP *http, int conn, HTTPrequests *request) {
+    EpochReader* reader = reader_epoch(http->epoch);
+    enter_epoch(http->epoch, reader);
+    HTTPtable* table = atomic_load(&http->table);
+    int32_t index = match_router(table->router, request->path, request->params, &request->nparams);
+    void(*handle)(int, HTTPrequests*) = NULL;
+    int32_t slot = -1;
+    if (index >= 0) {
+        handle = table->funcs[index];
+        slot = table->slots[index];
+        rebase_params(request, table->labels[slot]);
+    }
+    leave_epoch(reader);
+    if (handle == NULL) {
+        page404_html(conn);
+        return -1;
+    }
+    handle(conn, request);
+    return slot;
 }
 
 // Route incoming request to appropriate handler
-static int8_t switch_http(HTTP *http, int conn, HTTPrequests *request) {
-    // Check if exact path exists
-    if (!in_hashtab(http->tab, string(request->path))) {
-        char buffer[PATH_SIZE];
-        memcpy(buffer, request->path, PATH_SIZE);
-        int32_t index = strlen(request->path);
-        if (index == 0) {
-            page404_html(conn);
-            return 1;
-        }
-        index -= 1;
-        // Try to find parent directory handler
-        for (; index > 0 && buffer[index] != '/'; --index) {
-            buffer[index] = '\0';
+// Returns 0 when a handler ran, 1 after answering 404
+extern int8_t switch_http(HTTP *http, int conn, HTTPrequests *request) {
+    return route_http(http, conn, request) < 0;
+}
+
+// Create connection state for an accepted client socket
+// A connection closed earlier on this worker is reused with its buffers
+static HTTPconn* new_conn(int fd) {
+    HTTPconn* conn = worker_conns;
+    if (conn != NULL) {
+        worker_conns = conn->next;
+        worker_spare -= 1;
+    } else {
+        conn = (HTTPconn*)malloc(sizeof(HTTPconn));
+        conn->rbuf = NULL;
+        conn->rcap = 0;
+        conn->wbuf = NULL;
+        conn->wcap = 0;
+        conn->segs = NULL;
+        conn->scap = 0;
+        conn->send = NULL;
+    }
+    worker_open += 1;
+    conn->fd = fd;
+    conn->req = NULL;
+    conn->arena = NULL;
+    conn->rstart = 0;
+    conn->rlen = 0;
+    conn->head = 0;
+    conn->bpos = 0;
+    conn->body = 0;
+    conn->wlen = 0;
+    conn->shead = 0;
+    conn->slen = 0;
+    conn->done = 0;
+    conn->paused = 0;
+    conn->close = 0;
+    conn->corked = 0;
+    conn->fixed = 0;
+    conn->recving = 0;
+    conn->sending = 0;
+    conn->closing = 0;
+    conn->inflight = 0;
+    conn->served = 0;
+    conn->started = 0;
+    conn->route = -1;
+    conn->code = 0;
+    conn->out = 0;
+    conn->waiting = 0;
+    conn->waitroute = -1;
+    init_timer(&conn->timer);
+    conn->next = NULL;
+    return conn;
+}
+
+// Current monotonic time in milliseconds
+static int64_t now_ms(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Current monotonic time in microseconds, fine enough to time a batch
+static int64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Start a request: its parse state lives in an arena from the worker pool
+static void start_request(HTTP* http, HTTPconn* conn) {
+    conn->started = now_us();
+    conn->arena = get_pool(worker_arenas);
+    conn->req = (HTTPrequests*)alloc_arena(conn->arena, sizeof(HTTPrequests));
+    reset_request(conn->req, &http->limits);
+}
+
+// Finish a request: everything it allocated goes back with the arena at once
+static void end_request(HTTPconn* conn) {
+    if (conn->arena != NULL) {
+        put_pool(worker_arenas, conn->arena);
+    }
+    conn->arena = NULL;
+    conn->req = NULL;
+}
+
+// Free a connection and its buffers
+static void drop_conn(HTTPconn* conn) {
+    if (conn->send != NULL) {
+        free(conn->send->bounce);
+        free(conn->send);
+    }
+    free(conn->rbuf);
+    free(conn->segs);
+    free(conn->wbuf);
+    free(conn);
+}
+
+// Close client socket and files still queued, keep the state for reuse
+// Buffers that grew past their usual size are freed rather than kept
+static void free_conn(HTTPconn* conn) {
+    for (size_t i = conn->shead; i < conn->slen; ++i) {
+        if (conn->segs[i].file >= 0) {
+            close(conn->segs[i].file);
         }
-        if(!in_hashtab(http->tab, string(buffer))) {
-            page404_html(conn);
-            return 2;
+        if (conn->segs[i].ref != NULL) {
+            release_cache(conn->segs[i].ref);
         }
-        // Call parent directory handler
-        index = get_hashtab(http->tab, string(buffer)).decimal;
-        http->funcs[index](conn, request);
+    }
+    if (!conn->fixed) {
+        COUNTED(close_net(conn->fd)); // Ring slots are closed by the ring
+    }
+    end_request(conn);
+    if (worker_wheel != NULL) {
+        del_wheel(worker_wheel, &conn->timer);
+    }
+    worker_open -= 1;
+    if (worker_spare >= CONN_KEEP) {
+        drop_conn(conn);
+        return;
+    }
+    if (conn->rcap > worker_http->rbuf * RBUF_KEEP) {
+        free(conn->rbuf);
+        conn->rbuf = NULL;
+        conn->rcap = 0;
+    }
+    if (conn->wcap > WBUF_KEEP) {
+        free(conn->wbuf);
+        conn->wbuf = NULL;
+        conn->wcap = 0;
+    }
+    conn->next = worker_conns;
+    worker_conns = conn;
+    worker_spare += 1;
+}
+
+// Write the "Server: name" line of the worker's server into buf
+// Returns its length, 0 when no Server header is configured
+static size_t server_line(char* buf, size_t size) {
+    if (worker_http == NULL || worker_http->server[0] == '\0') {
         return 0;
     }
-    // Call exact path handler
-    int32_t index = get_hashtab(http->tab, string(request->path)).decimal;
-    http->funcs[index](conn, request);
+    int len = snprintf(buf, size, "Server: %s\r\n", worker_http->server);
+    return len > 0 && (size_t)len < size ? (size_t)len : 0;
+}
+
+// Build the 503 response of shed requests, only its Date changes later
+static void busy_worker(HTTP* http) {
+    size_t len = (size_t)snprintf(worker_busy, sizeof(worker_busy), "HTTP/1.1 503 Service Unavailable\r\nDate: ");
+    worker_busydate = len;
+    len += date_clock(worker_busy + len);
+    len += (size_t)snprintf(worker_busy + len, sizeof(worker_busy) - len, "\r\n");
+    len += server_line(worker_busy + len, sizeof(worker_busy) - len);
+    len += (size_t)snprintf(worker_busy + len, sizeof(worker_busy) - len,
+        "Retry-After: %d\r\nContent-Length: 0\r\n", (int)http->retry);
+    worker_busylen = len < sizeof(worker_busy) ? len : sizeof(worker_busy) - 1;
+}
+
+// Create the metrics block of the worker and publish it to the scrapers
+// Blocks stay registered until freehttp, their counts outlive the worker
+static void metrics_worker(HTTP* http) {
+    size_t size = (sizeof(HTTPmetrics) + 63) & ~(size_t)63;
+    HTTPmetrics* metrics = (HTTPmetrics*)aligned_alloc(64, size); // No line shared with other workers
+    memset(metrics, 0, size);
+    metrics->next = atomic_load(&http->metrics);
+    while (!atomic_compare_exchange_weak(&http->metrics, &metrics->next, metrics));
+    worker_metrics = metrics;
+}
+
+// Metrics slot of the worker on this thread, slot -1 for requests no route
+// took. Pages are allocated as requests reach them, routes added at runtime
+// get theirs on their first request
+static HTTProute* route_worker(int32_t slot) {
+    if (slot < 0) {
+        return &worker_metrics->unmatched;
+    }
+    _Atomic(HTTProute*)* page = &worker_metrics->pages[slot / ROUTE_PAGE];
+    HTTProute* routes = atomic_load_explicit(page, memory_order_relaxed);
+    if (routes == NULL) {
+        size_t size = (ROUTE_PAGE * sizeof(HTTProute) + 63) & ~(size_t)63;
+        routes = (HTTProute*)aligned_alloc(64, size);
+        memset(routes, 0, size);
+        atomic_store_explicit(page, routes, memory_order_release);
+    }
+    return &routes[slot % ROUTE_PAGE];
+}
+
+// Set up the memory a worker recycles between requests and connections
+static void start_worker(HTTP* http) {
+    worker_http = http;
+    worker_arenas = new_pool(ARENA_SIZE, ARENA_KEEP);
+    worker_wheel = new_wheel(now_ms());
+    busy_worker(http);
+    metrics_worker(http);
+}
+
+// Start a batch of ready events, adjusting the request limit once per window
+// While admitted requests queued past the target the limit drops to the batch
+// the target would have allowed; while requests are shed without that, it
+// grows by an eighth
+static void wake_worker(HTTP* http) {
+    worker_wake = now_us();
+    worker_batch = 0;
+    if (worker_wake < worker_window) {
+        return;
+    }
+    int64_t target = (int64_t)http->delay * 1000;
+    if (worker_worst > target) {
+        int32_t peak = worker_peak < worker_limit ? worker_peak : worker_limit;
+        worker_limit = (int32_t)(peak * target / worker_worst);
+        worker_limit = worker_limit > LIMIT_MIN ? worker_limit : LIMIT_MIN;
+    } else if (worker_full) {
+        worker_limit += worker_limit / 8 > 0 ? worker_limit / 8 : 1;
+        worker_limit = worker_limit < LIMIT_MAX ? worker_limit : LIMIT_MAX;
+    }
+    worker_peak = 0;
+    worker_worst = 0;
+    worker_full = 0;
+    worker_window = worker_wake + (int64_t)LIMIT_WINDOW * 1000;
+}
+
+// Whether a parsed request goes to its handler or is shed with 503
+// Requests of one batch run one after another, so the time since the wake-up
+// is how long a request queued behind the others; the limit caps the batch
+// to keep that under the target
+static int8_t admit_conn(HTTP* http, int64_t now) {
+    if (http->delay > 0 && worker_wake > 0) {
+        if (worker_batch >= worker_limit) {
+            worker_full = 1;
+            worker_shed += 1;
+            return 0;
+        }
+        int64_t waited = now - worker_wake;
+        worker_worst = waited > worker_worst ? waited : worker_worst;
+        worker_batch += 1;
+        worker_peak = worker_batch > worker_peak ? worker_batch : worker_peak;
+    }
+    worker_admitted += 1;
+    return 1;
+}
+
+// Free the recycled memory of the worker on this thread
+static void stop_worker(void) {
+    while (worker_conns != NULL) {
+        HTTPconn* next = worker_conns->next;
+        drop_conn(worker_conns);
+        worker_conns = next;
+    }
+    worker_spare = 0;
+    free_pool(worker_arenas);
+    worker_arenas = NULL;
+    free_wheel(worker_wheel);
+    worker_wheel = NULL;
+    worker_metrics = NULL;
+}
+
+
+// Append a segment to the output queue
+static HTTPseg* push_conn(HTTPconn* conn) {
+    if (conn->slen == conn->scap) {
+        conn->scap = conn->scap ? conn->scap << 1 : 8;
+        conn->segs = (HTTPseg*)realloc(conn->segs, conn->scap * sizeof(HTTPseg));
+    }
+    return &conn->segs[conn->slen++];
+}
+
+// Whether any output is still waiting to be sent
+static int8_t pending_conn(HTTPconn* conn) {
+    return conn->shead < conn->slen;
+}
+
+// Append bytes to the connection output buffer
+// The first bytes of a response are its status line, the status is noted
+static void queue_conn(HTTPconn* conn, char* buf, size_t size) {
+    if (conn->out == 0 && size >= 12 && memcmp(buf, "HTTP/1.", 7) == 0) {
+        conn->code = (uint16_t)((buf[9] - '0') * 100 + (buf[10] - '0') * 10 + (buf[11] - '0'));
+    }
+    conn->out += size;
+    if (conn->wlen + size > conn->wcap) {
+        size_t cap = conn->wcap ? conn->wcap : BUFSIZ;
+        while (cap < conn->wlen + size) {
+            cap <<= 1;
+        }
+        conn->wbuf = (char*)realloc(conn->wbuf, cap);
+        conn->wcap = cap;
+    }
+    memcpy(conn->wbuf + conn->wlen, buf, size);
+    // wbuf is append-only until the queue drains, so memory segments are contiguous
+    HTTPseg* last = pending_conn(conn) ? &conn->segs[conn->slen-1] : NULL;
+    if (last != NULL && last->file < 0 && last->ptr == NULL) {
+        last->len += size;
+    } else {
+        HTTPseg* seg = push_conn(conn);
+        seg->file = -1;
+        seg->ptr = NULL;
+        seg->ref = NULL;
+        seg->off = conn->wlen;
+        seg->len = size;
+    }
+    conn->wlen += size;
+}
+
+// Queue a file range, the connection takes ownership of the descriptor
+// Output queued before it is corked so the headers leave with the first file bytes
+static void queue_file_conn(HTTPconn* conn, int file, size_t off, size_t size) {
+    if (size == 0) {
+        close(file);
+        return;
+    }
+    conn->out += size;
+    if (!conn->corked && !conn->fixed && pending_conn(conn) && COUNTED(cork_net(conn->fd, 1)) == 0) {
+        conn->corked = 1;
+    }
+    HTTPseg* seg = push_conn(conn);
+    seg->file = file;
+    seg->ptr = NULL;
+    seg->ref = NULL;
+    seg->off = off;
+    seg->len = size;
+}
+
+// Queue memory sent without copying, held by a cache entry if ref is set
+static void queue_blob_conn(HTTPconn* conn, char* ptr, size_t size, CacheEntry* ref) {
+    if (size == 0) {
+        return;
+    }
+    if (ref != NULL) {
+        hold_cache(ref);
+    }
+    conn->out += size;
+    HTTPseg* seg = push_conn(conn);
+    seg->file = -1;
+    seg->ptr = ptr;
+    seg->ref = ref;
+    seg->off = 0;
+    seg->len = size;
+}
+
+// Mark n bytes of the queue head as sent, releasing finished segments
+static void advance_conn(HTTPconn* conn, size_t n) {
+    while (n > 0) {
+        HTTPseg* seg = &conn->segs[conn->shead];
+        size_t step = n < seg->len ? n : seg->len;
+        seg->off += step;
+        seg->len -= step;
+        n -= step;
+        if (seg->len > 0) {
+            return;
+        }
+        if (seg->ref != NULL) {
+            release_cache(seg->ref);
+        }
+        conn->shead += 1;
+    }
+}
+
+// Record the send time of the oldest unsent response once the output drained
+// Responses queued behind it in the same drain share its sample
+static void drained_conn(HTTPconn* conn) {
+    if (conn->waiting != 0) {
+        record_histogram(&route_worker(conn->waitroute)->send, (uint64_t)(now_us() - conn->waiting));
+        conn->waiting = 0;
+    }
+}
+
+// Count a finished request in the metrics of its route
+static void count_conn(HTTPconn* conn) {
+    HTTProute* route = route_worker(conn->route);
+    bump_counter(&route->requests, 1);
+    bump_counter(&route->bytes_in, conn->head + conn->req->body);
+    bump_counter(&route->bytes_out, conn->out);
+    if (conn->code >= 100 && conn->code < 600) {
+        bump_counter(&route->status[conn->code / 100 - 1], 1);
+    }
+}
+
+// Send as much queued output as the socket accepts
+// Consecutive memory segments go out in one writev, file ranges via sendfile
+// Returns 0 when everything is sent, 1 if the socket is full, -1 on error
+static int8_t flush_conn(HTTPconn* conn) {
+    while (pending_conn(conn)) {
+        HTTPseg* seg = &conn->segs[conn->shead];
+        int n;
+        if (seg->file < 0) {
+            struct iovec iov[IOV_BATCH];
+            int count = 0;
+            for (size_t i = conn->shead; i < conn->slen && count < IOV_BATCH; ++i) {
+                HTTPseg* mem = &conn->segs[i];
+                if (mem->file >= 0) {
+                    break;
+                }
+                iov[count].iov_base = mem->ptr != NULL ? mem->ptr + mem->off : conn->wbuf + mem->off;
+                iov[count].iov_len = mem->len;
+                count += 1;
+            }
+            n = COUNTED(writev_net(conn->fd, iov, count));
+            if (n > 0) {
+                advance_conn(conn, (size_t)n);
+                continue;
+            }
+        } else {
+            n = COUNTED(sendfile_net(conn->fd, seg->file, &seg->off, seg->len));
+            if (n > 0) {
+                seg->len -= n;
+                if (seg->len == 0) {
+                    close(seg->file);
+                    conn->shead += 1;
+                }
+                continue;
+            }
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+        }
+        return -1; // File shrank under us, the promised length cannot be met
+    }
+    if (conn->corked) {
+        COUNTED(cork_net(conn->fd, 0));
+        conn->corked = 0;
+    }
+    conn->wlen = 0;
+    conn->shead = 0;
+    conn->slen = 0;
+    drained_conn(conn);
     return 0;
 }
 
-// Start HTTP server and listen for connections (infinite loop, no shutdown)
-extern int8_t listen(HTTP* http){
-    // Create listening socket
-    int listener = listen_net(http->host);
-    if (listener < 0) {
-        return 1;
+// Queue the precomputed 503 of a shed request, its body is read and dropped
+static void busy_conn(HTTPconn* conn) {
+    char date[CLOCK_DATE];
+    date_clock(date);
+    memcpy(worker_busy + worker_busydate, date, CLOCK_DATE - 1);
+    queue_conn(conn, worker_busy, worker_busylen);
+    if (conn->close) {
+        queue_conn(conn, "Connection: close\r\n\r\n", 21);
+    } else {
+        queue_conn(conn, "\r\n", 2);
     }
-    // Main server loop (runs forever)
-    while(1) {
-        // Accept new connection
-        int conn = accept_net(listener);
-        if (conn < 0) {
-            continue;
+}
+
+// Route a parsed request, its handler runs before the body is read
+// Requests no handler took count in the last metrics slot
+static void dispatch_conn(HTTP* http, HTTPconn* conn) {
+    int64_t now = now_us();
+    conn->served += 1;
+    worker_served += 1;
+    conn->close = !keepalive_request(conn->req) || conn->served >= http->maxreq;
+    conn->route = -1;
+    conn->code = 0;
+    conn->out = 0;
+    // Handlers write through send_http into the output buffer
+    current_conn = conn;
+    if (conn->req->state == PARSE_ERROR) {
+        conn->close = 1; // Framing of anything after a bad request is unknown
+        error_html(conn->fd, conn->req->error);
+    } else if (!admit_conn(http, now)) {
+        busy_conn(conn);
+    } else if (!http->trace && equal_view(conn->req->method, "TRACE")) {
+        error_html(conn->fd, 501);
+    } else {
+        conn->route = route_http(http, conn->fd, conn->req);
+    }
+    current_conn = NULL;
+    int64_t done = now_us();
+    HTTProute* route = route_worker(conn->route);
+    record_histogram(&route->parse, (uint64_t)(now - conn->started));
+    record_histogram(&route->handler, (uint64_t)(done - now));
+    if (conn->waiting == 0 && pending_conn(conn)) {
+        conn->waiting = done;
+        conn->waitroute = conn->route;
+    }
+}
+
+// Decode the received body bytes of the dispatched request
+// Pieces go to the handler's onbody as they arrive, or are dropped without it
+// Returns 0 once the body is complete, 1 if more bytes are needed
+static int8_t body_conn(HTTPconn* conn) {
+    HTTPrequests* req = conn->req;
+    // The head may have moved in the buffer since the handler saw it
+    parse_request(req, conn->rbuf + conn->rstart, conn->head);
+    char* p = conn->rbuf + conn->bpos;
+    char* end = conn->rbuf + conn->rlen;
+    current_conn = conn;
+    while (p < end && req->bstate != BODY_DONE && req->bstate != BODY_ERROR) {
+        HTTPview data;
+        p += body_request(req, p, end - p, &data);
+        if (data.len > 0 && req->onbody != NULL) {
+            req->onbody(conn->fd, req, data);
         }
-        // Initialize request structure
-        HTTPrequests req = new_request();
-        // Read and parse HTTP request
-        while(1) {
-            char buffer[BUFSIZ] = {0};
-            int n = recv_net(conn, buffer, BUFSIZ);
-            if (n < 0) {
-                break;
+    }
+    conn->bpos = p - conn->rbuf;
+    int8_t more = req->bstate != BODY_DONE && req->bstate != BODY_ERROR;
+    if (!more && req->onbody != NULL) {
+        req->onbody(conn->fd, req, (HTTPview){NULL, 0});
+    }
+    current_conn = NULL;
+    if (req->bstate == BODY_ERROR) {
+        conn->close = 1; // The rest of the stream cannot be framed
+    }
+    return more;
+}
+
+// Parse and dispatch every complete request in the receive buffer, in order
+static void process_conn(HTTP* http, HTTPconn* conn) {
+    while (!conn->done) {
+        if (conn->body) {
+            if (body_conn(conn) != 0) {
+                break; // Need more body bytes
             }
-            parse_request(&req, buffer, n);
-            if (n != BUFSIZ) {
-                break; // End of request
+            conn->body = 0;
+            conn->rstart = conn->bpos;
+            conn->done = conn->close;
+            count_conn(conn);
+            end_request(conn);
+            continue;
+        }
+        if (conn->rstart == conn->rlen) {
+            break;
+        }
+        if (conn->wlen > WBUF_LIMIT || conn->slen - conn->shead > SEGS_LIMIT) {
+            conn->paused = 1; // Client is not reading its responses
+            break;
+        }
+        if (conn->req == NULL) {
+            start_request(http, conn);
+        }
+        size_t used = parse_request(conn->req, conn->rbuf + conn->rstart, conn->rlen - conn->rstart);
+        if (conn->req->state != PARSE_DONE && conn->req->state != PARSE_ERROR) {
+            break; // Need more bytes
+        }
+        dispatch_conn(http, conn);
+        if (conn->req->state == PARSE_ERROR) {
+            conn->done = 1;
+            conn->head = used;
+            count_conn(conn);
+            end_request(conn);
+            break;
+        }
+        conn->head = used;
+        conn->bpos = conn->rstart + used;
+        conn->body = 1;
+    }
+    if (!conn->body && conn->rstart == conn->rlen) {
+        conn->rstart = 0;
+        conn->rlen = 0;
+    }
+}
+
+// Make room at the end of the receive buffer
+// Consumed requests and body bytes are dropped first, the buffer only grows
+// for a long head
+static void reserve_conn(HTTPconn* conn) {
+    if (conn->rbuf == NULL) {
+        conn->rcap = worker_http->rbuf;
+        conn->rbuf = (char*)malloc(conn->rcap);
+    }
+    if (conn->rcap - conn->rlen >= worker_http->rbuf / 4) {
+        return;
+    }
+    if (conn->body && conn->bpos > conn->rstart + conn->head) {
+        // The head stays for the handler's views, decoded body bytes go
+        size_t keep = conn->rstart + conn->head;
+        memmove(conn->rbuf + keep, conn->rbuf + conn->bpos, conn->rlen - conn->bpos);
+        conn->rlen -= conn->bpos - keep;
+        conn->bpos = keep;
+    }
+    if (conn->rstart > 0) {
+        // The request in progress restarts at offset 0, its parse offsets are relative
+        memmove(conn->rbuf, conn->rbuf + conn->rstart, conn->rlen - conn->rstart);
+        conn->rlen -= conn->rstart;
+        if (conn->body) {
+            conn->bpos -= conn->rstart;
+        }
+        conn->rstart = 0;
+    }
+    if (conn->rcap - conn->rlen < worker_http->rbuf / 4) {
+        conn->rcap <<= 1;
+        conn->rbuf = (char*)realloc(conn->rbuf, conn->rcap);
+    }
+}
+
+#ifdef __linux__
+// Arm the timeout of the phase a connection is in, all from timeout_http
+// except the keep-alive idle time between requests. A request head must
+// arrive within the timeout of its first byte, however it trickles in; body
+// and response bytes only need to keep making progress.
+static void arm_conn(HTTP* http, HTTPconn* conn) {
+    int64_t now = now_ms();
+    int64_t deadline;
+    if (pending_conn(conn) || conn->body) {
+        deadline = now + (int64_t)http->timeout * 1000; // Writing or reading a body
+    } else if (conn->req != NULL) {
+        deadline = conn->started / 1000 + (int64_t)http->timeout * 1000; // Reading a head
+    } else {
+        deadline = now + (int64_t)http->idle * 1000;
+    }
+    add_wheel(worker_wheel, &conn->timer, deadline);
+}
+
+// Connection owning a timer of the wheel
+static HTTPconn* timer_conn(Timer* timer) {
+    return (HTTPconn*)((char*)timer - offsetof(HTTPconn, timer));
+}
+
+// Add the counters of this thread's worker to the server totals
+static void publish_worker(HTTP* http) {
+    if (worker_served > 0) {
+        atomic_fetch_add_explicit(&http->requests, worker_served, memory_order_relaxed);
+        worker_served = 0;
+    }
+    if (worker_calls > 0) {
+        atomic_fetch_add_explicit(&http->calls, worker_calls, memory_order_relaxed);
+        worker_calls = 0;
+    }
+    if (worker_admitted > 0) {
+        atomic_fetch_add_explicit(&http->admitted, worker_admitted, memory_order_relaxed);
+        worker_admitted = 0;
+    }
+    if (worker_shed > 0) {
+        atomic_fetch_add_explicit(&http->shed, worker_shed, memory_order_relaxed);
+        worker_shed = 0;
+    }
+}
+
+// Read everything available, parsing and dispatching pipelined requests in order
+// Returns -1 if the connection must be closed
+static int8_t read_conn(HTTP* http, HTTPconn* conn) {
+    while (!conn->paused) {
+        reserve_conn(conn);
+        int n = COUNTED(recv_net(conn->fd, conn->rbuf + conn->rlen, conn->rcap - conn->rlen));
+        if (n == 0) {
+            conn->done = 1; // Peer closed its side, finish sending and close
+            return 0;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (conn->done) {
+            conn->rstart = 0; // Drain and ignore anything after the last request
+            conn->rlen = 0;
+            continue;
         }
-        // Route request to appropriate handler
-        switch_http(http, conn, &req);
-        close_net(conn);
+        conn->rlen += n;
+        process_conn(http, conn);
     }
-    close_net(listener);
     return 0;
 }
 
-// Send HTML file as HTTP response
-extern void htmlparse_http(int connect, char* name){
-    // Send HTTP 200 OK response with HTML content type
-    char buffer[BUFSIZ] = "HTTP/1.1 200 OK\nContent-type: text/html\n\n";
-    size_t readsz = strlen(buffer);
-    send_net(connect, buffer, readsz);
-    // Open and send HTML file content
-    FILE* file = fopen(name, "r");
-    if(file == NULL)
-        return;
-    while((readsz = fread(buffer, sizeof(char), BUFSIZ, file)) != 0)
-        send_net(connect, buffer, readsz);
-    fclose(file);
-}
\ No newline at end of file
+// Handle readiness of a client socket, returns -1 if it must be closed
+static int8_t event_conn(HTTP* http, HTTPconn* conn, uint8_t flags) {
+    if (flags & LOOP_CLOSE) {
+        return -1;
+    }
+    if ((flags & LOOP_READ) && read_conn(http, conn) < 0) {
+        return -1;
+    }
+    while (pending_conn(conn)) {
+        int8_t rc = flush_conn(conn);
+        if (rc != 0) {
+            return rc < 0 ? -1 : 0; // Wait for writability
+        }
+        if (!conn->paused) {
+            break;
+        }
+        // Output drained: resume the pipelined requests left in the buffers
+        conn->paused = 0;
+        process_conn(http, conn);
+        if (read_conn(http, conn) < 0) {
+            return -1;
+        }
+    }
+    if (conn->done && !pending_conn(conn)) {
+        return -1; // Last response fully sent
+    }
+    return 0;
+}
+
+// Whether the worker is at its share of the connection limit
+static int8_t full_worker(void) {
+    return worker_maxconn > 0 && worker_open >= worker_maxconn;
+}
+
+// Descriptor the worker keeps in reserve for shed_accept
+static _Thread_local int worker_reserve = -1;
+// Running out of descriptors was logged, cleared by the next accept
+static _Thread_local uint8_t worker_starved = 0;
+
+// Out of descriptors: give up the reserve to accept a waiting client and
+// close it at once, so the backlog drains instead of stalling until the next
+// connect raises the edge-triggered listener again
+// Returns 0 if a client was shed, 1 if the backlog is empty, -1 if there is
+// no descriptor to spare
+static int8_t shed_accept(int listener) {
+    if (worker_reserve < 0) {
+        return -1;
+    }
+    close(worker_reserve);
+    int fd = COUNTED(accept_nonblock_net(listener));
+    int err = errno;
+    if (fd >= 0) {
+        close(fd);
+    }
+    worker_reserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        return 0;
+    }
+    return err == EAGAIN || err == EWOULDBLOCK ? 1 : -1;
+}
+
+// Accept pending connections and register them in the loop
+// At the connection limit the rest stay in the listen backlog; the listener
+// is edge-triggered, so serve_loop calls this again once there is room
+// Out of descriptors, waiting clients are shed through the reserve; without
+// one serve_loop retries every ACCEPT_RETRY ms
+// Returns 1 if accepting stopped at the limit, 2 if out of descriptors
+static int8_t accept_conns(HTTP* http, Loop* loop, int listener) {
+    while (1) {
+        if (full_worker()) {
+            return 1;
+        }
+        int fd = COUNTED(accept_nonblock_net(listener));
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EMFILE && errno != ENFILE) {
+                return 0; // EAGAIN: backlog drained
+            }
+            if (!worker_starved) {
+                fprintf(stderr, "http: out of descriptors, closing new clients: %s\n", strerror(errno));
+                worker_starved = 1;
+            }
+            int8_t rc = shed_accept(listener);
+            if (rc == 0) {
+                continue;
+            }
+            return rc > 0 ? 0 : 2;
+        }
+        worker_starved = 0;
+        if (worker_reserve < 0) {
+            worker_reserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+        HTTPconn* conn = new_conn(fd);
+        if (COUNTED(add_loop(loop, fd, LOOP_READ | LOOP_WRITE, conn)) != 0) {
+            free_conn(conn);
+            continue;
+        }
+        arm_conn(http, conn);
+    }
+}
+
+// Close connections whose timeout passed, returns ms until the next one
+static int expire_conns(Loop* loop) {
+    int64_t now = now_ms();
+    Timer* timer = expire_wheel(worker_wheel, now);
+    while (timer != NULL) {
+        Timer* next = timer->next;
+        HTTPconn* conn = timer_conn(timer);
+        COUNTED(del_loop(loop, conn->fd));
+        free_conn(conn);
+        timer = next;
+    }
+    return wait_wheel(worker_wheel, now);
+}
+
+// Loop data of descriptors that are not client connections
+static char listener_tag;
+static char cache_tag;
+
+// Run the edge-triggered event loop on a non-blocking listener
+static int8_t serve_loop(HTTP* http, int listener) {
+    Loop* loop = new_loop(LOOP_EVENTS);
+    if (loop == NULL) {
+        return 2;
+    }
+    if (nonblock_net(listener) != 0 || add_loop(loop, listener, LOOP_READ, &listener_tag) != 0) {
+        free_loop(loop);
+        return 3;
+    }
+    if (http->cache > 0) {
+        worker_cache = new_cache(http->cache);
+        if (fd_cache(worker_cache) >= 0) {
+            add_loop(loop, fd_cache(worker_cache), LOOP_READ, &cache_tag);
+        }
+    }
+    start_worker(http);
+    worker_reserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    int8_t paused = 0; // Accepting stopped at the connection limit or out of descriptors
+    while(1) {
+        publish_worker(http);
+        if (paused && !full_worker()) {
+            paused = accept_conns(http, loop, listener);
+        }
+        int timeout = expire_conns(loop);
+        if (paused == 2 && (timeout < 0 || timeout > ACCEPT_RETRY)) {
+            timeout = ACCEPT_RETRY;
+        }
+        int n = COUNTED(wait_loop(loop, timeout));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        wake_worker(http);
+        for (int i = 0; i < n; ++i) {
+            void* data = data_loop(loop, i);
+            if (data == &listener_tag) {
+                paused = accept_conns(http, loop, listener);
+                continue;
+            }
+            if (data == &cache_tag) {
+                events_cache(worker_cache);
+                continue;
+            }
+            HTTPconn* conn = (HTTPconn*)data;
+            if (event_conn(http, conn, flags_loop(loop, i)) < 0) {
+                COUNTED(del_loop(loop, conn->fd));
+                free_conn(conn);
+                continue;
+            }
+            arm_conn(http, conn);
+        }
+    }
+    if (worker_cache != NULL) {
+        free_cache(worker_cache);
+        worker_cache = NULL;
+    }
+    if (worker_reserve >= 0) {
+        close(worker_reserve);
+        worker_reserve = -1;
+    }
+    stop_worker();
+    free_loop(loop);
+    return 4;
+}
+
+#ifdef HTTP_RING
+// Completion loop state of a worker on the io_uring backend
+typedef struct HTTPring {
+    Ring* ring;
+    HTTP* http;
+    int listener;
+    uint8_t accepting;  // 1 multishot accept armed, 2 its cancel submitted
+    uint64_t calls;     // io_uring_enter calls already counted
+} HTTPring;
+
+// Queue a request on the ring tagged with its connection and operation
+// Returns NULL if the submission queue stays full, the request is then dropped
+static struct io_uring_sqe* prep_ring(HTTPring* r, HTTPconn* conn, uint8_t op) {
+    struct io_uring_sqe* sqe = sqe_ring(r->ring);
+    if (sqe == NULL) {
+        return NULL;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)conn | op;
+    if (conn != NULL) {
+        conn->inflight += 1;
+    }
+    return sqe;
+}
+
+// Re-arm the timeout of a connection that is not closing
+static void touch_ring(HTTPring* r, HTTPconn* conn) {
+    if (!conn->closing) {
+        arm_conn(r->http, conn);
+    }
+}
+
+// Arm the multishot accept, each accepted socket goes into a free ring slot
+static void accept_ring(HTTPring* r) {
+    struct io_uring_sqe* sqe = prep_ring(r, NULL, OP_ACCEPT);
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = r->listener;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->file_index = IORING_FILE_INDEX_ALLOC;
+    r->accepting = 1;
+}
+
+// Stop accepting at the connection limit, new clients wait in the backlog
+static void pause_ring(HTTPring* r) {
+    struct io_uring_sqe* sqe = prep_ring(r, NULL, OP_CANCEL);
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = OP_ACCEPT;
+    r->accepting = 2;
+}
+
+// Arm the multishot receive of a connection into the provided buffers
+static void recv_ring(HTTPring* r, HTTPconn* conn) {
+    struct io_uring_sqe* sqe = prep_ring(r, conn, OP_RECV);
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = 0;
+    conn->recving = 1;
+}
+
+// Stop the receive of a connection, bytes already completed still arrive
+static void cancel_ring(HTTPring* r, HTTPconn* conn) {
+    struct io_uring_sqe* sqe = prep_ring(r, conn, OP_CANCEL);
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uint64_t)(uintptr_t)conn | OP_RECV;
+}
+
+// Close the ring slot of a connection
+static struct io_uring_sqe* close_ring(HTTPring* r, HTTPconn* conn) {
+    struct io_uring_sqe* sqe = prep_ring(r, conn, OP_CLOSE);
+    if (sqe != NULL) {
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = (uint32_t)conn->fd + 1;
+    }
+    return sqe;
+}
+
+// Close a connection now: cancel everything on its slot, then close it
+static void abort_ring(HTTPring* r, HTTPconn* conn) {
+    if (conn->closing) {
+        return;
+    }
+    del_wheel(worker_wheel, &conn->timer);
+    if (space_ring(r->ring) < 2) {
+        submit_ring(r->ring, 0, 0);
+    }
+    struct io_uring_sqe* sqe = prep_ring(r, conn, OP_CANCEL);
+    if (sqe != NULL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = conn->fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_FD_FIXED | IORING_ASYNC_CANCEL_ALL;
+    }
+    close_ring(r, conn);
+    conn->closing = 2;
+}
+
+// Send the next part of the output queue
+// Memory segments go out in one sendmsg, file ranges are read into the bounce
+// buffer first: sendfile cannot take a ring slot. Once the last response is
+// queued, the close is linked to the send that finishes it.
+static void send_ring(HTTPring* r, HTTPconn* conn) {
+    if (conn->sending || conn->closing) {
+        return;
+    }
+    if (!pending_conn(conn)) {
+        if (conn->done) {
+            // Nothing left to say: stop receiving and close
+            del_wheel(worker_wheel, &conn->timer);
+            if (conn->recving) {
+                cancel_ring(r, conn);
+            }
+            close_ring(r, conn);
+            conn->closing = 1;
+        }
+        return;
+    }
+    if (conn->send == NULL) {
+        conn->send = (HTTPsend*)calloc(1, sizeof(HTTPsend));
+    }
+    HTTPsend* send = conn->send;
+    HTTPseg* seg = &conn->segs[conn->shead];
+    if (seg->file >= 0) {
+        if (send->bounce == NULL) {
+            send->bounce = (char*)malloc(BOUNCE_SIZE);
+        }
+        struct io_uring_sqe* sqe = prep_ring(r, conn, OP_READ);
+        if (sqe == NULL) {
+            abort_ring(r, conn);
+            return;
+        }
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = seg->file;
+        sqe->off = seg->off;
+        sqe->addr = (uint64_t)(uintptr_t)send->bounce;
+        sqe->len = seg->len < BOUNCE_SIZE ? (uint32_t)seg->len : BOUNCE_SIZE;
+        conn->sending = 1;
+        return;
+    }
+    int count = 0;
+    size_t total = 0;
+    size_t i = conn->shead;
+    for (; i < conn->slen && count < IOV_BATCH; ++i) {
+        HTTPseg* mem = &conn->segs[i];
+        if (mem->file >= 0) {
+            break;
+        }
+        send->iov[count].iov_base = mem->ptr != NULL ? mem->ptr + mem->off : conn->wbuf + mem->off;
+        send->iov[count].iov_len = mem->len;
+        total += mem->len;
+        count += 1;
+    }
+    uint8_t last = conn->done && i == conn->slen;
+    if (last && space_ring(r->ring) < 3) {
+        submit_ring(r->ring, 0, 0); // The linked pair must go in one submission
+    }
+    struct io_uring_sqe* sqe = prep_ring(r, conn, OP_SEND);
+    if (sqe == NULL) {
+        abort_ring(r, conn);
+        return;
+    }
+    memset(&send->msg, 0, sizeof(send->msg));
+    send->msg.msg_iov = send->iov;
+    send->msg.msg_iovlen = count;
+    send->len = total;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->fd;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uint64_t)(uintptr_t)&send->msg;
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    conn->sending = 1;
+    if (last) {
+        sqe->flags |= IOSQE_IO_LINK;
+        del_wheel(worker_wheel, &conn->timer);
+        if (conn->recving) {
+            cancel_ring(r, conn);
+        }
+        close_ring(r, conn);
+        conn->closing = 1;
+    }
+}
+
+// Send the bounce buffer holding size bytes of the file segment at the head
+static void file_ring(HTTPring* r, HTTPconn* conn, size_t size) {
+    HTTPsend* send = conn->send;
+    uint8_t last = conn->done && conn->shead + 1 == conn->slen && size == conn->segs[conn->shead].len;
+    if (last && space_ring(r->ring) < 3) {
+        submit_ring(r->ring, 0, 0);
+    }
+    struct io_uring_sqe* sqe = prep_ring(r, conn, OP_FILE);
+    if (sqe == NULL) {
+        abort_ring(r, conn);
+        return;
+    }
+    send->len = size;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uint64_t)(uintptr_t)send->bounce;
+    sqe->len = (uint32_t)size;
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    if (last) {
+        sqe->flags |= IOSQE_IO_LINK;
+        del_wheel(worker_wheel, &conn->timer);
+        if (conn->recving) {
+            cancel_ring(r, conn);
+        }
+        close_ring(r, conn);
+        conn->closing = 1;
+    }
+}
+
+// Resume a connection once its send completed
+// Requests that arrived meanwhile are processed now: the output buffer must
+// not move while the kernel reads from it
+static void sent_ring(HTTPring* r, HTTPconn* conn) {
+    conn->sending = 0;
+    if (conn->closing) {
+        return;
+    }
+    if (!pending_conn(conn)) {
+        conn->wlen = 0;
+        conn->shead = 0;
+        conn->slen = 0;
+        conn->paused = 0;
+        drained_conn(conn);
+        process_conn(r->http, conn);
+    }
+    if (!conn->paused && !conn->recving && !conn->done) {
+        recv_ring(r, conn);
+    }
+    send_ring(r, conn);
+}
+
+// Take the bytes of a receive completion into the connection
+static void received_ring(HTTPring* r, HTTPconn* conn, struct io_uring_cqe* cqe) {
+    char* buf = NULL;
+    uint32_t bid = 0;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        buf = buf_ring(r->ring, bid);
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        conn->recving = 0;
+    }
+    if (cqe->res > 0 && buf != NULL && !conn->closing && !conn->done) {
+        size_t left = (size_t)cqe->res;
+        char* src = buf;
+        while (left > 0) {
+            reserve_conn(conn);
+            size_t step = conn->rcap - conn->rlen < left ? conn->rcap - conn->rlen : left;
+            memcpy(conn->rbuf + conn->rlen, src, step);
+            conn->rlen += step;
+            src += step;
+            left -= step;
+            if (!conn->sending) {
+                process_conn(r->http, conn);
+            }
+        }
+    }
+    if (buf != NULL) {
+        recycle_ring(r->ring, bid);
+    }
+    if (conn->closing) {
+        return;
+    }
+    if (cqe->res == 0) {
+        conn->done = 1; // Peer closed its side, finish sending and close
+    } else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+        abort_ring(r, conn);
+        return;
+    }
+    if (conn->sending && conn->rlen - conn->rstart > r->http->rbuf * RBUF_KEEP) {
+        conn->paused = 1; // Client sends faster than it reads its responses
+    }
+    if (conn->recving && (conn->paused || conn->done)) {
+        cancel_ring(r, conn);
+    } else if (!conn->recving && !conn->paused && !conn->done) {
+        recv_ring(r, conn); // Out of buffers or cancelled while paused
+    }
+    send_ring(r, conn);
+    touch_ring(r, conn);
+}
+
+// Handle one completion of a connection
+static void complete_ring(HTTPring* r, HTTPconn* conn, uint8_t op, struct io_uring_cqe* cqe) {
+    int res = cqe->res;
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        conn->inflight -= 1;
+    }
+    switch (op) {
+    case OP_RECV:
+        received_ring(r, conn, cqe);
+        break;
+    case OP_SEND:
+        if (res < 0 || (size_t)res < conn->send->len) {
+            conn->sending = 0;
+            if (conn->closing == 1) {
+                break; // The linked close fails too and takes over
+            }
+            abort_ring(r, conn);
+            break;
+        }
+        advance_conn(conn, (size_t)res);
+        sent_ring(r, conn);
+        touch_ring(r, conn);
+        break;
+    case OP_READ:
+        if (conn->closing) {
+            conn->sending = 0;
+            break;
+        }
+        if (res <= 0) {
+            conn->sending = 0;
+            abort_ring(r, conn); // File shrank under us, the promised length cannot be met
+            break;
+        }
+        file_ring(r, conn, (size_t)res);
+        break;
+    case OP_FILE:
+        if (res < 0 || (size_t)res < conn->send->len) {
+            conn->sending = 0;
+            if (conn->closing != 1) {
+                abort_ring(r, conn);
+            }
+            break;
+        }
+        {
+            HTTPseg* seg = &conn->segs[conn->shead];
+            seg->off += res;
+            seg->len -= res;
+            if (seg->len == 0) {
+                close(seg->file);
+                seg->file = -1;
+                conn->shead += 1;
+            }
+        }
+        sent_ring(r, conn);
+        touch_ring(r, conn);
+        break;
+    case OP_CLOSE:
+        if (res == -ECANCELED && conn->closing == 1) {
+            conn->closing = 0; // The send linked before it failed
+            abort_ring(r, conn);
+            break;
+        }
+        conn->closing = 3;
+        break;
+    default:
+        break; // OP_CANCEL, its target completes on its own
+    }
+    if (conn->closing == 3 && conn->inflight == 0) {
+        free_conn(conn);
+        if (!r->accepting && !full_worker()) {
+            accept_ring(r); // A slot is free again
+        }
+    }
+}
+
+// Take a connection accepted into a ring slot
+static void accepted_ring(HTTPring* r, struct io_uring_cqe* cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        r->accepting = 0;
+    }
+    if (cqe->res >= 0 && full_worker()) {
+        // Accepted before the pause took effect: close the slot right away
+        struct io_uring_sqe* sqe = prep_ring(r, NULL, OP_CLOSE);
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->file_index = (uint32_t)cqe->res + 1;
+        }
+    } else if (cqe->res >= 0) {
+        HTTPconn* conn = new_conn(cqe->res);
+        conn->fixed = 1;
+        recv_ring(r, conn);
+        touch_ring(r, conn);
+        if (r->accepting == 1 && full_worker()) {
+            pause_ring(r);
+        }
+    }
+    // Out of slots or at the limit: accept again once a connection is freed
+    if (!r->accepting && cqe->res != -ENFILE && !full_worker()) {
+        accept_ring(r);
+    }
+}
+
+// Close connections whose timeout passed, returns ms until the next one
+static int expire_ring(HTTPring* r) {
+    int64_t now = now_ms();
+    Timer* timer = expire_wheel(worker_wheel, now);
+    while (timer != NULL) {
+        Timer* next = timer->next;
+        abort_ring(r, timer_conn(timer));
+        timer = next;
+    }
+    return wait_wheel(worker_wheel, now);
+}
+
+// Arm the multishot poll of the asset cache change notifications
+static void cache_ring(HTTPring* r) {
+    struct io_uring_sqe* sqe = prep_ring(r, NULL, OP_CACHE);
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd_cache(worker_cache);
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+}
+
+// Run the completion loop: one io_uring_enter per iteration submits every
+// queued request and waits for the next completions
+// Falls back to the epoll loop if the kernel has no usable io_uring
+static int8_t serve_ring(HTTP* http, int listener) {
+    Ring* ring = new_ring(RING_ENTRIES, RING_FILES);
+    if (ring == NULL) {
+        return serve_loop(http, listener);
+    }
+    if (bufs_ring(ring, RING_BUFS, RING_BUFSIZE) != 0) {
+        free_ring(ring);
+        return serve_loop(http, listener);
+    }
+    HTTPring r = { .ring = ring, .http = http, .listener = listener };
+    if (http->cache > 0) {
+        worker_cache = new_cache(http->cache);
+        if (fd_cache(worker_cache) >= 0) {
+            cache_ring(&r);
+        }
+    }
+    start_worker(http);
+    accept_ring(&r);
+    while(1) {
+        worker_calls += calls_ring(ring) - r.calls;
+        r.calls = calls_ring(ring);
+        publish_worker(http);
+        if (submit_ring(ring, 1, expire_ring(&r)) < 0 && errno != EINTR && errno != EBUSY) {
+            break;
+        }
+        wake_worker(http);
+        struct io_uring_cqe* cqe;
+        while ((cqe = cqe_ring(ring)) != NULL) {
+            uint8_t op = cqe->user_data & OP_MASK;
+            HTTPconn* conn = (HTTPconn*)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+            if (op == OP_ACCEPT) {
+                accepted_ring(&r, cqe);
+            } else if (op == OP_CACHE) {
+                events_cache(worker_cache);
+                if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                    cache_ring(&r);
+                }
+            } else if (conn != NULL) {
+                complete_ring(&r, conn, op, cqe);
+            }
+            seen_ring(ring);
+        }
+    }
+    if (worker_cache != NULL) {
+        free_cache(worker_cache);
+        worker_cache = NULL;
+    }
+    stop_worker();
+    free_ring(ring);
+    return 4;
+}
+#endif
+#else
+// Serve clients one by one with blocking sockets (no epoll on this platform)
+// Socket timeouts stand in for the timer wheel: the keep-alive idle time
+// between requests, the request timeout while one is in progress
+static int8_t serve_loop(HTTP* http, int listener) {
+    start_worker(http);
+    while(1) {
+        int fd = accept_net(listener);
+        if (fd < 0) {
+            continue;
+        }
+        HTTPconn* conn = new_conn(fd);
+        while(!conn->done) {
+            reserve_conn(conn);
+            timeout_net(fd, conn->req != NULL ? http->timeout : http->idle);
+            int n = recv_net(fd, conn->rbuf + conn->rlen, conn->rcap - conn->rlen);
+            if (n <= 0) {
+                break;
+            }
+            conn->rlen += n;
+            do {
+                conn->paused = 0;
+                process_conn(http, conn);
+                if (flush_conn(conn) != 0) {
+                    conn->done = 1;
+                }
+            } while (conn->paused && !conn->done);
+        }
+        free_conn(conn);
+    }
+    return 0;
+}
+#endif
+
+#ifdef __linux__
+// Event loop a worker runs, see backend_http
+typedef struct HTTPbackend {
+    char* name;
+    int8_t (*serve)(HTTP* http, int listener);
+} HTTPbackend;
+
+static const HTTPbackend backends[] = {
+    [HTTP_EPOLL] = { "epoll", serve_loop },
+#ifdef HTTP_RING
+    [HTTP_URING] = { "io_uring", serve_ring },
+#else
+    [HTTP_URING] = { "io_uring", serve_loop },
+#endif
+};
+
+// Pin the calling thread to a single CPU
+static void pin_worker(int32_t id) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(id % ncpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Worker thread body: own SO_REUSEPORT listener and event loop
+static void* run_worker(void* arg) {
+    HTTPworker* worker = (HTTPworker*)arg;
+    pin_worker(worker->id);
+    worker_maxconn = worker->maxconn;
+    int listener = listen_reuseport_net(worker->http->host, worker->http->backlog);
+    if (listener < 0) {
+        worker->status = 1;
+        return NULL;
+    }
+    worker->status = backends[worker->http->backend].serve(worker->http, listener);
+    close_net(listener);
+    return NULL;
+}
+
+// Start HTTP server on all workers (infinite loop, no shutdown)
+extern int8_t listen_http(HTTP* http){
+    http->since = now_ms();
+    int32_t count = http->workers;
+    if (count == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        count = ncpu > 0 ? (int32_t)ncpu : 1;
+    }
+    HTTPworker* workers = (HTTPworker*)malloc(count * sizeof(HTTPworker));
+    pthread_t* threads = (pthread_t*)malloc(count * sizeof(pthread_t));
+    // Worker 0 runs on the calling thread, the others get their own
+    for (int32_t i = 0; i < count; ++i) {
+        workers[i] = (HTTPworker){ .http = http, .id = i, .maxconn = 0, .status = 0 };
+        if (http->maxconn > 0) {
+            workers[i].maxconn = (http->maxconn + count - 1) / count;
+        }
+    }
+    int32_t started = 1;
+    for (; started < count; ++started) {
+        if (pthread_create(&threads[started], NULL, run_worker, &workers[started]) != 0) {
+            break;
+        }
+    }
+    run_worker(&workers[0]);
+    for (int32_t i = 1; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    int8_t rc = workers[0].status;
+    free(threads);
+    free(workers);
+    return rc;
+}
+#else
+// Start HTTP server and listen for connections (infinite loop, no shutdown)
+extern int8_t listen_http(HTTP* http){
+    http->since = now_ms();
+    // Create listening socket
+    int listener = listen_net(http->host, http->backlog);
+    if (listener < 0) {
+        return 1;
+    }
+    int8_t rc = serve_loop(http, listener);
+    close_net(listener);
+    return rc;
+}
+#endif
+
+// Scratch memory for the handler of the request being dispatched
+// Released when the request finishes, NULL outside of a handler
+extern void* alloc_http(int connect, size_t size){
+    HTTPconn* conn = current_conn;
+    if (conn == NULL || conn->fd != connect || conn->arena == NULL) {
+        return NULL;
+    }
+    return alloc_arena(conn->arena, size);
+}
+
+// Queue response bytes for a connection
+// Outside of the event loop (no dispatched connection) data is sent directly
+extern void send_http(int connect, char* buf, size_t size){
+    HTTPconn* conn = current_conn;
+    if (conn == NULL || conn->fd != connect) {
+        send_net(connect, buf, size);
+        return;
+    }
+    queue_conn(conn, buf, size);
+}
+
+// Whether the response being built is the last one on its connection
+// Handlers add "Connection: close" to their headers when this is true
+extern int8_t closing_http(int connect){
+    HTTPconn* conn = current_conn;
+    if (conn == NULL || conn->fd != connect) {
+        return 1;
+    }
+    return conn->close;
+}
+
+// Send HTML file as HTTP response
+// Hot files come from the worker's asset cache as one writev of prebuilt
+// headers and body, others are streamed from the page cache with sendfile
+extern void htmlparse_http(int connect, char* name){
+    HTTPconn* conn = current_conn;
+    if (conn != NULL && conn->fd == connect && worker_cache != NULL) {
+        CacheEntry* entry = get_cache(worker_cache, name);
+        if (entry != NULL) {
+            // Status, Date and Server lines go to the output buffer, the rest is prebuilt
+            char status[64 + SERVER_NAME + 16] = "HTTP/1.1 200 OK\r\nDate: ";
+            size_t len = strlen(status);
+            len += date_clock(status + len);
+            memcpy(status + len, "\r\n", 2);
+            len += 2;
+            len += server_line(status + len, sizeof(status) - len);
+            queue_conn(conn, status, len);
+            if (conn->close) {
+                queue_blob_conn(conn, entry->hclose, entry->hclosesz, entry);
+            } else {
+                queue_blob_conn(conn, entry->head, entry->headsz, entry);
+            }
+            // HEAD gets the same headers, Content-Length included, but no body
+            if (conn->req == NULL || !equal_view(conn->req->method, "HEAD")) {
+                queue_blob_conn(conn, entry->body, entry->size, entry);
+            }
+            return;
+        }
+    }
+    int file = open(name, O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        page404_html(connect);
+        return;
+    }
+    struct stat st;
+    if (fstat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(file);
+        page404_html(connect);
+        return;
+    }
+    HTTPresponse* res = start_response(connect, 200, "OK");
+    header_response(res, "Content-Type", "text/html");
+    range_response(res, file, 0, (size_t)st.st_size);
+    end_response(res);
+}
+
+// Phases of a request timed by the route histograms
+#define PHASES 3
+static const char* phases[PHASES] = { "parse", "handler", "send" };
+
+// Histogram of a route for one phase
+static Histogram* phase_route(HTTProute* route, int phase) {
+    return phase == 0 ? &route->parse : phase == 1 ? &route->handler : &route->send;
+}
+
+// Label of a metrics slot: the route pattern, "unmatched" for the last slot
+static char* slot_label(HTTPtable* table, int32_t slot) {
+    return slot < table->nslots ? table->labels[slot] : "unmatched";
+}
+
+// Metrics of a slot in a worker's block, the last slot for requests no route
+// took. NULL while the worker has no page for it
+static HTTProute* peek_metrics(HTTPmetrics* m, HTTPtable* table, int32_t slot) {
+    if (slot >= table->nslots) {
+        return &m->unmatched;
+    }
+    HTTProute* routes = atomic_load_explicit(&m->pages[slot / ROUTE_PAGE], memory_order_acquire);
+    return routes != NULL ? &routes[slot % ROUTE_PAGE] : NULL;
+}
+
+// Sum of a counter of one slot over the metrics blocks of every worker
+static uint64_t sum_metrics(HTTP* http, HTTPtable* table, int32_t slot, size_t field) {
+    uint64_t total = 0;
+    for (HTTPmetrics* m = atomic_load(&http->metrics); m != NULL; m = m->next) {
+        HTTProute* route = peek_metrics(m, table, slot);
+        if (route != NULL) {
+            total += atomic_load_explicit((_Atomic uint64_t*)((char*)route + field), memory_order_relaxed);
+        }
+    }
+    return total;
+}
+
+// Merge the histograms of one route and phase over every worker
+static void merge_metrics(HTTP* http, HTTPtable* table, int32_t slot, int phase, uint64_t* counts, uint64_t* sum) {
+    memset(counts, 0, HIST_BUCKETS * sizeof(uint64_t));
+    *sum = 0;
+    for (HTTPmetrics* m = atomic_load(&http->metrics); m != NULL; m = m->next) {
+        HTTProute* route = peek_metrics(m, table, slot);
+        if (route != NULL) {
+            merge_histogram(counts, sum, phase_route(route, phase));
+        }
+    }
+}
+
+// Print a counter family with one sample per route
+static void counter_text(Text* text, HTTP* http, HTTPtable* table, char* name, char* help, size_t field) {
+    print_text(text, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (int32_t slot = 0; slot <= table->nslots; ++slot) {
+        print_text(text, "%s{route=\"", name);
+        label_text(text, slot_label(table, slot));
+        print_text(text, "\"} %llu\n", (unsigned long long)sum_metrics(http, table, slot, field));
+    }
+}
+
+// Send the metrics of every worker, summed on the spot, in the Prometheus
+// text format. Latencies are histograms in seconds whose bucket bounds are
+// powers of two of microseconds, exact edges of the recorded buckets
+extern void metrics_http(int connect){
+    HTTP* http = worker_http;
+    if (http == NULL) {
+        status_html(connect, 503, "Service Unavailable");
+        return;
+    }
+    // Labels are read from the current table, held until the text is built
+    EpochReader* reader = reader_epoch(http->epoch);
+    enter_epoch(http->epoch, reader);
+    HTTPtable* table = atomic_load(&http->table);
+    Text text = {0};
+    print_text(&text, "# HELP proda_requests_total Requests served by route and status class\n"
+        "# TYPE proda_requests_total counter\n");
+    for (int32_t slot = 0; slot <= table->nslots; ++slot) {
+        for (int c = 0; c < 5; ++c) {
+            uint64_t n = sum_metrics(http, table, slot, offsetof(HTTProute, status) + c * sizeof(uint64_t));
+            if (n == 0) {
+                continue;
+            }
+            print_text(&text, "proda_requests_total{route=\"");
+            label_text(&text, slot_label(table, slot));
+            print_text(&text, "\",code=\"%dxx\"} %llu\n", c + 1, (unsigned long long)n);
+        }
+    }
+    counter_text(&text, http, table, "proda_received_bytes_total", "Request head and body bytes",
+        offsetof(HTTProute, bytes_in));
+    counter_text(&text, http, table, "proda_sent_bytes_total", "Response bytes including headers",
+        offsetof(HTTProute, bytes_out));
+    print_text(&text, "# HELP proda_request_duration_seconds Time spent per request phase\n"
+        "# TYPE proda_request_duration_seconds histogram\n");
+    uint64_t counts[HIST_BUCKETS];
+    for (int32_t slot = 0; slot <= table->nslots; ++slot) {
+        for (int phase = 0; phase < PHASES; ++phase) {
+            uint64_t sum;
+            merge_metrics(http, table, slot, phase, counts, &sum);
+            uint64_t total = below_histogram(counts, HIST_TOP);
+            for (uint32_t power = 4; power <= 25; ++power) {
+                print_text(&text, "proda_request_duration_seconds_bucket{route=\"");
+                label_text(&text, slot_label(table, slot));
+                print_text(&text, "\",phase=\"%s\",le=\"%.6f\"} %llu\n", phases[phase],
+                    (double)((uint64_t)1 << power) / 1e6, (unsigned long long)below_histogram(counts, power));
+            }
+            print_text(&text, "proda_request_duration_seconds_bucket{route=\"");
+            label_text(&text, slot_label(table, slot));
+            print_text(&text, "\",phase=\"%s\",le=\"+Inf\"} %llu\n", phases[phase], (unsigned long long)total);
+            print_text(&text, "proda_request_duration_seconds_sum{route=\"");
+            label_text(&text, slot_label(table, slot));
+            print_text(&text, "\",phase=\"%s\"} %.6f\n", phases[phase], (double)sum / 1e6);
+            print_text(&text, "proda_request_duration_seconds_count{route=\"");
+            label_text(&text, slot_label(table, slot));
+            print_text(&text, "\",phase=\"%s\"} %llu\n", phases[phase], (unsigned long long)total);
+        }
+    }
+    uint64_t requests, calls, admitted, shed;
+    stats_http(http, &requests, &calls);
+    admission_http(http, &admitted, &shed);
+    print_text(&text, "# HELP proda_admitted_requests_total Requests admitted to their handlers\n"
+        "# TYPE proda_admitted_requests_total counter\nproda_admitted_requests_total %llu\n"
+        "# HELP proda_shed_requests_total Requests answered with 503 under overload\n"
+        "# TYPE proda_shed_requests_total counter\nproda_shed_requests_total %llu\n"
+        "# HELP proda_syscalls_total System calls of the worker loops\n"
+        "# TYPE proda_syscalls_total counter\nproda_syscalls_total %llu\n"
+        "# HELP proda_uptime_seconds Seconds since the server started\n"
+        "# TYPE proda_uptime_seconds gauge\nproda_uptime_seconds %.3f\n",
+        (unsigned long long)admitted, (unsigned long long)shed, (unsigned long long)calls,
+        (double)(now_ms() - http->since) / 1e3);
+    leave_epoch(reader);
+    HTTPresponse* res = start_response(connect, 200, "OK");
+    header_response(res, "Content-Type", "text/plain; version=0.0.4");
+    data_response(res, text.buf, text.len);
+    end_response(res);
+    free_text(&text);
+}
+
+// Send a JSON summary of the server: backend, workers, uptime, request
+// counts and latency quantiles of each phase over all routes
+extern void status_http(int connect){
+    HTTP* http = worker_http;
+    if (http == NULL) {
+        status_html(connect, 503, "Service Unavailable");
+        return;
+    }
+    int32_t workers = 0;
+    for (HTTPmetrics* m = atomic_load(&http->metrics); m != NULL; m = m->next) {
+        workers += 1;
+    }
+    EpochReader* reader = reader_epoch(http->epoch);
+    enter_epoch(http->epoch, reader);
+    HTTPtable* table = atomic_load(&http->table);
+    uint64_t served = 0;
+    for (int32_t slot = 0; slot <= table->nslots; ++slot) {
+        served += sum_metrics(http, table, slot, offsetof(HTTProute, requests));
+    }
+    uint64_t admitted, shed;
+    admission_http(http, &admitted, &shed);
+#ifdef __linux__
+    char* backend = backends[http->backend].name;
+#else
+    char* backend = "blocking";
+#endif
+    Text text = {0};
+    print_text(&text, "{\"status\":\"ok\",\"backend\":\"%s\",\"workers\":%d,\"uptime_seconds\":%lld,"
+        "\"requests\":%llu,\"admitted\":%llu,\"shed\":%llu,\"latency_us\":{", backend, (int)workers,
+        (long long)((now_ms() - http->since) / 1000), (unsigned long long)served,
+        (unsigned long long)admitted, (unsigned long long)shed);
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t merged[HIST_BUCKETS];
+    for (int phase = 0; phase < PHASES; ++phase) {
+        memset(merged, 0, sizeof(merged));
+        for (int32_t slot = 0; slot <= table->nslots; ++slot) {
+            uint64_t sum;
+            merge_metrics(http, table, slot, phase, counts, &sum);
+            for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+                merged[i] += counts[i];
+            }
+        }
+        print_text(&text, "%s\"%s\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu}", phase ? "," : "", phases[phase],
+            (unsigned long long)quantile_histogram(merged, 0.5), (unsigned long long)quantile_histogram(merged, 0.99),
+            (unsigned long long)quantile_histogram(merged, 0.999));
+    }
+    print_text(&text, "}}\n");
+    leave_epoch(reader);
+    HTTPresponse* res = start_response(connect, 200, "OK");
+    header_response(res, "Content-Type", "application/json");
+    data_response(res, text.buf, text.len);
+    end_response(res);
+    free_text(&text);
+}
+
+// Start a response on a connection, status and reason can be changed until it ends
+// reason must stay valid until end_response, a string literal usually
+extern HTTPresponse* start_response(int connect, int code, char* reason){
+    HTTPconn* conn = current_conn;
+    if (conn == NULL || conn->fd != connect) {
+        conn = NULL;
+    }
+    Arena* own = NULL;
+    Arena* arena = conn != NULL ? conn->arena : NULL;
+    if (arena == NULL) {
+        own = new_arena(ARENA_SIZE);
+        arena = own;
+    }
+    HTTPresponse* res = (HTTPresponse*)alloc_arena(arena, sizeof(HTTPresponse));
+    res->connect = connect;
+    res->conn = conn;
+    res->arena = arena;
+    res->own = own;
+    res->code = code;
+    res->reason = reason;
+    res->head = (char*)alloc_arena(arena, RESPONSE_HEAD);
+    res->headlen = 0;
+    res->headcap = RESPONSE_HEAD;
+    res->parts = (HTTPpart*)alloc_arena(arena, RESPONSE_PARTS * sizeof(HTTPpart));
+    res->nparts = 0;
+    res->partcap = RESPONSE_PARTS;
+    res->length = 0;
+    return res;
+}
+
+// Change the status of a response, e.g. after a body source failed
+extern void status_response(HTTPresponse* res, int code, char* reason){
+    res->code = code;
+    res->reason = reason;
+}
+
+// Append bytes to the header block of a response
+static void append_response(HTTPresponse* res, char* str, size_t size) {
+    if (res->headlen + size > res->headcap) {
+        size_t cap = res->headcap << 1;
+        while (cap < res->headlen + size) {
+            cap <<= 1;
+        }
+        char* head = (char*)alloc_arena(res->arena, cap);
+        memcpy(head, res->head, res->headlen);
+        res->head = head;
+        res->headcap = cap;
+    }
+    memcpy(res->head + res->headlen, str, size);
+    res->headlen += size;
+}
+
+// Add a header field, Date, Content-Length and Connection are set by end_response
+extern void header_response(HTTPresponse* res, char* name, char* value){
+    append_response(res, name, strlen(name));
+    append_response(res, ": ", 2);
+    append_response(res, value, strlen(value));
+    append_response(res, "\r\n", 2);
+}
+
+// Append an empty body segment
+static HTTPpart* push_response(HTTPresponse* res) {
+    if (res->nparts == res->partcap) {
+        HTTPpart* parts = (HTTPpart*)alloc_arena(res->arena, (res->partcap << 1) * sizeof(HTTPpart));
+        memcpy(parts, res->parts, res->nparts * sizeof(HTTPpart));
+        res->parts = parts;
+        res->partcap <<= 1;
+    }
+    HTTPpart* part = &res->parts[res->nparts++];
+    part->file = -1;
+    part->ptr = NULL;
+    part->ref = NULL;
+    part->copy = 0;
+    part->off = 0;
+    part->len = 0;
+    return part;
+}
+
+// Add body bytes that are copied when the response ends
+// The caller may reuse ptr once end_response returned
+extern void data_response(HTTPresponse* res, char* ptr, size_t size){
+    HTTPpart* part = push_response(res);
+    part->ptr = ptr;
+    part->len = size;
+    part->copy = 1;
+    res->length += size;
+}
+
+// Add body bytes sent without copying, ptr must stay valid until they are sent
+extern void static_response(HTTPresponse* res, char* ptr, size_t size){
+    HTTPpart* part = push_response(res);
+    part->ptr = ptr;
+    part->len = size;
+    res->length += size;
+}
+
+// Add a file range streamed with sendfile, the response takes ownership of file
+extern void range_response(HTTPresponse* res, int file, size_t off, size_t size){
+    HTTPpart* part = push_response(res);
+    part->file = file;
+    part->off = off;
+    part->len = size;
+    res->length += size;
+}
+
+// Add a whole file as body: a blob of the asset cache when it is cached there,
+// a file range otherwise. Returns -1 and adds nothing if it is not a regular file
+extern int8_t file_response(HTTPresponse* res, char* path){
+    if (res->conn != NULL && worker_cache != NULL) {
+        CacheEntry* entry = get_cache(worker_cache, path);
+        if (entry != NULL) {
+            hold_cache(entry);
+            HTTPpart* part = push_response(res);
+            part->ptr = entry->body;
+            part->ref = entry;
+            part->len = entry->size;
+            res->length += entry->size;
+            return 0;
+        }
+    }
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(file);
+        return -1;
+    }
+    range_response(res, file, 0, (size_t)st.st_size);
+    return 0;
+}
+
+// Release what a body segment holds without sending it
+static void drop_part(HTTPpart* part) {
+    if (part->file >= 0) {
+        close(part->file);
+    }
+    if (part->ref != NULL) {
+        release_cache(part->ref);
+    }
+}
+
+// writev until the whole batch is sent, returns -1 if the peer is gone
+static int8_t writeall_response(int connect, struct iovec* iov, int count) {
+    while (count > 0) {
+        int n = writev_net(connect, iov, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= (int)iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+// Write the whole response to a blocking socket
+// Status, headers and memory segments go out in one writev, file ranges with sendfile
+static void send_response(HTTPresponse* res, char* status, size_t statuslen, uint8_t body) {
+    struct iovec iov[IOV_BATCH];
+    iov[0].iov_base = status;
+    iov[0].iov_len = statuslen;
+    iov[1].iov_base = res->head;
+    iov[1].iov_len = res->headlen;
+    int count = 2;
+    size_t next = 0;
+    int8_t failed = 0;
+    cork_net(res->connect, 1);
+    while (!failed && (count > 0 || (body && next < res->nparts))) {
+        while (body && next < res->nparts && res->parts[next].file < 0 && count < IOV_BATCH) {
+            iov[count].iov_base = res->parts[next].ptr;
+            iov[count].iov_len = res->parts[next].len;
+            count += 1;
+            next += 1;
+        }
+        if (count > 0) {
+            failed = writeall_response(res->connect, iov, count) != 0;
+            count = 0;
+            continue;
+        }
+        HTTPpart* part = &res->parts[next++];
+        size_t end = part->off + part->len;
+        while (part->off < end) {
+            if (sendfile_net(res->connect, part->file, &part->off, end - part->off) <= 0) {
+                failed = 1;
+                break;
+            }
+        }
+    }
+    cork_net(res->connect, 0);
+    for (size_t i = 0; i < res->nparts; ++i) {
+        drop_part(&res->parts[i]);
+    }
+}
+
+// Finish a response: add the status line, Date and framing headers and queue
+// everything for the event loop, which sends it with as few writes as possible
+// The body is left out for HEAD requests and statuses that have none
+extern void end_response(HTTPresponse* res){
+    HTTPconn* conn = res->conn;
+    uint8_t body = !(res->code < 200 || res->code == 204 || res->code == 304);
+    char status[128];
+    char date[CLOCK_DATE];
+    date_clock(date);
+    int len = snprintf(status, sizeof(status), "HTTP/1.1 %d %s\r\nDate: %s\r\n", res->code, res->reason, date);
+    if (len < 0 || (size_t)len >= sizeof(status)) {
+        len = snprintf(status, sizeof(status), "HTTP/1.1 %d \r\nDate: %s\r\n", res->code, date);
+    }
+    if (body) {
+        char length[48];
+        int lensz = snprintf(length, sizeof(length), "Content-Length: %zu\r\n", res->length);
+        append_response(res, length, lensz);
+    }
+    char server[SERVER_NAME + 16];
+    size_t serversz = server_line(server, sizeof(server));
+    if (serversz > 0) {
+        append_response(res, server, serversz);
+    }
+    if (closing_http(res->connect)) {
+        append_response(res, "Connection: close\r\n", 19);
+    }
+    append_response(res, "\r\n", 2);
+    if (conn != NULL && conn->req != NULL && equal_view(conn->req->method, "HEAD")) {
+        body = 0;
+    }
+    if (conn == NULL) {
+        send_response(res, status, (size_t)len, body);
+        free_arena(res->own);
+        return;
+    }
+    queue_conn(conn, status, (size_t)len);
+    queue_conn(conn, res->head, res->headlen);
+    for (size_t i = 0; i < res->nparts; ++i) {
+        HTTPpart* part = &res->parts[i];
+        if (!body) {
+            drop_part(part);
+        } else if (part->file >= 0) {
+            queue_file_conn(conn, part->file, part->off, part->len);
+        } else if (part->copy) {
+            queue_conn(conn, part->ptr, part->len);
+        } else {
+            queue_blob_conn(conn, part->ptr, part->len, part->ref);
+            if (part->ref != NULL) {
+                release_cache(part->ref); // The queued segment holds it now
+            }
+        }
+    }
+    if (res->own != NULL) {
+        free_arena(res->own);
+    }
+}
@@ -1,44 +1,334 @@
+// Asynchronous logger
+// Each thread formats messages into its own ring of fixed-size slots; a flush
+// thread drains all rings into the file with writev. Rings are single-producer
+// single-consumer, so logging takes no lock and makes no system call; the
+// timestamp is copied from the shared clock. The flush thread sleeps on a
+// condition variable once every ring is empty and the first message after
+// that wakes it. The ring of a thread that exits goes to the next new thread.
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include "logger.h"
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include "clock.h"
+
+#define LOG_SLOT   512     // Bytes per message slot, longer messages are cut
+#define LOG_SLOTS  1024    // Default ring size in messages (power of two)
+#define LOG_BATCH  64      // Slots written per writev
+
+// Formatted message waiting in a ring
+typedef struct log_slot {
+    uint32_t len;
+    char text[LOG_SLOT - sizeof(uint32_t)];
+} log_slot;
+
+// Ring of one logging thread: written by that thread, drained by the flusher
+typedef struct log_ring {
+    _Alignas(64) _Atomic size_t head; // Next slot the owner fills
+    _Atomic int busy;                 // Owner is between its running check and publishing
+    _Alignas(64) _Atomic size_t tail; // Next slot the flusher writes
+    _Atomic int owned;                // A live thread logs into the ring
+    _Atomic unsigned long dropped;    // Messages lost to a full ring
+    size_t mask;                      // Slots - 1
+    log_slot *slots;
+    struct log_ring *next;            // Rings of other threads
+} log_ring;
 
 // Static variables for log file and current log level
-static FILE *log_file = NULL;
-static log_level_t current_level = LOG_INFO;
+static int log_fd = -1;
+static _Atomic int current_level = LOG_INFO;
+static log_policy_t log_overflow = LOG_DROP;
+static size_t log_slots = LOG_SLOTS;
+static _Atomic(log_ring*) log_rings = NULL;
+static _Atomic int log_running = 0;
+static _Atomic int log_stop = 0;
+static pthread_t log_thread;
+static unsigned long log_reported = 0; // Drops already noted in the file
+static _Atomic int log_sleeping = 0;   // Flush thread waits for a message
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static pthread_key_t log_key;          // Releases the ring of an exiting thread
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+
+// Ring of the calling thread
+static _Thread_local log_ring *thread_ring = NULL;
 
 // String representations of log levels
 static const char *level_str[] = { "DEBUG", "INFO", "WARN", "ERROR" };
 
-// Initialize logger: open file and set minimum log level
-void log_init(const char *filename, log_level_t min_level) {
-    if (log_file && log_file != stdout) {
-        fclose(log_file);
+// Function prototypes for internal logger operations
+static log_ring *log_register(void);
+static void log_make_key(void);
+static void log_release(void *arg);
+static void log_wake(void);
+static void log_sleep(void);
+static int log_pending(void);
+static size_t log_format(char *buf, size_t size, log_level_t level, const char *fmt, va_list args);
+static size_t log_drain(void);
+static void log_writeall(struct iovec *iov, int count);
+static void *log_flusher(void *arg);
+
+// Set overflow policy and ring size, used by rings created afterwards
+void log_config(log_policy_t policy, size_t slots) {
+    log_overflow = policy;
+    size_t size = 8;
+    while (size < slots) {
+        size <<= 1;
     }
-    log_file = fopen(filename, "a");
-    if (!log_file) log_file = stdout;
+    log_slots = size;
+}
+
+// Initialize logger: open file, set minimum log level and start flushing
+void log_init(const char *filename, log_level_t min_level) {
+    log_close();
+    log_fd = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0) log_fd = STDOUT_FILENO;
     current_level = min_level;
+    log_stop = 0;
+    if (pthread_create(&log_thread, NULL, log_flusher, NULL) != 0) {
+        if (log_fd != STDOUT_FILENO) close(log_fd);
+        log_fd = -1;
+        return;
+    }
+    log_running = 1;
 }
 
 // Write a log message if level is sufficient
+// The message is formatted into the thread's ring, the flush thread writes it
 void log_write(log_level_t level, const char *fmt, ...) {
-    if (level < current_level) return;
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    char timebuf[20];
-    strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", t);
-
-    fprintf(log_file, "[%s] %s: ", timebuf, level_str[level]);
+    if ((int)level < current_level) return;
     va_list args;
     va_start(args, fmt);
-    vfprintf(log_file, fmt, args);
+    log_ring *ring = NULL;
+    if (log_running) {
+        ring = thread_ring != NULL ? thread_ring : log_register();
+        // log_close waits for busy rings, so a message that passed the
+        // check is drained before the flush thread stops
+        atomic_store(&ring->busy, 1);
+        if (!log_running) {
+            atomic_store_explicit(&ring->busy, 0, memory_order_release);
+            ring = NULL;
+        }
+    }
+    if (ring == NULL) {
+        // No flush thread: write synchronously to stdout
+        char buf[LOG_SLOT];
+        size_t len = log_format(buf, sizeof(buf), level, fmt, args);
+        va_end(args);
+        fwrite(buf, 1, len, stdout);
+        return;
+    }
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) > ring->mask) {
+        if (log_overflow == LOG_DROP) {
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            atomic_store_explicit(&ring->busy, 0, memory_order_release);
+            va_end(args);
+            return;
+        }
+        sched_yield(); // LOG_BLOCK: wait for the flusher to make room
+    }
+    log_slot *slot = &ring->slots[head & ring->mask];
+    slot->len = (uint32_t)log_format(slot->text, sizeof(slot->text), level, fmt, args);
     va_end(args);
-    fprintf(log_file, "\n");
-    fflush(log_file);
+    // Sequentially consistent: either the flusher sees the message before it
+    // sleeps or this thread sees it sleeping
+    atomic_store(&ring->head, head + 1);
+    atomic_store_explicit(&ring->busy, 0, memory_order_release);
+    if (atomic_load(&log_sleeping)) {
+        log_wake();
+    }
+}
+
+// Number of messages dropped since the program started
+unsigned long log_dropped(void) {
+    unsigned long dropped = 0;
+    for (log_ring *ring = log_rings; ring != NULL; ring = ring->next) {
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    return dropped;
 }
 
-// Close the log file if needed
+// Close the logger: messages being written finish, then the flush thread
+// drains every ring before it exits
+// Rings stay registered, threads keep using them after the next log_init
 void log_close(void) {
-    if (log_file && log_file != stdout) fclose(log_file);
-    log_file = NULL;
-}
\ No newline at end of file
+    if (log_running) {
+        log_running = 0;
+        for (log_ring *ring = log_rings; ring != NULL; ring = ring->next) {
+            while (atomic_load(&ring->busy)) {
+                sched_yield();
+            }
+        }
+        pthread_mutex_lock(&log_lock);
+        log_stop = 1;
+        pthread_cond_signal(&log_cond);
+        pthread_mutex_unlock(&log_lock);
+        pthread_join(log_thread, NULL);
+    }
+    if (log_fd >= 0 && log_fd != STDOUT_FILENO) close(log_fd);
+    log_fd = -1;
+}
+
+// Give the calling thread a ring: one an exited thread left, or a new one
+// published to the flusher. Messages the previous owner left are kept
+static log_ring *log_register(void) {
+    pthread_once(&log_once, log_make_key);
+    log_ring *ring = log_rings;
+    for (; ring != NULL; ring = ring->next) {
+        int none = 0;
+        if (atomic_load_explicit(&ring->owned, memory_order_relaxed) == 0
+                && atomic_compare_exchange_strong(&ring->owned, &none, 1)) {
+            break;
+        }
+    }
+    if (ring == NULL) {
+        ring = (log_ring*)aligned_alloc(64, sizeof(log_ring));
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->busy, 0);
+        atomic_init(&ring->tail, 0);
+        atomic_init(&ring->owned, 1);
+        atomic_init(&ring->dropped, 0);
+        ring->mask = log_slots - 1;
+        ring->slots = (log_slot*)malloc(log_slots * sizeof(log_slot));
+        ring->next = atomic_load(&log_rings);
+        while (!atomic_compare_exchange_weak(&log_rings, &ring->next, ring));
+    }
+    pthread_setspecific(log_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+// Create the key whose destructor releases rings of exiting threads
+static void log_make_key(void) {
+    pthread_key_create(&log_key, log_release);
+}
+
+// Release the ring of an exiting thread for reuse
+static void log_release(void *arg) {
+    log_ring *ring = (log_ring*)arg;
+    atomic_store_explicit(&ring->owned, 0, memory_order_release);
+}
+
+// Wake the flush thread sleeping in log_sleep
+static void log_wake(void) {
+    pthread_mutex_lock(&log_lock);
+    atomic_store(&log_sleeping, 0);
+    pthread_cond_signal(&log_cond);
+    pthread_mutex_unlock(&log_lock);
+}
+
+// Sleep until a message arrives or the logger stops
+// The flag is raised before the rings are checked, see log_write
+static void log_sleep(void) {
+    pthread_mutex_lock(&log_lock);
+    atomic_store(&log_sleeping, 1);
+    while (atomic_load(&log_sleeping) && !log_stop && !log_pending()) {
+        pthread_cond_wait(&log_cond, &log_lock);
+    }
+    atomic_store(&log_sleeping, 0);
+    pthread_mutex_unlock(&log_lock);
+}
+
+// Whether any ring holds a message not written yet
+static int log_pending(void) {
+    for (log_ring *ring = log_rings; ring != NULL; ring = ring->next) {
+        if (atomic_load(&ring->head) != atomic_load_explicit(&ring->tail, memory_order_relaxed)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Format "[time] LEVEL: message\n" into buf, returns its length
+static size_t log_format(char *buf, size_t size, log_level_t level, const char *fmt, va_list args) {
+    char stamp[CLOCK_STAMP];
+    stamp_clock(stamp);
+    int n = snprintf(buf, size, "[%s] %s: ", stamp, level_str[level]);
+    size_t len = (size_t)n < size ? (size_t)n : size - 1;
+    n = vsnprintf(buf + len, size - len, fmt, args);
+    if (n > 0) {
+        len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+    }
+    if (len == size - 1) {
+        len -= 1; // Cut message, keep room for the newline
+    }
+    buf[len++] = '\n';
+    return len;
+}
+
+// Write every message queued so far, returns the number written
+static size_t log_drain(void) {
+    size_t total = 0;
+    for (log_ring *ring = log_rings; ring != NULL; ring = ring->next) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        while (tail != head) {
+            struct iovec iov[LOG_BATCH];
+            int count = 0;
+            for (; tail + count != head && count < LOG_BATCH; ++count) {
+                log_slot *slot = &ring->slots[(tail + count) & ring->mask];
+                iov[count].iov_base = slot->text;
+                iov[count].iov_len = slot->len;
+            }
+            log_writeall(iov, count);
+            tail += count;
+            total += count;
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        }
+    }
+    unsigned long dropped = log_dropped();
+    if (dropped != log_reported) {
+        char note[96];
+        int n = snprintf(note, sizeof(note), "[logger] WARN: %lu messages dropped, ring full\n", dropped - log_reported);
+        struct iovec iov = { note, (size_t)n };
+        log_writeall(&iov, 1);
+        log_reported = dropped;
+    }
+    return total;
+}
+
+// writev until every byte of the batch is written or the file fails
+static void log_writeall(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(log_fd, iov, count);
+        if (n < 0) {
+            return; // Nothing sensible to report a log write error to
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// Flush thread: drain the rings, sleep while they are empty
+static void *log_flusher(void *arg) {
+    (void)arg;
+    while (1) {
+        int stop = log_stop;
+        if (log_drain() == 0) {
+            if (stop) break;
+            log_sleep();
+        }
+    }
+    return NULL;
+}
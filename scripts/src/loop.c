@@ -0,0 +1,84 @@
+// Edge-triggered event loop built on epoll
+// Descriptors are registered once for both directions and must be drained
+// until EAGAIN on every notification
+
+#ifdef __linux__
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "loop.h"
+
+// Event loop structure holding the epoll instance and its result array
+typedef struct Loop {
+    int fd;                     // epoll descriptor
+    int cap;                    // Size of events array
+    struct epoll_event* events; // Events returned by the last wait
+} Loop;
+
+// Create a new event loop able to report up to cap events per wait
+extern Loop* new_loop(size_t cap){
+    Loop* loop = (Loop*)malloc(sizeof(Loop));
+    loop->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->fd < 0) {
+        free(loop);
+        return NULL;
+    }
+    loop->cap = (int)cap;
+    loop->events = (struct epoll_event*)malloc(cap * sizeof(struct epoll_event));
+    return loop;
+}
+
+// Free the event loop and close its epoll descriptor
+extern void free_loop(Loop* loop){
+    close(loop->fd);
+    free(loop->events);
+    free(loop);
+}
+
+// Register a descriptor in edge-triggered mode with user data attached
+extern int add_loop(Loop* loop, int fd, uint8_t flags, void* data){
+    struct epoll_event ev = {0};
+    ev.events = EPOLLET | EPOLLRDHUP;
+    if (flags & LOOP_READ) {
+        ev.events |= EPOLLIN;
+    }
+    if (flags & LOOP_WRITE) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.ptr = data;
+    return epoll_ctl(loop->fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Remove a descriptor from the loop
+extern int del_loop(Loop* loop, int fd){
+    return epoll_ctl(loop->fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+// Wait for events, returns number of ready descriptors or -1 on error
+extern int wait_loop(Loop* loop, int timeout){
+    return epoll_wait(loop->fd, loop->events, loop->cap, timeout);
+}
+
+// Get user data of the ready descriptor at index
+extern void* data_loop(Loop* loop, int index){
+    return loop->events[index].data.ptr;
+}
+
+// Get readiness flags of the ready descriptor at index
+extern uint8_t flags_loop(Loop* loop, int index){
+    uint32_t ev = loop->events[index].events;
+    uint8_t flags = 0;
+    if (ev & EPOLLIN) {
+        flags |= LOOP_READ;
+    }
+    if (ev & EPOLLOUT) {
+        flags |= LOOP_WRITE;
+    }
+    if (ev & (EPOLLERR | EPOLLHUP)) {
+        flags |= LOOP_CLOSE;
+    }
+    return flags;
+}
+
+#endif /* __linux__ */
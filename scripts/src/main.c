@@ -1,9 +1,14 @@
+#include <stdio.h>
 #include <string.h>
-#include "headers/httpbase.h"
+#include "httpbase.h"
+#include "clock.h"
+#include "config.h"
+#include "logger.h"
+#include "tests.h"
 
 // Handler for "/" route. Serves index.html or 404 if path is not "/"
 void pageindex(int connect, HTTPrequests *req){
-    if(strcmp(req->path, "/") != 0){
+    if(!equal_view(req->path, "/")){
         htmlparse_http(connect, "404 ERR");
         return; // Early exit on wrong path
     }
@@ -12,18 +17,172 @@ void pageindex(int connect, HTTPrequests *req){
 
 // Handler for "/scream" route. Serves scream.html or 404 if path is not "/scream"
 void pagescream(int connect, HTTPrequests *req){
-    if(strcmp(req->path, "/scream") != 0){
+    if(!equal_view(req->path, "/scream")){
         htmlparse_http(connect, "404 ERR");
         return;
     }
     htmlparse_http(connect, "scream.html");
 }
 
-// Main entry point: creates HTTP server, registers routes, and starts server loop
-int main(void){
-    HTTP *server = new_http("127.0.0.1:8080");
-    handle_http(server, "/", pageindex);
-    handle_http(server, "/scream", pagescream);
-    listen(server); // Start the server loop
+// Body callback of "/echo". Sends every received piece straight back,
+// with chunk framing when the request body was chunked too
+static void echobody(int connect, HTTPrequests *req, HTTPview data){
+    if(data.len == 0){
+        if(req->chunked && req->bstate == BODY_DONE){
+            send_http(connect, "0\r\n\r\n", 5);
+        }
+        return; // On BODY_ERROR the connection closes mid-response
+    }
+    if(!req->chunked){
+        send_http(connect, data.ptr, data.len);
+        return;
+    }
+    char size[24];
+    int len = snprintf(size, sizeof(size), "%zx\r\n", data.len);
+    send_http(connect, size, len);
+    send_http(connect, data.ptr, data.len);
+    send_http(connect, "\r\n", 2);
+}
+
+// Handler for "/echo" route. Answers before the body arrives and streams it back
+void pageecho(int connect, HTTPrequests *req){
+    if(!equal_view(req->method, "POST")){
+        HTTPresponse *res = start_response(connect, 405, "Method Not Allowed");
+        header_response(res, "Allow", "POST");
+        end_response(res);
+        return;
+    }
+    char head[256];
+    char date[CLOCK_DATE];
+    date_clock(date);
+    int len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nDate: %s\r\n"
+        "Content-Type: application/octet-stream\r\n", date);
+    if(req->chunked){
+        len += snprintf(head + len, sizeof(head) - len, "Transfer-Encoding: chunked\r\n");
+    } else {
+        len += snprintf(head + len, sizeof(head) - len, "Content-Length: %zu\r\n", req->clen);
+    }
+    len += snprintf(head + len, sizeof(head) - len, "%s\r\n",
+        closing_http(connect) ? "Connection: close\r\n" : "");
+    send_http(connect, head, len);
+    req->onbody = echobody;
+}
+
+// Handler for "/api/status" route. Sends a JSON summary of the server
+void pagestatus(int connect, HTTPrequests *req){
+    (void)req;
+    status_http(connect);
+}
+
+// Handler for "/api/metrics" route. Sends every counter and latency
+// histogram in the Prometheus text format
+void pagemetrics(int connect, HTTPrequests *req){
+    (void)req;
+    metrics_http(connect);
+}
+
+// Handlers routes in the configuration can name
+typedef struct Handler {
+    char* name;
+    void (*handle)(int, HTTPrequests*);
+} Handler;
+
+static const Handler handlers[] = {
+    { "root_handler", pageindex },
+    { "scream_handler", pagescream },
+    { "echo_handler", pageecho },
+    { "status_handler", pagestatus },
+    { "metrics_handler", pagemetrics },
+};
+
+// Handler registered under name, NULL if there is none
+const Handler* find_handler(char* name){
+    for(size_t i = 0; i < sizeof(handlers) / sizeof(handlers[0]); ++i){
+        if(strcmp(handlers[i].name, name) == 0){
+            return &handlers[i];
+        }
+    }
+    return NULL;
 }
 
+// Create the server described by config, with its routes and limits
+HTTP* configure_server(Config* config){
+    char address[CONFIG_HOST + 8];
+    snprintf(address, sizeof(address), "%s:%d", config->host, config->port);
+    HTTP *server = new_http(address);
+    workers_http(server, config->workers);
+    backlog_http(server, config->backlog);
+    timeout_http(server, config->timeout);
+    connections_http(server, config->max_connections);
+    overload_http(server, config->queue_delay, config->retry_after);
+    buffers_http(server, config->buffer_size);
+    cache_http(server, config->cache_size);
+    keepalive_http(server, config->keep_alive_timeout, config->keep_alive ? config->max_keep_alive_requests : 1);
+    limits_http(server, config->max_uri_length, config->max_headers, config->max_request_size, config->max_body_size);
+    server_http(server, config->server_header);
+    trace_http(server, !config->disable_trace);
+    if(config->backend == HTTP_URING && backend_http(server, HTTP_URING) != 0){
+        LOG_WARN("io_uring unavailable, serving with epoll");
+    }
+    if(config->nroutes == 0){
+        handle_http(server, "/", pageindex);
+        handle_http(server, "/scream", pagescream);
+        handle_http(server, "/echo", pageecho);
+        handle_http(server, "/api/status", pagestatus);
+        handle_http(server, "/api/metrics", pagemetrics);
+        return server;
+    }
+    for(int32_t i = 0; i < config->nroutes; ++i){
+        const Handler* handler = find_handler(config->routes[i].handler);
+        if(handler == NULL){
+            LOG_WARN("route %s: unknown handler %s, skipped", config->routes[i].path, config->routes[i].handler);
+            continue;
+        }
+        handle_http(server, config->routes[i].path, handler->handle);
+    }
+    return server;
+}
+
+// Main entry point: loads the configuration, creates the HTTP server and
+// starts its loop. With --test runs the unit tests instead (benchmarks are
+// in bin/microbench). --config (or -c) names the configuration file, by
+// default setings.yaml when it exists; --uring selects the io_uring backend
+int main(int argc, char** argv){
+    char* path = CONFIG_FILE;
+    int8_t given = 0;
+    int8_t uring = 0;
+    for(int i = 1; i < argc; ++i){
+        if(strcmp(argv[i], "--test") == 0){
+            return run_all_tests() != 0;
+        }
+        if(strcmp(argv[i], "--uring") == 0){
+            uring = 1;
+        } else if((strcmp(argv[i], "--config") == 0 || strcmp(argv[i], "-c") == 0) && i + 1 < argc){
+            path = argv[++i];
+            given = 1;
+        } else {
+            fprintf(stderr, "usage: %s [--config file] [--uring] [--test]\n", argv[0]);
+            return 2;
+        }
+    }
+    Config config;
+    default_config(&config);
+    int8_t rc = load_config(&config, path);
+    if(rc == 2 || (rc == 1 && given)){
+        if(rc == 1){
+            fprintf(stderr, "%s: cannot open configuration\n", path);
+        }
+        return 1;
+    }
+    if(uring){
+        config.backend = HTTP_URING;
+    }
+    log_init(config.log_file, config.log_level);
+    HTTP *server = configure_server(&config);
+    LOG_INFO("starting on %s:%d", config.host, config.port);
+    rc = listen_http(server); // Start the server loop
+    LOG_ERROR("server stopped, listen_http returned %d", rc);
+    log_close();
+    freehttp(server);
+    return 1;
+}
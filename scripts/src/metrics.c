@@ -0,0 +1,132 @@
+// Metrics primitives
+// Counters and histograms have a single writer, the worker that owns them,
+// so an update is a relaxed load and store: no lock and no atomic
+// read-modify-write. Readers merge snapshots of every worker's copy.
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metrics.h"
+
+// Add n to a counter only the calling thread writes
+extern void bump_counter(_Atomic uint64_t* counter, uint64_t n) {
+    uint64_t value = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, value + n, memory_order_relaxed);
+}
+
+// Bucket of a value: the power of two it falls in, then its linear slice
+extern size_t bucket_histogram(uint64_t value) {
+    if (value < HIST_SUB) {
+        return (size_t)value;
+    }
+    uint32_t power = 63 - (uint32_t)__builtin_clzll(value);
+    if (power >= HIST_TOP) {
+        return HIST_BUCKETS - 1;
+    }
+    size_t sub = (size_t)(value >> (power - HIST_SHIFT)) & (HIST_SUB - 1);
+    return (size_t)(power - HIST_SHIFT + 1) * HIST_SUB + sub;
+}
+
+// Largest value that lands in a bucket
+static uint64_t highest_histogram(size_t bucket) {
+    if (bucket < HIST_SUB) {
+        return bucket;
+    }
+    uint32_t power = (uint32_t)(bucket / HIST_SUB) + HIST_SHIFT - 1;
+    uint64_t width = (uint64_t)1 << (power - HIST_SHIFT);
+    uint64_t lowest = (uint64_t)(HIST_SUB + bucket % HIST_SUB) << (power - HIST_SHIFT);
+    return lowest + width - 1;
+}
+
+// Record a value, only from the thread owning the histogram
+extern void record_histogram(Histogram* hist, uint64_t value) {
+    bump_counter(&hist->counts[bucket_histogram(value)], 1);
+    bump_counter(&hist->sum, value);
+}
+
+// Add a snapshot of a histogram to counts (HIST_BUCKETS) and sum
+extern void merge_histogram(uint64_t* counts, uint64_t* sum, Histogram* hist) {
+    for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+        counts[i] += atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+    }
+    *sum += atomic_load_explicit(&hist->sum, memory_order_relaxed);
+}
+
+// Number of values below 2^power, exact since powers of two are bucket edges
+extern uint64_t below_histogram(const uint64_t* counts, uint32_t power) {
+    size_t end = power <= HIST_SHIFT ? (size_t)1 << power : (size_t)(power - HIST_SHIFT + 1) * HIST_SUB;
+    end = end < HIST_BUCKETS ? end : HIST_BUCKETS;
+    uint64_t total = 0;
+    for (size_t i = 0; i < end; ++i) {
+        total += counts[i];
+    }
+    return total;
+}
+
+// Value at quantile q (0 to 1): the largest value of the bucket holding it,
+// 0 for an empty histogram
+extern uint64_t quantile_histogram(const uint64_t* counts, double q) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+    rank = rank > 0 ? rank : 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return highest_histogram(i);
+        }
+    }
+    return highest_histogram(HIST_BUCKETS - 1);
+}
+
+// Append formatted text, growing the buffer as needed
+extern void print_text(Text* text, const char* fmt, ...) {
+    while (1) {
+        size_t room = text->cap - text->len;
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(text->buf != NULL ? text->buf + text->len : NULL, room, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            return;
+        }
+        if ((size_t)n < room) {
+            text->len += (size_t)n;
+            return;
+        }
+        size_t cap = text->cap ? text->cap : 4096;
+        while (cap - text->len <= (size_t)n) {
+            cap <<= 1;
+        }
+        text->buf = (char*)realloc(text->buf, cap);
+        text->cap = cap;
+    }
+}
+
+// Append a Prometheus label value: backslash, quote and newline escaped
+extern void label_text(Text* text, const char* value) {
+    for (const char* p = value; *p != '\0'; ++p) {
+        if (*p == '\\' || *p == '"') {
+            print_text(text, "\\%c", *p);
+        } else if (*p == '\n') {
+            print_text(text, "\\n");
+        } else {
+            print_text(text, "%c", *p);
+        }
+    }
+}
+
+// Free the buffer of a text
+extern void free_text(Text* text) {
+    free(text->buf);
+    text->buf = NULL;
+    text->len = 0;
+    text->cap = 0;
+}
@@ -2,10 +2,17 @@
 // Supports both Linux and Windows platforms
 
 #if __linux__
+#define _GNU_SOURCE
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
+#include <sys/sendfile.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
 #elif __WIN32
 #include <WinSock2.h>
+#include <io.h>
+#include <stdio.h>
 #else 
 #warning "net.h: plat unwer"
 #endif
@@ -17,11 +24,24 @@
 #include "net.h"
 #include "hash.h"
 
-// Function prototype for parsing address string
+// Function prototypes for internal socket helpers
 static int8_t pars_address(char* address, char* ipv4, char* port);
+static int open_listener(char* address, int reuseport, int backlog);
 
 // Create a listening socket on the specified address
-extern int listen_net(char* address){
+// backlog limits the queue of pending connections, 0 or less for SOMAXCONN
+extern int listen_net(char* address, int backlog){
+    return open_listener(address, 0, backlog);
+}
+
+// Create a listening socket that other sockets may bind to the same address
+// The kernel balances incoming connections between all of them
+extern int listen_reuseport_net(char* address, int backlog){
+    return open_listener(address, 1, backlog);
+}
+
+// Create, configure, bind and listen a TCP socket
+static int open_listener(char* address, int reuseport, int backlog){
 #ifdef __WIN32
     WSADATA wsa;
     if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0){
@@ -36,6 +56,13 @@ extern int listen_net(char* address){
     if(setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt)) < 0){
         return -3;
     }
+#ifdef SO_REUSEPORT
+    if(reuseport && setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, (char*)&opt, sizeof(opt)) < 0){
+        return -3;
+    }
+#else
+    (void)reuseport;
+#endif
     char ipv4[16];
     char port[6];
     if (pars_address(address, ipv4, port) != 0){
@@ -48,7 +75,7 @@ extern int listen_net(char* address){
     if(bind(listener, (struct sockaddr*)&addr, sizeof(addr))  != 0){
         return -5;
     }
-    if(listen(listener, SOMAXCONN) != 0){
+    if(listen(listener, backlog > 0 ? backlog : SOMAXCONN) != 0){
         return -6;
     }
     return listener;
@@ -59,6 +86,39 @@ extern int accept_net(int listener){
     return accept(listener, NULL, NULL); // NULL because we don't care about client info
 }
 
+// Accept a new connection already switched to non-blocking mode
+extern int accept_nonblock_net(int listener){
+#ifdef __linux__
+    return accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int conn = accept(listener, NULL, NULL);
+    if (conn < 0){
+        return conn;
+    }
+    if (nonblock_net(conn) != 0){
+        close_net(conn);
+        return -1;
+    }
+    return conn;
+#endif
+}
+
+// Switch a socket to non-blocking mode
+extern int nonblock_net(int conn){
+#ifdef __linux__
+    int flags = fcntl(conn, F_GETFL, 0);
+    if (flags < 0){
+        return -1;
+    }
+    return fcntl(conn, F_SETFL, flags | O_NONBLOCK);
+#elif __WIN32
+    u_long mode = 1;
+    return ioctlsocket(conn, FIONBIO, &mode);
+#else
+    return -1;
+#endif
+}
+
 // Connect to a remote address
 extern int connect_net(char* address){
 #ifdef __WIN32
@@ -74,6 +134,7 @@ extern int connect_net(char* address){
     char ipv4[16];
     char port[6];
     if (pars_address(address, ipv4, port) != 0){
+        close_net(conn);
         return -9;
     }
     struct sockaddr_in addr;
@@ -81,6 +142,7 @@ extern int connect_net(char* address){
     addr.sin_port = htons(atoi(port));
     addr.sin_addr.s_addr = inet_addr(ipv4);
     if(connect(conn, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+        close_net(conn);
         return -10;
     }
     return conn;
@@ -97,9 +159,13 @@ extern int close_net(int conn){
 #endif
 }
 
-// Send data over a socket connection
+// Send data over a socket connection (never raises SIGPIPE on a closed peer)
 extern int send_net(int conn, char* buf, size_t size){
+#ifdef MSG_NOSIGNAL
+    return send(conn, buf, (int)size, MSG_NOSIGNAL);
+#else
     return send(conn, buf, (int)size, 0);
+#endif
 }
 
 // Receive data from a socket connection
@@ -107,6 +173,89 @@ extern int recv_net(int conn, char* buf, size_t size){
     return recv(conn, buf, (int)size, 0);
 }
 
+// Send several buffers with a single call, returns total bytes sent
+extern int writev_net(int conn, struct iovec* iov, int count){
+#ifdef __linux__
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size_t)count;
+    return (int)sendmsg(conn, &msg, MSG_NOSIGNAL);
+#else
+    int total = 0;
+    for (int i = 0; i < count; ++i){
+        int n = send_net(conn, (char*)iov[i].iov_base, iov[i].iov_len);
+        if (n < 0){
+            return total > 0 ? total : n;
+        }
+        total += n;
+        if ((size_t)n < iov[i].iov_len){
+            break;
+        }
+    }
+    return total;
+#endif
+}
+
+// Send up to size bytes of a file starting at *offset, advancing *offset
+// On Linux the kernel copies the data straight from the page cache
+extern int sendfile_net(int conn, int file, size_t* offset, size_t size){
+#ifdef __linux__
+    off_t off = (off_t)*offset;
+    ssize_t n = sendfile(conn, file, &off, size);
+    if (n > 0){
+        *offset = (size_t)off;
+    }
+    return (int)n;
+#else
+    char buf[BUFSIZ];
+    if (size > BUFSIZ){
+        size = BUFSIZ;
+    }
+    if (lseek(file, (long)*offset, SEEK_SET) < 0){
+        return -1;
+    }
+    int n = read(file, buf, (unsigned)size);
+    if (n <= 0){
+        return n;
+    }
+    n = send_net(conn, buf, (size_t)n);
+    if (n > 0){
+        *offset += (size_t)n;
+    }
+    return n;
+#endif
+}
+
+// Hold back partial packets while on, so headers and a file body share segments
+// Turning it off sends whatever is pending
+extern int cork_net(int conn, int on){
+#ifdef TCP_CORK
+    return setsockopt(conn, IPPROTO_TCP, TCP_CORK, (char*)&on, sizeof(on));
+#else
+    (void)conn;
+    (void)on;
+    return 0;
+#endif
+}
+
+// Send small writes at once instead of waiting to coalesce them (Nagle)
+extern int nodelay_net(int conn, int on){
+    return setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, (char*)&on, sizeof(on));
+}
+
+// Fail blocking receives and sends that wait longer than seconds, 0 waits forever
+extern int timeout_net(int conn, int seconds){
+#ifdef __WIN32
+    DWORD ms = (DWORD)seconds * 1000;
+#else
+    struct timeval ms = { .tv_sec = seconds, .tv_usec = 0 };
+#endif
+    if(setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, (char*)&ms, sizeof(ms)) != 0){
+        return -1;
+    }
+    return setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, (char*)&ms, sizeof(ms));
+}
+
 // Parse address string in format "ip:port" into separate IP and port strings
 static int8_t pars_address(char* address, char* ipv4, char* port){
     size_t i = 0, j = 0;
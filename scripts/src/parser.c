@@ -0,0 +1,653 @@
+// Incremental HTTP/1.1 request parser
+// Works on the raw request kept in a receive buffer: every call gets the bytes
+// received so far and resumes scanning where the previous call stopped, so the
+// input may be split at any byte. Delimiters are found with SSE2/AVX2 scans.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "httpbase.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PARSE_SIMD 1
+#endif
+
+// Longest method and protocol version accepted
+#define METHOD_SIZE 16
+#define PROTO_SIZE  16
+
+// Parser states (PARSE_DONE and PARSE_ERROR are public)
+#define PARSE_METHOD  0 // Reading the method
+#define PARSE_PATH    1 // Reading the request-target
+#define PARSE_PROT    2 // Reading the protocol version
+#define PARSE_NAME    3 // At a header line start or reading a header name
+#define PARSE_VALUE   4 // Reading a header value
+
+// Body decoder states (BODY_DONE and BODY_ERROR are public)
+#define BODY_LENGTH   0 // Reading a Content-Length body
+#define BODY_SIZE     1 // At the start of a chunk size line
+#define BODY_DIGITS   2 // Reading the hex digits of a chunk size
+#define BODY_EXT      3 // Skipping a chunk extension up to the line end
+#define BODY_DATA     4 // Reading chunk data
+#define BODY_CRLF     5 // Expecting the line end after chunk data
+#define BODY_TRAILER  6 // At a trailer line start, an empty line ends the body
+#define BODY_FIELD    9 // Skipping a trailer field, numbered past the public states
+
+// Limits used when the request has none attached (values of setings.yaml)
+static const HTTPlimits default_limits = {
+    .uri = 1024,
+    .headers = HTTP_HEADERS,
+    .head = 4096,
+    .body = 1 << 20,
+};
+
+// Function prototypes for internal parser operations
+static char* find_ctl(char* p, char* end);
+static char* find_two(char* p, char* end, char a, char b);
+static void rebase_request(HTTPrequests* request, char* buf);
+static int8_t add_header(HTTPrequests* request, char* colon, char* eol);
+static int8_t eq_nocase(char* x, size_t size, char* lower);
+static int8_t is_name(char* name, size_t size);
+static char* next_token(char* p, char* end, char** token, size_t* len);
+static int8_t has_token(char* value, size_t size, char* lower);
+static int8_t hex_digit(char c);
+
+// Parse the request line and headers of a request starting at buf
+// size is the number of bytes received so far, the previous position is kept
+// in the request. Returns the length of the request head once state is
+// PARSE_DONE; the body, if any, follows it and is read with body_request.
+// Calling it again on a parsed request only points its views at buf.
+extern size_t parse_request(HTTPrequests* request, char* buf, size_t size) {
+    const HTTPlimits* limits = request->limits != NULL ? request->limits : &default_limits;
+    size_t maxheaders = limits->headers < HTTP_HEADERS ? limits->headers : HTTP_HEADERS;
+    char* end = buf + size;
+    // Scan position and token start live in locals, stores through buf would
+    // otherwise force the compiler to reload them from the request
+    uint8_t state = request->state;
+    char* p = buf + request->ind;
+    char* mark = buf + request->mark;
+    uint16_t status = 0;
+    if (request->base != buf) {
+        rebase_request(request, buf);
+    }
+    while (state < PARSE_DONE) {
+        char* q;
+        switch (state) {
+            case PARSE_METHOD:
+                q = find_ctl(p, end);
+                if (q - mark > METHOD_SIZE-1) {
+                    status = 501;
+                    goto fail;
+                }
+                if (q == end) {
+                    p = q;
+                    goto more;
+                }
+                if (*q != ' ' || q == mark) {
+                    status = 400;
+                    goto fail;
+                }
+                request->method = (HTTPview){mark, q - mark};
+                state = PARSE_PATH;
+                p = mark = q + 1;
+            break;
+            case PARSE_PATH:
+                q = find_ctl(p, end);
+                if ((size_t)(q - mark) > limits->uri) {
+                    status = 414;
+                    goto fail;
+                }
+                if (q == end) {
+                    p = q;
+                    goto more;
+                }
+                if (*q != ' ' || q == mark) {
+                    status = 400;
+                    goto fail;
+                }
+                request->path = (HTTPview){mark, q - mark};
+                state = PARSE_PROT;
+                p = mark = q + 1;
+            break;
+            case PARSE_PROT: {
+                q = find_two(p, end, '\r', '\n');
+                if (q - mark > PROTO_SIZE) {
+                    status = 400;
+                    goto fail;
+                }
+                if (q == end || (*q == '\r' && q + 1 == end)) {
+                    p = q;
+                    goto more;
+                }
+                if (*q == '\r' && q[1] != '\n') {
+                    status = 400;
+                    goto fail;
+                }
+                size_t len = q - mark;
+                if (len > PROTO_SIZE-1 || len < 8 || memcmp(mark, "HTTP/", 5) != 0) {
+                    status = 400;
+                    goto fail;
+                }
+                request->prot = (HTTPview){mark, len};
+                state = PARSE_NAME;
+                p = mark = q + (*q == '\r' ? 2 : 1);
+            }
+            break;
+            case PARSE_NAME:
+                if (p == end) {
+                    goto more;
+                }
+                if (p == mark) {
+                    // Line start: an empty line ends the head
+                    if (*p == '\r') {
+                        if (p + 1 == end) {
+                            goto more;
+                        }
+                        if (p[1] != '\n') {
+                            status = 400;
+                            goto fail;
+                        }
+                        p += 2;
+                        state = PARSE_DONE;
+                        break;
+                    }
+                    if (*p == '\n') {
+                        p += 1;
+                        state = PARSE_DONE;
+                        break;
+                    }
+                    if (*p == ' ' || *p == '\t') {
+                        status = 400; // Obsolete line folding
+                        goto fail;
+                    }
+                }
+                q = find_two(p, end, ':', '\n');
+                if (q == end) {
+                    p = q;
+                    goto more;
+                }
+                // A name is a non-empty token, whitespace before the colon
+                // would hide a framing header under another name
+                if (*q == '\n' || !is_name(mark, q - mark)) {
+                    status = 400;
+                    goto fail;
+                }
+                if (request->nheaders >= maxheaders) {
+                    status = 431;
+                    goto fail;
+                }
+                request->headers[request->nheaders].name = (HTTPview){mark, q - mark};
+                state = PARSE_VALUE;
+                p = q + 1;
+            break;
+            case PARSE_VALUE:
+                q = memchr(p, '\n', end - p);
+                if (q == NULL) {
+                    p = end;
+                    goto more;
+                }
+                // mark is still the line start, the value follows the name and colon
+                if (add_header(request, mark + request->headers[request->nheaders].name.len + 1, q) != 0) {
+                    status = 400;
+                    goto fail;
+                }
+                state = PARSE_NAME;
+                p = mark = q + 1;
+            break;
+        }
+        if ((size_t)(p - buf) > limits->head) {
+            status = 431;
+            goto fail;
+        }
+    }
+    if (request->chunked && request->length) {
+        status = 400; // Both framings given: ambiguous body
+        goto fail;
+    }
+    if (request->clen > limits->body) {
+        status = 413;
+        goto fail;
+    }
+    if (request->state != PARSE_DONE) {
+        request->bstate = request->chunked ? BODY_SIZE : request->length && request->clen > 0 ? BODY_LENGTH : BODY_DONE;
+        request->left = request->clen;
+    }
+    request->state = state;
+    request->ind = request->mark = p - buf;
+    return p - buf;
+more:
+    if (size > limits->head) {
+        status = 431;
+        goto fail;
+    }
+    request->state = state;
+    request->ind = p - buf;
+    request->mark = mark - buf;
+    return size;
+fail:
+    request->state = PARSE_ERROR;
+    request->error = status;
+    request->ind = p - buf;
+    return p - buf;
+}
+
+// Decode body bytes following the head, buf holds the bytes not consumed yet
+// Returns the number of bytes consumed; data is set to the body bytes among
+// them, at most one contiguous piece per call. Chunk framing is removed and
+// the size limit enforced as chunks arrive, nothing is buffered.
+extern size_t body_request(HTTPrequests* request, char* buf, size_t size, HTTPview* data) {
+    const HTTPlimits* limits = request->limits != NULL ? request->limits : &default_limits;
+    char* p = buf;
+    char* end = buf + size;
+    *data = (HTTPview){NULL, 0};
+    while (p < end && request->bstate != BODY_DONE && request->bstate != BODY_ERROR) {
+        char c = *p;
+        switch (request->bstate) {
+            case BODY_LENGTH:
+            case BODY_DATA: {
+                size_t n = request->left < (size_t)(end - p) ? request->left : (size_t)(end - p);
+                *data = (HTTPview){p, n};
+                request->left -= n;
+                request->body += n;
+                if (request->left == 0) {
+                    request->bstate = request->bstate == BODY_LENGTH ? BODY_DONE : BODY_CRLF;
+                }
+                return p + n - buf;
+            }
+            case BODY_SIZE:
+            case BODY_DIGITS:
+                if (hex_digit(c) >= 0) {
+                    if (request->left > (SIZE_MAX >> 4)) {
+                        goto fail;
+                    }
+                    request->left = (request->left << 4) | (size_t)hex_digit(c);
+                    request->bstate = BODY_DIGITS;
+                    break;
+                }
+                if (request->bstate == BODY_SIZE) {
+                    goto fail; // No digits
+                }
+                request->bstate = BODY_EXT;
+                continue; // The line end is handled there
+            case BODY_EXT:
+                if (c != '\n') {
+                    break;
+                }
+                if (request->left == 0) {
+                    request->bstate = BODY_TRAILER; // Last chunk
+                } else if (request->left > limits->body - request->body) {
+                    request->bstate = BODY_ERROR;
+                    request->error = 413;
+                    return p + 1 - buf;
+                } else {
+                    request->bstate = BODY_DATA;
+                }
+                break;
+            case BODY_CRLF:
+                if (c == '\n') {
+                    request->bstate = BODY_SIZE;
+                } else if (c != '\r') {
+                    goto fail;
+                }
+                break;
+            case BODY_TRAILER:
+                if (c == '\n') {
+                    request->bstate = BODY_DONE;
+                } else if (c != '\r') {
+                    request->bstate = BODY_FIELD;
+                }
+                break;
+            case BODY_FIELD:
+                if (c == '\n') {
+                    request->bstate = BODY_TRAILER;
+                }
+                break;
+        }
+        p += 1;
+    }
+    return p - buf;
+fail:
+    request->bstate = BODY_ERROR;
+    request->error = 400;
+    return p - buf;
+}
+
+// Find a header value by case-insensitive name, a NULL view if absent
+extern HTTPview header_request(HTTPrequests* request, char* name) {
+    size_t size = strlen(name);
+    for (uint8_t i = 0; i < request->nheaders; ++i) {
+        HTTPheader* header = &request->headers[i];
+        if (header->name.len != size) {
+            continue;
+        }
+        size_t j = 0;
+        for (; j < size; ++j) {
+            char x = header->name.ptr[j], y = name[j];
+            if (x >= 'A' && x <= 'Z') x += 'a' - 'A';
+            if (y >= 'A' && y <= 'Z') y += 'a' - 'A';
+            if (x != y) {
+                break;
+            }
+        }
+        if (j == size) {
+            return header->value;
+        }
+    }
+    return (HTTPview){NULL, 0};
+}
+
+// Find the value of a route parameter by name, a NULL view if absent
+extern HTTPview param_request(HTTPrequests* request, char* name) {
+    for (uint8_t i = 0; i < request->nparams; ++i) {
+        if (equal_view(request->params[i].name, name)) {
+            return request->params[i].value;
+        }
+    }
+    return (HTTPview){NULL, 0};
+}
+
+// Compare a view with a NUL-terminated string
+extern int8_t equal_view(HTTPview view, char* str) {
+    size_t size = strlen(str);
+    return view.len == size && (size == 0 || memcmp(view.ptr, str, size) == 0);
+}
+
+// Prepare a request for parsing without clearing the header array
+extern void reset_request(HTTPrequests* request, const HTTPlimits* limits) {
+    request->method = request->path = request->prot = (HTTPview){NULL, 0};
+    request->base = NULL;
+    request->limits = limits;
+    request->state = PARSE_METHOD;
+    request->nheaders = 0;
+    request->nparams = 0;
+    request->conn = 0;
+    request->chunked = 0;
+    request->length = 0;
+    request->error = 0;
+    request->ind = 0;
+    request->mark = 0;
+    request->clen = 0;
+    request->bstate = BODY_DONE;
+    request->left = 0;
+    request->body = 0;
+    request->onbody = NULL;
+    request->user = NULL;
+}
+
+// Point the views of a partially parsed request at the buffer it moved to
+// Offsets are taken as integers, the old buffer may already be freed
+static void rebase_request(HTTPrequests* request, char* buf) {
+    if (request->base != NULL) {
+        uintptr_t from = (uintptr_t)request->base;
+        uintptr_t to = (uintptr_t)buf;
+        HTTPview* views[] = {&request->method, &request->path, &request->prot};
+        for (size_t i = 0; i < sizeof(views) / sizeof(views[0]); ++i) {
+            if (views[i]->ptr != NULL) {
+                views[i]->ptr = (char*)((uintptr_t)views[i]->ptr - from + to);
+            }
+        }
+        // Also the name of a header whose value is still being read
+        uint8_t count = request->nheaders + (request->state == PARSE_VALUE);
+        for (uint8_t i = 0; i < count; ++i) {
+            HTTPheader* header = &request->headers[i];
+            header->name.ptr = (char*)((uintptr_t)header->name.ptr - from + to);
+            if (i < request->nheaders) {
+                header->value.ptr = (char*)((uintptr_t)header->value.ptr - from + to);
+            }
+        }
+    }
+    request->base = buf;
+}
+
+// Store a complete header line and pick up fields needed for framing
+// colon points right after the ':' and eol at the '\n' ending the line
+static int8_t add_header(HTTPrequests* request, char* colon, char* eol) {
+    char* value = colon;
+    while (value < eol && (*value == ' ' || *value == '\t')) {
+        ++value;
+    }
+    char* last = eol;
+    while (last > value && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t')) {
+        --last;
+    }
+    HTTPheader* header = &request->headers[request->nheaders++];
+    header->value = (HTTPview){value, last - value};
+    char* hname = header->name.ptr;
+    size_t namelen = header->name.len;
+    size_t len = last - value;
+    // Only three names matter for framing, their lengths tell them apart
+    if (namelen != 10 && namelen != 14 && namelen != 17) {
+        return 0;
+    }
+    if (eq_nocase(hname, namelen, "connection")) {
+        if (has_token(value, len, "close")) {
+            request->conn = -1;
+        } else if (has_token(value, len, "keep-alive")) {
+            request->conn = 1;
+        }
+    } else if (eq_nocase(hname, namelen, "content-length")) {
+        size_t clen = 0;
+        if (len == 0) {
+            return 1;
+        }
+        for (size_t i = 0; i < len; ++i) {
+            if (value[i] < '0' || value[i] > '9' || clen > (SIZE_MAX - 9) / 10) {
+                return 1;
+            }
+            clen = clen * 10 + (size_t)(value[i] - '0');
+        }
+        if (request->length && request->clen != clen) {
+            return 1; // Conflicting lengths
+        }
+        request->clen = clen;
+        request->length = 1;
+    } else if (eq_nocase(hname, namelen, "transfer-encoding")) {
+        // chunked must be the final coding and applied once, so no coding
+        // may follow it, in this header or in a later one
+        char* end = value + len;
+        char* token = NULL;
+        size_t size = 0;
+        for (char* p = value; p < end; ) {
+            p = next_token(p, end, &token, &size);
+            if (size == 0) {
+                continue; // Empty list elements are allowed
+            }
+            if (request->chunked) {
+                return 1;
+            }
+            request->chunked = eq_nocase(token, size, "chunked");
+        }
+        if (!request->chunked) {
+            return 1; // Other codings cannot be framed
+        }
+    }
+    return 0;
+}
+
+// Whether a header name is a non-empty token (RFC 7230 tchar)
+static int8_t is_name(char* name, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        unsigned char c = (unsigned char)name[i];
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+            continue;
+        }
+        if (c == 0 || strchr("!#$%&'*+-.^_`|~", c) == NULL) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Next element of a comma-separated header value, OWS trimmed
+// Returns the position after its comma; empty elements come out empty
+static char* next_token(char* p, char* end, char** token, size_t* len) {
+    char* comma = memchr(p, ',', end - p);
+    char* stop = comma != NULL ? comma : end;
+    while (p < stop && (*p == ' ' || *p == '\t')) {
+        ++p;
+    }
+    char* last = stop;
+    while (last > p && (last[-1] == ' ' || last[-1] == '\t')) {
+        --last;
+    }
+    *token = p;
+    *len = last - p;
+    return comma != NULL ? comma + 1 : end;
+}
+
+// Case-insensitive comparison against a lowercase name
+static int8_t eq_nocase(char* x, size_t size, char* lower) {
+    size_t i = 0;
+    for (; i < size && lower[i] != '\0'; ++i) {
+        char c = x[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        if (c != lower[i]) {
+            return 0;
+        }
+    }
+    return i == size && lower[i] == '\0';
+}
+
+// Whether a comma-separated header value lists a lowercase token,
+// compared whole and case-insensitively
+static int8_t has_token(char* value, size_t size, char* lower) {
+    char* end = value + size;
+    char* token = NULL;
+    size_t len = 0;
+    for (char* p = value; p < end; ) {
+        p = next_token(p, end, &token, &len);
+        if (eq_nocase(token, len, lower)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Scalar scan for a control character or space (ends method, target, version)
+static char* find_ctl_scalar(char* p, char* end) {
+    for (; p < end; ++p) {
+        unsigned char c = (unsigned char)*p;
+        if (c <= 0x20 || c == 0x7f) {
+            break;
+        }
+    }
+    return p;
+}
+
+// Scalar scan for either of two bytes
+static char* find_two_scalar(char* p, char* end, char a, char b) {
+    for (; p < end && *p != a && *p != b; ++p);
+    return p;
+}
+
+#ifdef PARSE_SIMD
+// SSE2 scan for a control character or space, 16 bytes per step
+static char* find_ctl_sse2(char* p, char* end) {
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        // c <= 0x20 (unsigned) exactly when min(c, 0x20) == c
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, space), v), _mm_cmpeq_epi8(v, del));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_ctl_scalar(p, end);
+}
+
+// SSE2 scan for either of two bytes
+static char* find_two_sse2(char* p, char* end, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_two_scalar(p, end, a, b);
+}
+
+// AVX2 scan for a control character or space, 32 bytes per step
+__attribute__((target("avx2")))
+static char* find_ctl_avx2(char* p, char* end) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, space), v),
+            _mm256_cmpeq_epi8(v, del));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    // Scalar tail: calling legacy SSE code with dirty upper halves stalls the CPU
+    return find_ctl_scalar(p, end);
+}
+
+// AVX2 scan for either of two bytes
+__attribute__((target("avx2")))
+static char* find_two_avx2(char* p, char* end, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_two_scalar(p, end, a, b);
+}
+
+// Whether the CPU runs AVX2 code, checked once
+static int8_t has_avx2(void) {
+    static int8_t avx2 = -1;
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return avx2;
+}
+#endif
+
+// Find the first control character or space in [p, end), end if none
+static char* find_ctl(char* p, char* end) {
+#ifdef PARSE_SIMD
+    return has_avx2() ? find_ctl_avx2(p, end) : find_ctl_sse2(p, end);
+#else
+    return find_ctl_scalar(p, end);
+#endif
+}
+
+// Find the first a or b in [p, end), end if none
+static char* find_two(char* p, char* end, char a, char b) {
+#ifdef PARSE_SIMD
+    return has_avx2() ? find_two_avx2(p, end, a, b) : find_two_sse2(p, end, a, b);
+#else
+    return find_two_scalar(p, end, a, b);
+#endif
+}
+
+// Value of a hex digit, -1 for other characters
+static int8_t hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20; // Lowercase
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
@@ -0,0 +1,251 @@
+// io_uring rings driven through the raw system calls
+// Submission and completion queues are shared memory: SQEs are filled and
+// published by moving the SQ tail, completions are read up to the CQ tail.
+// Receive buffers are handed to the kernel through a provided buffer ring.
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "ring.h"
+
+#define RING_GROUP 0 // Buffer group receives select from
+
+// Ring structure holding both queues, the SQE array and the buffer ring
+typedef struct Ring {
+    int fd;                     // io_uring descriptor
+    uint32_t features;          // IORING_FEAT_* of the kernel
+    // Submission queue
+    void* sqmem;                // Mapping of the SQ ring (and CQ ring if single)
+    size_t sqsize;
+    _Atomic uint32_t* sqhead;
+    _Atomic uint32_t* sqtail;
+    uint32_t sqmask;
+    uint32_t* sqarray;
+    struct io_uring_sqe* sqes;
+    size_t sqesize;
+    uint32_t sqlocal;           // SQEs filled but not yet published
+    // Completion queue
+    void* cqmem;                // Separate mapping, NULL if shared with sqmem
+    size_t cqsize;
+    _Atomic uint32_t* cqhead;
+    _Atomic uint32_t* cqtail;
+    uint32_t cqmask;
+    struct io_uring_cqe* cqes;
+    // Provided receive buffers
+    struct io_uring_buf_ring* br;
+    uint32_t brmask;
+    char* bufs;
+    uint32_t bufsize;
+    uint64_t calls;             // io_uring_enter calls made
+} Ring;
+
+// Create a ring with room for entries SQEs and a sparse table of files
+// registered descriptors. Returns NULL if the kernel lacks what is needed.
+extern Ring* new_ring(uint32_t entries, uint32_t files) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4; // Multishot requests complete many times
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0 && errno == EINVAL) {
+        // Older kernel: no single issuer or cooperative task running
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+    uint32_t need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & need) != need) {
+        close(fd);
+        return NULL;
+    }
+    Ring* ring = (Ring*)calloc(1, sizeof(Ring));
+    ring->fd = fd;
+    ring->features = params.features;
+    ring->sqsize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    size_t cqsize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cqsize > ring->sqsize) {
+        ring->sqsize = cqsize; // One mapping serves both rings
+    }
+    ring->sqmem = mmap(NULL, ring->sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->sqesize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqmem == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        ring->sqmem = ring->sqmem == MAP_FAILED ? NULL : ring->sqmem;
+        ring->sqes = ring->sqes == MAP_FAILED ? NULL : ring->sqes;
+        free_ring(ring);
+        return NULL;
+    }
+    char* sq = (char*)ring->sqmem;
+    ring->sqhead = (_Atomic uint32_t*)(sq + params.sq_off.head);
+    ring->sqtail = (_Atomic uint32_t*)(sq + params.sq_off.tail);
+    ring->sqmask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+    ring->sqarray = (uint32_t*)(sq + params.sq_off.array);
+    ring->cqhead = (_Atomic uint32_t*)(sq + params.cq_off.head);
+    ring->cqtail = (_Atomic uint32_t*)(sq + params.cq_off.tail);
+    ring->cqmask = *(uint32_t*)(sq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(sq + params.cq_off.cqes);
+    // SQE slots map one to one, the indirection array never changes
+    for (uint32_t i = 0; i <= ring->sqmask; ++i) {
+        ring->sqarray[i] = i;
+    }
+    if (files > 0) {
+        struct io_uring_rsrc_register reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.nr = files;
+        reg.flags = IORING_RSRC_REGISTER_SPARSE;
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES2, &reg, sizeof(reg)) != 0) {
+            free_ring(ring);
+            return NULL;
+        }
+    }
+    return ring;
+}
+
+// Unmap and close the ring, the kernel drops registered files and buffers
+extern void free_ring(Ring* ring) {
+    if (ring->br != NULL) {
+        munmap(ring->br, (ring->brmask + 1) * sizeof(struct io_uring_buf));
+        free(ring->bufs);
+    }
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqesize);
+    }
+    if (ring->sqmem != NULL) {
+        munmap(ring->sqmem, ring->sqsize);
+    }
+    close(ring->fd);
+    free(ring);
+}
+
+// Get a cleared SQE to fill, submitting queued ones first if the queue is full
+extern struct io_uring_sqe* sqe_ring(Ring* ring) {
+    uint32_t head = atomic_load_explicit(ring->sqhead, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(ring->sqtail, memory_order_relaxed) + ring->sqlocal;
+    if (tail - head > ring->sqmask) {
+        submit_ring(ring, 0, 0);
+        head = atomic_load_explicit(ring->sqhead, memory_order_acquire);
+        tail = atomic_load_explicit(ring->sqtail, memory_order_relaxed) + ring->sqlocal;
+        if (tail - head > ring->sqmask) {
+            return NULL;
+        }
+    }
+    struct io_uring_sqe* sqe = &ring->sqes[tail & ring->sqmask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqlocal += 1;
+    return sqe;
+}
+
+// Number of SQEs that can be filled before sqe_ring has to submit
+// Linked requests are only taken once this covers the whole chain
+extern uint32_t space_ring(Ring* ring) {
+    uint32_t head = atomic_load_explicit(ring->sqhead, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(ring->sqtail, memory_order_relaxed) + ring->sqlocal;
+    return ring->sqmask + 1 - (tail - head);
+}
+
+// Submit the filled SQEs and wait until wait completions are ready or timeout
+// ms passed (-1 waits without limit). Returns SQEs submitted or -1 with errno
+extern int submit_ring(Ring* ring, uint32_t wait, int timeout) {
+    uint32_t tail = atomic_load_explicit(ring->sqtail, memory_order_relaxed);
+    atomic_store_explicit(ring->sqtail, tail + ring->sqlocal, memory_order_release);
+    uint32_t count = ring->sqlocal;
+    ring->sqlocal = 0;
+    if (count == 0 && wait == 0) {
+        return 0;
+    }
+    uint32_t flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (wait > 0 && timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    ring->calls += 1;
+    int n = (int)syscall(__NR_io_uring_enter, ring->fd, count, wait, flags | IORING_ENTER_EXT_ARG,
+        &arg, sizeof(arg));
+    if (n < 0 && errno == ETIME) {
+        return (int)count; // Timeout, the SQEs were still submitted
+    }
+    return n;
+}
+
+// Next completion or NULL if none is ready, release it with seen_ring
+extern struct io_uring_cqe* cqe_ring(Ring* ring) {
+    uint32_t head = atomic_load_explicit(ring->cqhead, memory_order_relaxed);
+    if (head == atomic_load_explicit(ring->cqtail, memory_order_acquire)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cqmask];
+}
+
+// Give the completion returned by cqe_ring back to the kernel
+extern void seen_ring(Ring* ring) {
+    uint32_t head = atomic_load_explicit(ring->cqhead, memory_order_relaxed);
+    atomic_store_explicit(ring->cqhead, head + 1, memory_order_release);
+}
+
+// Register count receive buffers of size bytes each (count a power of two)
+// Receives with IOSQE_BUFFER_SELECT pick one; the CQE flags carry its id
+extern int bufs_ring(Ring* ring, uint32_t count, uint32_t size) {
+    size_t brsize = count * sizeof(struct io_uring_buf);
+    void* br = mmap(NULL, brsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br == MAP_FAILED) {
+        return -1;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)br;
+    reg.ring_entries = count;
+    reg.bgid = RING_GROUP;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(br, brsize);
+        return -1;
+    }
+    ring->br = (struct io_uring_buf_ring*)br;
+    ring->brmask = count - 1;
+    ring->bufsize = size;
+    ring->bufs = (char*)malloc((size_t)count * size);
+    for (uint32_t i = 0; i < count; ++i) {
+        recycle_ring(ring, i);
+    }
+    return 0;
+}
+
+// Bytes of a provided buffer picked by a completion
+extern char* buf_ring(Ring* ring, uint32_t bid) {
+    return ring->bufs + (size_t)bid * ring->bufsize;
+}
+
+// Hand a provided buffer back to the kernel once its bytes are consumed
+extern void recycle_ring(Ring* ring, uint32_t bid) {
+    _Atomic uint16_t* tailp = (_Atomic uint16_t*)&ring->br->tail;
+    uint16_t tail = atomic_load_explicit(tailp, memory_order_relaxed);
+    struct io_uring_buf* buf = &ring->br->bufs[tail & ring->brmask];
+    buf->addr = (uint64_t)(uintptr_t)buf_ring(ring, bid);
+    buf->len = ring->bufsize;
+    buf->bid = (uint16_t)bid;
+    atomic_store_explicit(tailp, (uint16_t)(tail + 1), memory_order_release);
+}
+
+// Number of io_uring_enter calls made on the ring
+extern uint64_t calls_ring(Ring* ring) {
+    return ring->calls;
+}
+#endif
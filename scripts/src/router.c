@@ -0,0 +1,241 @@
+// Route matching with a compressed radix tree
+// Static bytes shared by patterns are stored once on the edges, so a path is
+// matched by walking it once; only a ":name" branch that dead-ends makes the
+// walk return to the sibling static branch. Nothing is copied or hashed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "router.h"
+
+#define ROUTER_PATTERNS 16 // Initial capacity of the pattern copies array
+
+// Tree node: the edge into it is label, or a parameter segment when name is set
+typedef struct RouteNode {
+    char* label;        // Static bytes of the edge, points into a pattern copy
+    size_t len;         // Length of label
+    char* name;         // Parameter name of a ":name" node, NULL otherwise
+    size_t namelen;     // Length of name
+    char* firsts;       // First label byte of each static child
+    struct RouteNode** children; // Static children
+    size_t nchild;      // Number of static children
+    struct RouteNode* param; // ":name" child, NULL if none
+    int32_t exact;      // Value of the route ending here, -1 if none
+    int32_t prefix;     // Value of the '/'-terminated route ending here, -1 if none
+} RouteNode;
+
+// Router structure: the tree and the pattern copies its labels point into
+typedef struct Router {
+    RouteNode* root;    // Node of the empty path
+    char** patterns;    // Copies of registered patterns
+    size_t len;         // Number of pattern copies
+    size_t cap;         // Capacity of patterns
+} Router;
+
+// Function prototypes for internal router operations
+static RouteNode* new_node(char* label, size_t len);
+static void free_node(RouteNode* node);
+static RouteNode* static_node(RouteNode* node, char* run, size_t size, size_t* used);
+static int32_t match_node(RouteNode* node, char* p, char* end, HTTPheader* params, uint8_t* nparams);
+
+// Create an empty router
+extern Router* new_router(void) {
+    Router* router = (Router*)malloc(sizeof(Router));
+    router->root = new_node(NULL, 0);
+    router->len = 0;
+    router->cap = ROUTER_PATTERNS;
+    router->patterns = (char**)malloc(router->cap * sizeof(char*));
+    return router;
+}
+
+// Free the router with all its nodes and pattern copies
+extern void free_router(Router* router) {
+    free_node(router->root);
+    for (size_t i = 0; i < router->len; ++i) {
+        free(router->patterns[i]);
+    }
+    free(router->patterns);
+    free(router);
+}
+
+// Register a pattern, registering it again replaces the value
+// Returns 0 on success, -1 for a malformed or conflicting pattern
+extern int8_t add_router(Router* router, char* pattern, int32_t value) {
+    size_t size = strlen(pattern);
+    if (size == 0 || pattern[0] != '/') {
+        fprintf(stderr, "router: pattern must start with '/': %s\n", pattern);
+        return -1;
+    }
+    // Check parameter segments before touching the tree
+    uint8_t params = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (pattern[i] != ':') {
+            continue;
+        }
+        if (pattern[i-1] != '/' || i + 1 == size || pattern[i+1] == '/') {
+            fprintf(stderr, "router: parameter must be a whole named segment: %s\n", pattern);
+            return -1;
+        }
+        if (++params > HTTP_PARAMS) {
+            fprintf(stderr, "router: more than %d parameters: %s\n", HTTP_PARAMS, pattern);
+            return -1;
+        }
+    }
+    if (router->len == router->cap) {
+        router->cap <<= 1;
+        router->patterns = (char**)realloc(router->patterns, router->cap * sizeof(char*));
+    }
+    char* copy = (char*)malloc(size + 1);
+    memcpy(copy, pattern, size + 1);
+    router->patterns[router->len++] = copy;
+    RouteNode* node = router->root;
+    char* p = copy;
+    char* end = copy + size;
+    while (p < end) {
+        if (*p == ':') {
+            char* q = p + 1;
+            while (q < end && *q != '/') {
+                ++q;
+            }
+            size_t namelen = q - p - 1;
+            if (node->param == NULL) {
+                node->param = new_node(NULL, 0);
+                node->param->name = p + 1;
+                node->param->namelen = namelen;
+            } else if (node->param->namelen != namelen || memcmp(node->param->name, p + 1, namelen) != 0) {
+                fprintf(stderr, "router: parameter name conflicts with an earlier route: %s\n", pattern);
+                return -1; // The nodes added so far only hold other routes or none
+            }
+            node = node->param;
+            p = q;
+            continue;
+        }
+        char* q = p;
+        while (q < end && *q != ':') {
+            ++q;
+        }
+        size_t used = 0;
+        node = static_node(node, p, q - p, &used);
+        p += used;
+    }
+    node->exact = value;
+    if (end[-1] == '/') {
+        node->prefix = value;
+    }
+    return 0;
+}
+
+// Find the value of the route matching path, -1 if none
+// The query string is ignored. Parameters are stored in params as views into
+// the pattern (name) and the path (value), their count in nparams.
+extern int32_t match_router(Router* router, HTTPview path, HTTPheader* params, uint8_t* nparams) {
+    char* end = path.ptr + path.len;
+    char* query = path.len > 0 ? (char*)memchr(path.ptr, '?', path.len) : NULL;
+    if (query != NULL) {
+        end = query;
+    }
+    *nparams = 0;
+    return match_node(router->root, path.ptr, end, params, nparams);
+}
+
+// Create a node entered through the given static label
+static RouteNode* new_node(char* label, size_t len) {
+    RouteNode* node = (RouteNode*)malloc(sizeof(RouteNode));
+    node->label = label;
+    node->len = len;
+    node->name = NULL;
+    node->namelen = 0;
+    node->firsts = NULL;
+    node->children = NULL;
+    node->nchild = 0;
+    node->param = NULL;
+    node->exact = -1;
+    node->prefix = -1;
+    return node;
+}
+
+// Free a node and everything below it
+static void free_node(RouteNode* node) {
+    for (size_t i = 0; i < node->nchild; ++i) {
+        free_node(node->children[i]);
+    }
+    if (node->param != NULL) {
+        free_node(node->param);
+    }
+    free(node->children);
+    free(node->firsts);
+    free(node);
+}
+
+// Descend from node along as much of a static run as one edge covers
+// Splits an edge sharing only part of its label, adds a leaf for a new one.
+// Stores the number of run bytes consumed in used.
+static RouteNode* static_node(RouteNode* node, char* run, size_t size, size_t* used) {
+    for (size_t i = 0; i < node->nchild; ++i) {
+        if (node->firsts[i] != run[0]) {
+            continue;
+        }
+        RouteNode* child = node->children[i];
+        size_t common = 1;
+        while (common < child->len && common < size && child->label[common] == run[common]) {
+            ++common;
+        }
+        *used = common;
+        if (common == child->len) {
+            return child;
+        }
+        // Split the edge: the shared part becomes a node above the old child
+        RouteNode* mid = new_node(child->label, common);
+        child->label += common;
+        child->len -= common;
+        mid->firsts = (char*)malloc(1);
+        mid->children = (RouteNode**)malloc(sizeof(RouteNode*));
+        mid->firsts[0] = child->label[0];
+        mid->children[0] = child;
+        mid->nchild = 1;
+        node->children[i] = mid;
+        return mid;
+    }
+    RouteNode* leaf = new_node(run, size);
+    node->firsts = (char*)realloc(node->firsts, node->nchild + 1);
+    node->children = (RouteNode**)realloc(node->children, (node->nchild + 1) * sizeof(RouteNode*));
+    node->firsts[node->nchild] = run[0];
+    node->children[node->nchild] = leaf;
+    node->nchild += 1;
+    *used = size;
+    return leaf;
+}
+
+// Match the rest of a path below node, static children before parameters
+// Falls back to the deepest '/'-terminated route the path lies under.
+static int32_t match_node(RouteNode* node, char* p, char* end, HTTPheader* params, uint8_t* nparams) {
+    if (p == end) {
+        return node->exact >= 0 ? node->exact : node->prefix;
+    }
+    char* first = node->nchild > 0 ? (char*)memchr(node->firsts, *p, node->nchild) : NULL;
+    if (first != NULL) {
+        RouteNode* child = node->children[first - node->firsts];
+        if ((size_t)(end - p) >= child->len && memcmp(p, child->label, child->len) == 0) {
+            int32_t value = match_node(child, p + child->len, end, params, nparams);
+            if (value >= 0) {
+                return value;
+            }
+        }
+    }
+    if (node->param != NULL && *p != '/') {
+        char* q = (char*)memchr(p, '/', end - p);
+        if (q == NULL) {
+            q = end;
+        }
+        uint8_t saved = *nparams;
+        params[saved].name = (HTTPview){node->param->name, node->param->namelen};
+        params[saved].value = (HTTPview){p, q - p};
+        *nparams = saved + 1;
+        int32_t value = match_node(node->param, q, end, params, nparams);
+        if (value >= 0) {
+            return value;
+        }
+        *nparams = saved; // Parameters of a dead branch are dropped
+    }
+    return node->prefix;
+}
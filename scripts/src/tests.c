@@ -1,39 +1,1765 @@
-#include "headers/tests.h"
-#include "headers/httpbase.h"
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "tests.h"
+#include "httpbase.h"
+#include "cache.h"
+#include "router.h"
+#include "hash.h"
+#include "tree.h"
+#include "arena.h"
+#include "net.h"
+#include "logger.h"
+#include "clock.h"
+#include "config.h"
+#include "wheel.h"
+#include "epoch.h"
+#include "metrics.h"
+#include "alloc.h"
+#include <time.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
+
 // Test HTTP request parsing logic
 int test_parse_request() {
     HTTPrequests req = {0};
     char raw[] = "GET /scream HTTP/1.1\n";
     parse_request(&req, raw, strlen(raw));
-    if (strcmp(req.method, "GET") != 0) {
+    if (!equal_view(req.method, "GET")) {
         printf("test_parse_request: method fail\n");
         return 1;
     }
-    if (strcmp(req.path, "/scream") != 0) {
+    if (!equal_view(req.path, "/scream")) {
         printf("test_parse_request: path fail\n");
         return 2;
     }
-    if (strcmp(req.prot, "HTTP/1.1") != 0) {
+    if (!equal_view(req.prot, "HTTP/1.1")) {
         printf("test_parse_request: prot fail\n");
         return 3;
     }
     return 0;
 }
 
+// Test that parsing resumes at every byte boundary as data arrives
+int test_parse_partial() {
+    HTTPrequests req = {0};
+    char raw[] = "GET /scream HTTP/1.1\r\nHost: a\r\nAccept-Encoding: gzip\r\n\r\n";
+    for (size_t i = 1; i <= strlen(raw); ++i) {
+        parse_request(&req, raw, i);
+    }
+    if (req.state != PARSE_DONE) {
+        printf("test_parse_partial: request not complete\n");
+        return 1;
+    }
+    if (!equal_view(req.method, "GET") || !equal_view(req.path, "/scream")) {
+        printf("test_parse_partial: method/path fail\n");
+        return 2;
+    }
+    if (!equal_view(req.prot, "HTTP/1.1")) {
+        printf("test_parse_partial: prot fail\n");
+        return 3;
+    }
+    HTTPview value = header_request(&req, "accept-encoding");
+    if (!equal_view(value, "gzip")) {
+        printf("test_parse_partial: header fail\n");
+        return 4;
+    }
+    return 0;
+}
+
+// Test that parser limits and malformed requests end in PARSE_ERROR
+int test_parse_limits() {
+    HTTPlimits limits = { .uri = 8, .headers = 2, .head = 4096, .body = 4 };
+    char* cases[] = {
+        "GET /very/long/path HTTP/1.1\r\n\r\n",
+        "GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\n\r\n",
+        "GET / HTTP/1.1\r\nNo colon here\r\n\r\n",
+        "GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\n",
+    };
+    uint16_t codes[] = {414, 431, 400, 400, 413};
+    for (size_t i = 0; i < sizeof(cases)/sizeof(cases[0]); ++i) {
+        HTTPrequests req = {0};
+        req.limits = &limits;
+        parse_request(&req, cases[i], strlen(cases[i]));
+        if (req.state != PARSE_ERROR || req.error != codes[i]) {
+            printf("test_parse_limits: case %zu fail\n", i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Test the headers that frame a body: whole tokens, the final chunked
+// coding, repeated or mixed lengths and malformed names
+int test_parse_framing() {
+    char* errors[] = {
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: xchunkedx\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 0\r\nContent-Length: 5\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 0\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length : 5\r\n\r\nhello",
+        "POST / HTTP/1.1\r\n Content-Length: 5\r\n\r\nhello",
+        "GET / HTTP/1.1\r\nX\tName: 1\r\n\r\n",
+        "GET / HTTP/1.1\r\nX(Name): 1\r\n\r\n",
+    };
+    for (size_t i = 0; i < sizeof(errors)/sizeof(errors[0]); ++i) {
+        HTTPrequests req = {0};
+        parse_request(&req, errors[i], strlen(errors[i]));
+        if (req.state != PARSE_ERROR || req.error != 400) {
+            printf("test_parse_framing: error case %zu fail\n", i);
+            return 1;
+        }
+    }
+    char* raw = "POST / HTTP/1.1\r\nTransfer-Encoding: gzip ,, Chunked\r\nConnection: closed, x-close\r\n\r\n";
+    HTTPrequests req = {0};
+    parse_request(&req, raw, strlen(raw));
+    if (req.state != PARSE_DONE || !req.chunked || req.bstate == BODY_DONE || req.conn != 0) {
+        printf("test_parse_framing: token list fail\n");
+        return 2;
+    }
+    raw = "POST / HTTP/1.1\r\nContent-Length: 0\r\nConnection: keep-alive, Close\r\n\r\n";
+    memset(&req, 0, sizeof(req));
+    parse_request(&req, raw, strlen(raw));
+    if (req.state != PARSE_DONE || !req.length || req.bstate != BODY_DONE || req.conn != -1) {
+        printf("test_parse_framing: empty length fail\n");
+        return 3;
+    }
+    return 0;
+}
+
+// Test that pipelined requests are split at the end of each head
+// The body is left to the caller, which skips clen bytes
+int test_parse_pipeline() {
+    char raw[] = "POST /a HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+                 "GET /b HTTP/1.1\r\nConnection: close\r\n\r\n";
+    size_t size = strlen(raw);
+    HTTPrequests first = {0};
+    size_t used = parse_request(&first, raw, size);
+    used += first.clen;
+    if (first.state != PARSE_DONE || !equal_view(first.path, "/a") || first.clen != 3) {
+        printf("test_parse_pipeline: first request fail\n");
+        return 1;
+    }
+    HTTPrequests second = {0};
+    used += parse_request(&second, raw + used, size - used);
+    if (second.state != PARSE_DONE || !equal_view(second.path, "/b")) {
+        printf("test_parse_pipeline: second request fail\n");
+        return 2;
+    }
+    if (used != size || second.conn != -1) {
+        printf("test_parse_pipeline: framing fail\n");
+        return 3;
+    }
+    return 0;
+}
+
+// Test that views follow a receive buffer moved between partial reads
+// and that paths are not truncated to a fixed size
+int test_parse_views() {
+    HTTPlimits limits = { .uri = 8192, .headers = 8, .head = 16384 };
+    size_t pathlen = 3000;
+    size_t size = pathlen + 64;
+    char* first = (char*)malloc(size);
+    int n = snprintf(first, size, "GET /%0*d HTTP/1.1\r\nHost: a\r\n\r\n", (int)pathlen - 1, 0);
+    HTTPrequests req;
+    reset_request(&req, &limits);
+    parse_request(&req, first, pathlen + 20); // Stops inside the Host header
+    char* second = (char*)malloc(size);
+    memcpy(second, first, n);
+    memset(first, 'x', n); // Old buffer must no longer be read
+    size_t used = parse_request(&req, second, n);
+    int res = 0;
+    if (req.state != PARSE_DONE || used != (size_t)n) {
+        printf("test_parse_views: request not complete\n");
+        res = 1;
+    } else if (req.path.ptr != second + 4 || req.path.len != pathlen) {
+        printf("test_parse_views: path fail\n");
+        res = 2;
+    } else if (!equal_view(header_request(&req, "host"), "a")) {
+        printf("test_parse_views: header fail\n");
+        res = 3;
+    }
+    free(first);
+    free(second);
+    return res;
+}
+
+// Decode a body fed one byte at a time, returns the bytes consumed
+static size_t body_bytes(HTTPrequests* req, char* raw, char* out, size_t* outlen) {
+    size_t head = parse_request(req, raw, strlen(raw));
+    size_t used = head;
+    *outlen = 0;
+    while (raw[used] != '\0' && req->bstate != BODY_DONE && req->bstate != BODY_ERROR) {
+        HTTPview data;
+        used += body_request(req, raw + used, 1, &data);
+        if (data.len > 0) {
+            memcpy(out + *outlen, data.ptr, data.len);
+            *outlen += data.len;
+        }
+    }
+    return used - head;
+}
+
+// Test chunked and Content-Length bodies split at every byte and the body limits
+int test_parse_body() {
+    char out[64];
+    size_t outlen;
+    HTTPrequests req = {0};
+    char* chunked = "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                    "5;name=value\r\nhello\r\nA\r\n, chunked!\r\n0\r\nTrailer: x\r\n\r\nGET";
+    size_t used = body_bytes(&req, chunked, out, &outlen);
+    if (req.bstate != BODY_DONE || outlen != 15 || memcmp(out, "hello, chunked!", 15) != 0) {
+        printf("test_parse_body: chunked body fail\n");
+        return 1;
+    }
+    // Everything up to the next request is consumed
+    if (used != strlen(strstr(chunked, "\r\n\r\n") + 4) - strlen("GET")) {
+        printf("test_parse_body: chunked framing fail\n");
+        return 2;
+    }
+    memset(&req, 0, sizeof(req));
+    body_bytes(&req, "POST / HTTP/1.1\r\nContent-Length: 4\r\n\r\nbodyGET", out, &outlen);
+    if (req.bstate != BODY_DONE || outlen != 4 || memcmp(out, "body", 4) != 0) {
+        printf("test_parse_body: length body fail\n");
+        return 3;
+    }
+    HTTPlimits limits = { .uri = 64, .headers = 8, .head = 4096, .body = 8 };
+    char* errors[] = {
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\n12345\r\n5\r\n67890\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nabX\r\n",
+    };
+    uint16_t codes[] = {413, 400, 400};
+    for (size_t i = 0; i < sizeof(errors)/sizeof(errors[0]); ++i) {
+        reset_request(&req, &limits);
+        body_bytes(&req, errors[i], out, &outlen);
+        if (req.bstate != BODY_ERROR || req.error != codes[i] || outlen > limits.body) {
+            printf("test_parse_body: error case %zu fail\n", i);
+            return 4;
+        }
+    }
+    return 0;
+}
+
+// Test hash table growth, updates and deletion with both key types
+int test_hashtab() {
+    HashTab* names = new_hashtab(4, STRING_TYPE, STRING_TYPE);
+    HashTab* numbers = new_hashtab(4, DECIMAL_TYPE, DECIMAL_TYPE);
+    char key[32];
+    int res = 0;
+    for (int32_t i = 0; i < 5000; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        set_hashtab(names, string(key), string(key));
+        set_hashtab(numbers, decimal(i * 4096), decimal(i));
+    }
+    set_hashtab(names, string("key7"), string("seven"));
+    for (int32_t i = 0; i < 5000; i += 2) {
+        snprintf(key, sizeof(key), "key%d", i);
+        del_hashtab(names, string(key));
+        del_hashtab(numbers, decimal(i * 4096));
+    }
+    for (int32_t i = 0; i < 5000 && res == 0; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        if (in_hashtab(names, string(key)) != (i % 2 == 1) || in_hashtab(numbers, decimal(i * 4096)) != (i % 2 == 1)) {
+            printf("test_hashtab: membership fail at %d\n", i);
+            res = 1;
+        } else if (i % 2 == 1 && get_hashtab(numbers, decimal(i * 4096)).decimal != i) {
+            printf("test_hashtab: value fail at %d\n", i);
+            res = 2;
+        }
+    }
+    if (res == 0 && strcmp(get_hashtab(names, string("key7")).string, "seven") != 0) {
+        printf("test_hashtab: update fail\n");
+        res = 3;
+    }
+    // A stored value passed back in survives the update
+    set_hashtab(names, string("key7"), string(get_hashtab(names, string("key7")).string));
+    if (res == 0 && strcmp(get_hashtab(names, string("key7")).string, "seven") != 0) {
+        printf("test_hashtab: self update fail\n");
+        res = 5;
+    }
+    if (res == 0 && (size_hashtab(names) & (size_hashtab(names) - 1)) != 0) {
+        printf("test_hashtab: capacity is not a power of two\n");
+        res = 4;
+    }
+    free_hashtab(names);
+    free_hashtab(numbers);
+    return res;
+}
+
+// Test string keys of every length the hash reads differently, all sharing
+// a prefix, and lookups of one table's keys in another
+int test_strhash() {
+    char path[] = "/api/v1/organizations/42/projects/7/settings/members/roles/"
+        "admin/permissions/write/history/2024/10/17/entries/page/3/index.json"
+        "?limit=100&offset=200&sort=created&order=desc&fields=id,name,role";
+    size_t total = strlen(path);
+    HashTab* first = new_hashtab(0, STRING_TYPE, DECIMAL_TYPE);
+    HashTab* second = new_hashtab(0, STRING_TYPE, DECIMAL_TYPE);
+    char key[sizeof(path)];
+    int res = 0;
+    for (size_t len = 0; len <= total; ++len) {
+        memcpy(key, path, len);
+        key[len] = '\0';
+        set_hashtab(first, string(key), decimal((int32_t)len));
+        set_hashtab(second, string(key), decimal((int32_t)len));
+    }
+    for (size_t len = 0; len <= total && res == 0; ++len) {
+        memcpy(key, path, len);
+        key[len] = '\0';
+        if (!in_hashtab(first, string(key)) || get_hashtab(first, string(key)).decimal != (int32_t)len) {
+            printf("test_strhash: lookup fail at length %zu\n", len);
+            res = 1;
+        }
+    }
+    if (res == 0 && !eq_hashtab(first, second)) {
+        printf("test_strhash: tables differ\n");
+        res = 2;
+    }
+    if (res == 0 && in_hashtab(first, string("/api/v1/organizations/42/projects/8"))) {
+        printf("test_strhash: found a missing key\n");
+        res = 3;
+    }
+    free_hashtab(first);
+    free_hashtab(second);
+    return res;
+}
+
+// Test the tree on sorted input, deletes of inner nodes and ordered equality
+int test_tree() {
+    Tree* sorted = new_tree(DECIMAL_TYPE, DECIMAL_TYPE);
+    Tree* reversed = new_tree(DECIMAL_TYPE, DECIMAL_TYPE);
+    int32_t count = 200000; // Deep enough to overflow the stack of a recursive unbalanced tree
+    for (int32_t i = 0; i < count; ++i) {
+        set_tree(sorted, decimal(i), decimal(i * 2));
+        set_tree(reversed, decimal(count - 1 - i), decimal((count - 1 - i) * 2));
+    }
+    for (int32_t i = 0; i < count; i += 3) {
+        del_tree(sorted, decimal(i));
+        del_tree(reversed, decimal(i));
+    }
+    int res = 0;
+    for (int32_t i = 0; i < count && res == 0; ++i) {
+        if (in_tree(sorted, decimal(i)) != (i % 3 != 0)) {
+            printf("test_tree: membership fail at %d\n", i);
+            res = 1;
+        } else if (i % 3 != 0 && get_tree(sorted, decimal(i)).decimal != i * 2) {
+            printf("test_tree: value fail at %d\n", i);
+            res = 2;
+        }
+    }
+    if (res == 0 && (size_tree(sorted) != (size_t)(count - (count + 2) / 3) || !eq_tree(sorted, reversed))) {
+        printf("test_tree: size or equality fail\n");
+        res = 3;
+    }
+    free_tree(sorted);
+    free_tree(reversed);
+    // Deleting a node with two children keeps the successor's pair intact
+    Tree* names = new_tree(STRING_TYPE, STRING_TYPE);
+    char* keys[] = {"m", "f", "t", "c", "h", "p", "w"};
+    for (size_t i = 0; i < sizeof(keys)/sizeof(keys[0]); ++i) {
+        set_tree(names, string(keys[i]), string(keys[i]));
+    }
+    del_tree(names, string("m"));
+    del_tree(names, string("f"));
+    if (res == 0 && (in_tree(names, string("m")) || strcmp(get_tree(names, string("p")).string, "p") != 0
+            || strcmp(get_tree(names, string("h")).string, "h") != 0 || size_tree(names) != 5)) {
+        printf("test_tree: inner delete fail\n");
+        res = 4;
+    }
+    // A stored value passed back in, long and short, survives the update
+    char* long_value = "a value longer than the inline buffer of a tree node";
+    set_tree(names, string("p"), string(long_value));
+    set_tree(names, string("p"), string(get_tree(names, string("p")).string));
+    set_tree(names, string("h"), string(get_tree(names, string("h")).string));
+    if (res == 0 && (strcmp(get_tree(names, string("p")).string, long_value) != 0
+            || strcmp(get_tree(names, string("h")).string, "h") != 0)) {
+        printf("test_tree: self update fail\n");
+        res = 5;
+    }
+    free_tree(names);
+    return res;
+}
+
+// Key of the interning test: short for even numbers, long for odd ones
+static void intern_key(char* key, size_t size, int32_t i) {
+    if (i % 2 == 0) {
+        snprintf(key, size, "k%d", i);
+    } else {
+        snprintf(key, size, "x-a-header-name-longer-than-the-node-buffer-%d", i);
+    }
+}
+
+// Test inline and long strings, shared interned keys and real values in
+// trees and hash tables
+int test_intern() {
+    char* long_value = "text/html,application/xhtml+xml,application/xml;q=0.9";
+    Intern* intern = new_intern(0);
+    Tree* first = new_tree(STRING_TYPE, STRING_TYPE);
+    Tree* second = new_tree(STRING_TYPE, REAL_TYPE);
+    HashTab* tab = new_hashtab(0, STRING_TYPE, REAL_TYPE);
+    int res = 0;
+    if (intern_tree(first, intern) != 0 || intern_tree(second, intern) != 0 || intern_hashtab(tab, intern) != 0) {
+        printf("test_intern: can not intern keys\n");
+        res = 1;
+    }
+    char key[64];
+    for (int32_t i = 0; i < 1000; ++i) {
+        intern_key(key, sizeof(key), i);
+        set_tree(first, string(key), string(i % 3 ? "gzip" : long_value));
+        // Boxed reals as before and reals stored by value
+        if (i % 2) {
+            set_tree(second, string(key), real(i / 4.0));
+            set_hashtab(tab, string(key), real(i / 8.0));
+        } else {
+            set_real_tree(second, string(key), i / 4.0);
+            set_real_hashtab(tab, string(key), i / 8.0);
+        }
+    }
+    // Every key is stored once: the trees keep short keys inline, the hash
+    // table interns all of them
+    if (res == 0 && size_intern(intern) != 1000) {
+        printf("test_intern: %zu interned keys\n", size_intern(intern));
+        res = 2;
+    }
+    intern_key(key, sizeof(key), 7);
+    char* shared = get_intern(intern, key);
+    char* inline_value = get_tree(first, string("k8")).string;
+    if (res == 0 && (shared != get_intern(intern, key) || size_intern(intern) != 1000 || strcmp(get_tree(first, string("k6")).string, long_value) != 0
+            || get_tree(second, string(key)).real != 1.75 || get_hashtab(tab, string(key)).real != 0.875)) {
+        printf("test_intern: lookup fail\n");
+        res = 3;
+    }
+    // Deleting other keys leaves the pairs and their inline strings in place
+    for (int32_t i = 0; i < 1000; i += 3) {
+        intern_key(key, sizeof(key), i);
+        del_tree(first, string(key));
+    }
+    if (res == 0 && (get_tree(first, string("k8")).string != inline_value || strcmp(inline_value, "gzip") != 0
+            || size_tree(first) != 666)) {
+        printf("test_intern: delete moved a pair\n");
+        res = 4;
+    }
+    set_tree(first, string("k8"), string(long_value));
+    set_tree(first, string("k10"), string("br"));
+    if (res == 0 && (strcmp(get_tree(first, string("k8")).string, long_value) != 0
+            || strcmp(get_tree(first, string("k10")).string, "br") != 0)) {
+        printf("test_intern: update fail\n");
+        res = 5;
+    }
+#ifdef ALLOC_HOOK
+    // Short pairs and reals stored by value only take slabs from the heap
+    Tree* headers = new_tree(STRING_TYPE, STRING_TYPE);
+    alloc_count = 0;
+    alloc_counting = 1;
+    for (int32_t i = 0; i < 1000; ++i) {
+        snprintf(key, sizeof(key), "x-header-%d", i);
+        set_tree(headers, string(key), string("gzip, deflate, br"));
+        set_real_tree(second, string(key), i);
+    }
+    alloc_counting = 0;
+    if (res == 0 && alloc_count > 20) {
+        printf("test_intern: %ld allocations for 2000 short pairs\n", (long)alloc_count);
+        res = 6;
+    }
+    free_tree(headers);
+#endif
+    free_tree(first);
+    free_tree(second);
+    free_hashtab(tab);
+    free_intern(intern);
+    return res;
+}
+
+// Write a small file for the cache tests
+static void write_file(char* name, char* text) {
+    FILE* file = fopen(name, "w");
+    fputs(text, file);
+    fclose(file);
+}
+
+// Test asset cache hits, invalidation on change and budget eviction
+int test_cache() {
+    char* first = "test_cache_a.html";
+    char* second = "test_cache_b.html";
+    write_file(first, "aaaa");
+    write_file(second, "bbbb");
+    Cache* cache = new_cache(1024);
+    int res = 0;
+    CacheEntry* entry = get_cache(cache, first);
+    if (entry == NULL || entry->size != 4 || get_cache(cache, first) != entry) {
+        printf("test_cache: hit fail\n");
+        res = 1;
+        goto out;
+    }
+    if (strstr(entry->head, "Content-Length: 4\r\n") == NULL) {
+        printf("test_cache: header fail\n");
+        res = 2;
+        goto out;
+    }
+    write_file(first, "changed");
+    events_cache(cache);
+    entry = get_cache(cache, first);
+    if (entry == NULL || entry->size != 7 || memcmp(entry->body, "changed", 7) != 0) {
+        printf("test_cache: invalidation fail\n");
+        res = 3;
+        goto out;
+    }
+    // Budget only fits one of the two entries with headers
+    free_cache(cache);
+    cache = new_cache(200);
+    get_cache(cache, first);
+    get_cache(cache, second);
+    if (used_cache(cache) == 0 || used_cache(cache) > 200) {
+        printf("test_cache: eviction fail\n");
+        res = 4;
+    }
+out:
+    free_cache(cache);
+    remove(first);
+    remove(second);
+    return res;
+}
+
+// Match a path given as a C string
+static int32_t match_path(Router* router, char* path, HTTPrequests* req) {
+    return match_router(router, (HTTPview){path, strlen(path)}, req->params, &req->nparams);
+}
+
+// Test exact, longest-prefix and parameter matching of the router
+int test_router() {
+    Router* router = new_router();
+    add_router(router, "/", 0);
+    add_router(router, "/static/", 1);
+    add_router(router, "/static/img/", 2);
+    add_router(router, "/users/:id", 3);
+    add_router(router, "/users/new", 4);
+    add_router(router, "/users/:id/orders/:order", 5);
+    add_router(router, "/user", 6);
+    HTTPrequests req;
+    reset_request(&req, NULL);
+    int res = 0;
+    if (match_path(router, "/user", &req) != 6 || match_path(router, "/users/new", &req) != 4) {
+        printf("test_router: exact fail\n");
+        res = 1;
+    } else if (match_path(router, "/static/img/a/b.png", &req) != 2 || match_path(router, "/static/x", &req) != 1
+            || match_path(router, "/usr", &req) != 0) {
+        printf("test_router: prefix fail\n");
+        res = 2;
+    } else if (match_path(router, "/users/42?full=1", &req) != 3 || !equal_view(param_request(&req, "id"), "42")) {
+        printf("test_router: parameter fail\n");
+        res = 3;
+    } else if (match_path(router, "/users/new/orders/7", &req) != 5 || req.nparams != 2
+            || !equal_view(param_request(&req, "id"), "new") || !equal_view(param_request(&req, "order"), "7")) {
+        printf("test_router: backtracking fail\n");
+        res = 4;
+    } else if (match_path(router, "/users/42/orders", &req) != 0 || req.nparams != 0) {
+        printf("test_router: dead branch fail\n");
+        res = 5;
+    } else if (add_router(router, "/users/:name", 7) == 0 || add_router(router, "/a:b", 7) == 0) {
+        printf("test_router: bad pattern accepted\n");
+        res = 6;
+    }
+    free_router(router);
+    return res;
+}
+
+// Test arena alignment, growth past the first chunk and pool reuse
+int test_arena() {
+    ArenaPool* pool = new_pool(256, 4);
+    Arena* arena = get_pool(pool);
+    int res = 0;
+    char* small = (char*)alloc_arena(arena, 3);
+    char* big = (char*)alloc_arena(arena, 1000); // Needs a second chunk
+    if (((uintptr_t)small | (uintptr_t)big) % 16 != 0 || used_arena(arena) != 16 + 1008) {
+        printf("test_arena: allocation fail\n");
+        res = 1;
+    }
+    memset(big, 'x', 1000);
+    put_pool(pool, arena);
+    Arena* again = get_pool(pool);
+    if (res == 0 && (again != arena || used_arena(again) != 0 || alloc_arena(again, 8) != small)) {
+        printf("test_arena: reuse fail\n");
+        res = 2;
+    }
+    put_pool(pool, again);
+    free_pool(pool);
+    return res;
+}
+
+#if defined(__linux__) && defined(ALLOC_HOOK)
+#define ALLOC_ADDRESS "127.0.0.1:18089"
+
+// Server for the allocation test, runs until the process exits
+static void* alloc_server(void* arg) {
+    listen_http((HTTP*)arg);
+    return NULL;
+}
+
+// Handler building its body in request scratch memory
+static void alloc_page(int conn, HTTPrequests *req) {
+    HTTPview id = param_request(req, "id");
+    char* body = (char*)alloc_http(conn, 64);
+    int len = snprintf(body, 64, "item %.*s", (int)id.len, id.ptr);
+    HTTPresponse* res = start_response(conn, 200, "OK");
+    header_response(res, "Content-Type", "text/plain");
+    data_response(res, body, len);
+    end_response(res);
+}
+
+// Handler serving a cached static file
+static void alloc_file(int conn, HTTPrequests *req) {
+    (void)req;
+    htmlparse_http(conn, "test_alloc.html");
+}
+
+// Send pipelined requests and read until every response arrived
+static int alloc_exchange(int fd, char* raw, int responses) {
+    char buf[8192];
+    size_t len = 0;
+    if (send_net(fd, raw, strlen(raw)) < 0) {
+        return -1;
+    }
+    while (1) {
+        int seen = 0;
+        for (char* p = buf; (p = memmem(p, len - (p - buf), "HTTP/1.1 200", 12)) != NULL; ++p) {
+            seen += 1;
+        }
+        if (seen >= responses) {
+            return 0;
+        }
+        int n = recv_net(fd, buf + len, sizeof(buf) - len);
+        if (n <= 0) {
+            return -1;
+        }
+        len += n;
+    }
+}
+
+// Test that keep-alive requests and reused connections do not call malloc
+// once the worker's pools and the asset cache are warm
+int test_allocs() {
+    write_file("test_alloc.html", "<p>alloc</p>");
+    HTTP* server = new_http(ALLOC_ADDRESS);
+    workers_http(server, 1);
+    handle_http(server, "/item/:id", alloc_page);
+    handle_http(server, "/file", alloc_file);
+    pthread_t thread;
+    pthread_create(&thread, NULL, alloc_server, server);
+    pthread_detach(thread);
+    char* raw = "GET /item/7 HTTP/1.1\r\nHost: a\r\n\r\n"
+                "GET /file HTTP/1.1\r\nHost: a\r\n\r\n"
+                "GET /item/42?x=1 HTTP/1.1\r\nHost: a\r\n\r\n";
+    // Warm up with two connections so two closed ones are kept for reuse
+    int warm[2] = {-1, -1};
+    for (int i = 0; i < 200 && warm[0] < 0; ++i) {
+        warm[0] = connect_net(ALLOC_ADDRESS);
+        if (warm[0] < 0) {
+            usleep(10000);
+        }
+    }
+    warm[1] = connect_net(ALLOC_ADDRESS);
+    int res = 0;
+    for (int i = 0; i < 2 && res == 0; ++i) {
+        if (warm[i] < 0 || alloc_exchange(warm[i], raw, 3) != 0 || alloc_exchange(warm[i], raw, 3) != 0) {
+            printf("test_allocs: warm-up fail\n");
+            res = 1;
+        }
+    }
+    close_net(warm[0]);
+    close_net(warm[1]);
+    usleep(100000); // Let the worker see both closes
+    alloc_count = 0;
+    alloc_counting = 1;
+    for (int c = 0; c < 2 && res == 0; ++c) {
+        int fd = connect_net(ALLOC_ADDRESS);
+        for (int i = 0; i < 30 && res == 0; ++i) { // Below the 100 requests a connection may serve
+            if (fd < 0 || alloc_exchange(fd, raw, 3) != 0) {
+                printf("test_allocs: exchange fail\n");
+                res = 2;
+            }
+        }
+        close_net(fd);
+    }
+    alloc_counting = 0;
+    if (res == 0 && alloc_count != 0) {
+        printf("test_allocs: %ld allocations in steady state\n", (long)alloc_count);
+        res = 3;
+    }
+    remove("test_alloc.html");
+    return res;
+}
+#else
+// Allocation counting needs glibc and the epoll server
+int test_allocs() {
+    return 0;
+}
+#endif
+
+#ifdef __linux__
+#define LOG_TEST_LINES 5000
+
+// Logging thread of the logger test
+static void* log_worker(void* arg) {
+    for (int i = 0; i < LOG_TEST_LINES; ++i) {
+        LOG_INFO("worker %d message %d", *(int*)arg, i);
+    }
+    LOG_DEBUG("below the minimum level");
+    return NULL;
+}
+
+// Run two logging threads and count the lines that reached the file
+static long log_round(char* name) {
+    int ids[2] = {1, 2};
+    pthread_t threads[2];
+    log_init(name, LOG_INFO);
+    for (int i = 0; i < 2; ++i) {
+        pthread_create(&threads[i], NULL, log_worker, &ids[i]);
+    }
+    for (int i = 0; i < 2; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    log_close();
+    FILE* file = fopen(name, "r");
+    char line[1024];
+    long lines = 0;
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        if (strstr(line, "] INFO: worker ") != NULL) {
+            lines += 1;
+        } else if (strstr(line, "[logger]") == NULL) {
+            lines = -1000000; // Unexpected content
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    remove(name);
+    return lines;
+}
+
+// Logging thread of the churn round, one line and exit
+static void* log_once_worker(void* arg) {
+    LOG_INFO("worker %d message 0", *(int*)arg);
+    return NULL;
+}
+
+// Lines of a log file that are complete so far
+static long log_count(char* name) {
+    FILE* file = fopen(name, "r");
+    char line[1024];
+    long lines = 0;
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        lines += 1;
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    return lines;
+}
+
+// Test that the blocking policy loses nothing and dropped messages are counted,
+// that an idle flush thread wakes for a message and rings of exited threads
+// are reused without losing lines
+int test_logger() {
+    log_config(LOG_BLOCK, 16);
+    long lines = log_round("test_log_block.txt");
+    if (lines != 2 * LOG_TEST_LINES) {
+        printf("test_logger: block policy wrote %ld lines\n", lines);
+        return 1;
+    }
+    unsigned long before = log_dropped();
+    log_config(LOG_DROP, 8);
+    lines = log_round("test_log_drop.txt");
+    log_config(LOG_DROP, 1024);
+    if (lines < 0 || (unsigned long)lines + (log_dropped() - before) != 2 * LOG_TEST_LINES) {
+        printf("test_logger: drop policy wrote %ld lines, dropped %lu\n", lines, log_dropped() - before);
+        return 2;
+    }
+    char* name = "test_log_idle.txt";
+    log_init(name, LOG_INFO);
+    usleep(20000); // The flush thread is asleep by now
+    LOG_INFO("after idle");
+    long seen = 0;
+    for (int i = 0; i < 200 && seen == 0; ++i) {
+        usleep(5000);
+        seen = log_count(name);
+    }
+    if (seen != 1) {
+        printf("test_logger: idle flush thread did not wake\n");
+        log_close();
+        remove(name);
+        return 3;
+    }
+    for (int i = 0; i < 200; ++i) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, log_once_worker, &i);
+        pthread_join(thread, NULL);
+    }
+    log_close();
+    seen = log_count(name);
+    remove(name);
+    if (seen != 201) {
+        printf("test_logger: thread churn wrote %ld lines\n", seen);
+        return 4;
+    }
+    return 0;
+}
+#else
+// The logger test needs POSIX threads
+int test_logger() {
+    return 0;
+}
+#endif
+
 // Dummy handler for routing test
 static int called = 0;
 void fake_handler(int conn, HTTPrequests *req) { (void)conn; (void)req; called = 1; }
 
+// Test that the cached Date string matches the current second in HTTP format
+int test_clock() {
+    char date[CLOCK_DATE];
+    char stamp[CLOCK_STAMP];
+    int64_t sec = now_clock();
+    if (date_clock(date) != 29 || stamp_clock(stamp) != 19) {
+        printf("test_clock: wrong lengths '%s' '%s'\n", date, stamp);
+        return 1;
+    }
+    // The second may have changed between the two calls
+    for (int64_t t = sec; t <= sec + 1; ++t) {
+        char expect[CLOCK_DATE];
+        time_t now = (time_t)t;
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(expect, sizeof(expect), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if (strcmp(date, expect) == 0) {
+            return 0;
+        }
+    }
+    printf("test_clock: unexpected date '%s'\n", date);
+    return 2;
+}
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Test a response mixing copied, static and file segments on a blocking socket
+int test_response() {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        return 1;
+    }
+    write_file("test_response.txt", "xx!!yy");
+    int file = open("test_response.txt", O_RDONLY);
+    char data[] = "hello ";
+    HTTPresponse* res = start_response(sv[0], 500, "Error");
+    header_response(res, "Content-Type", "text/plain");
+    data_response(res, data, 6);
+    static_response(res, "world", 5);
+    range_response(res, file, 2, 2);
+    status_response(res, 200, "OK");
+    end_response(res);
+    close(sv[0]);
+    char buf[512];
+    size_t len = 0;
+    int n;
+    while ((n = recv_net(sv[1], buf + len, sizeof(buf) - 1 - len)) > 0) {
+        len += n;
+    }
+    buf[len] = '\0';
+    close(sv[1]);
+    remove("test_response.txt");
+    if (strncmp(buf, "HTTP/1.1 200 OK\r\nDate: ", 23) != 0 ||
+        strstr(buf, " GMT\r\nContent-Type: text/plain\r\nContent-Length: 13\r\nConnection: close\r\n\r\n") == NULL) {
+        printf("test_response: bad head '%s'\n", buf);
+        return 2;
+    }
+    if (len < 13 || strcmp(buf + len - 13, "hello world!!") != 0) {
+        printf("test_response: bad body '%s'\n", buf);
+        return 3;
+    }
+    return 0;
+}
+#else
+// The response test uses a socket pair
+int test_response() {
+    return 0;
+}
+#endif
+
+#if defined(__linux__) && !defined(HTTP_NO_URING)
+#define URING_ADDRESS "127.0.0.1:18092"
+#define URING_FILE    200000 // Larger than one bounce buffer read
+
+// Server for the io_uring test, runs until the process exits
+static void* uring_server(void* arg) {
+    listen_http((HTTP*)arg);
+    return NULL;
+}
+
+// Handler answering with its route parameter
+static void uring_item(int conn, HTTPrequests *req) {
+    HTTPview id = param_request(req, "id");
+    HTTPresponse* res = start_response(conn, 200, "OK");
+    data_response(res, id.ptr, id.len);
+    end_response(res);
+}
+
+// Handler streaming an uncached file
+static void uring_file(int conn, HTTPrequests *req) {
+    (void)req;
+    htmlparse_http(conn, "test_uring.html");
+}
+
+// Test the io_uring backend: pipelined requests, a file sent through the
+// bounce buffer and the close linked to the last response
+int test_uring() {
+    HTTP* server = new_http(URING_ADDRESS);
+    if (backend_http(server, HTTP_URING) != 0) {
+        printf("test_uring: io_uring unavailable, skipped\n");
+        freehttp(server);
+        return 0;
+    }
+    char* text = (char*)malloc(URING_FILE + 1);
+    for (int i = 0; i < URING_FILE; ++i) {
+        text[i] = 'a' + i % 26;
+    }
+    text[URING_FILE] = '\0';
+    write_file("test_uring.html", text);
+    workers_http(server, 1);
+    cache_http(server, 0);
+    handle_http(server, "/item/:id", uring_item);
+    handle_http(server, "/file", uring_file);
+    pthread_t thread;
+    pthread_create(&thread, NULL, uring_server, server);
+    pthread_detach(thread);
+    int fd = -1;
+    for (int i = 0; i < 200 && fd < 0; ++i) {
+        fd = connect_net(URING_ADDRESS);
+        if (fd < 0) {
+            usleep(10000);
+        }
+    }
+    char* raw = "GET /item/7 HTTP/1.1\r\nHost: a\r\n\r\n"
+                "GET /file HTTP/1.1\r\nHost: a\r\n\r\n"
+                "GET /item/42 HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n";
+    size_t cap = URING_FILE + 4096;
+    char* buf = (char*)malloc(cap);
+    size_t len = 0;
+    int res = 0;
+    if (fd < 0 || send_net(fd, raw, strlen(raw)) < 0) {
+        printf("test_uring: connect fail\n");
+        res = 1;
+    }
+    // The server closes after the last response, so read until EOF
+    while (res == 0 && len < cap) {
+        int n = recv_net(fd, buf + len, cap - len);
+        if (n < 0) {
+            printf("test_uring: recv fail\n");
+            res = 2;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    int seen = 0;
+    for (char* p = buf; (p = memmem(p, len - (p - buf), "HTTP/1.1 200", 12)) != NULL; ++p) {
+        seen += 1;
+    }
+    char* body = memmem(buf, len, "\r\n\r\nabc", 7);
+    if (res == 0 && (seen != 3 || body == NULL || memmem(buf, len, "\r\n\r\n7", 5) == NULL)) {
+        printf("test_uring: got %d responses in %zu bytes\n", seen, len);
+        res = 3;
+    }
+    if (res == 0 && (len - (body + 4 - buf) < URING_FILE || memcmp(body + 4, text, URING_FILE) != 0)) {
+        printf("test_uring: file body corrupted\n");
+        res = 4;
+    }
+    if (res == 0 && (len < 2 || memcmp(buf + len - 2, "42", 2) != 0)) {
+        printf("test_uring: last response missing\n");
+        res = 5;
+    }
+    uint64_t requests, calls;
+    stats_http(server, &requests, &calls);
+    if (res == 0 && (requests < 3 || calls == 0)) {
+        printf("test_uring: stats %llu requests %llu calls\n", (unsigned long long)requests, (unsigned long long)calls);
+        res = 6;
+    }
+    close_net(fd);
+    free(buf);
+    free(text);
+    remove("test_uring.html");
+    return res;
+}
+#else
+// The io_uring backend is Linux only
+int test_uring() {
+    return 0;
+}
+#endif
+
+// Test the setings.yaml loader: nesting, comments, quoting, units, routes
+int test_config() {
+    write_file("test_config.yaml",
+        "# comment line\n"
+        "server:\n"
+        "  network:\n"
+        "    host: \"10.0.0.1\"   # trailing comment\n"
+        "    port: 9090\n"
+        "    backlog: 511\n"
+        "  performance:\n"
+        "    buffer_size: 16KB\n"
+        "    cache_size: \"2MB\"\n"
+        "    backend: io_uring\n"
+        "    unknown_key: 7\n"
+        "  http:\n"
+        "    keep_alive: false\n"
+        "    server_header: \"a#b\"\n"
+        "  logging:\n"
+        "    level: \"warning\"\n"
+        "routes:\n"
+        "  - path: \"/x\"\n"
+        "    handler: \"x_handler\"\n"
+        "    methods: [\"GET\", \"HEAD\"]\n"
+        "  - path: /y\n"
+        "    handler: y_handler\n"
+        "development:\n"
+        "  debug: false\n");
+    Config config;
+    default_config(&config);
+    int res = 0;
+    if (load_config(&config, "test_config.yaml") != 0) {
+        printf("test_config: valid file rejected\n");
+        res = 1;
+    } else if (strcmp(config.host, "10.0.0.1") != 0 || config.port != 9090 || config.backlog != 511) {
+        printf("test_config: network section wrong\n");
+        res = 2;
+    } else if (config.buffer_size != 16384 || config.cache_size != (2 << 20) || config.backend != HTTP_URING) {
+        printf("test_config: performance section wrong\n");
+        res = 3;
+    } else if (config.keep_alive != 0 || strcmp(config.server_header, "a#b") != 0 || config.log_level != LOG_WARN) {
+        printf("test_config: http or logging section wrong\n");
+        res = 4;
+    } else if (config.max_keep_alive_requests != 100 || config.timeout != 30) {
+        printf("test_config: defaults of missing keys lost\n");
+        res = 5;
+    } else if (config.nroutes != 2 || strcmp(config.routes[0].path, "/x") != 0
+        || strcmp(config.routes[1].handler, "y_handler") != 0) {
+        printf("test_config: routes wrong\n");
+        res = 6;
+    }
+    write_file("test_config.yaml", "server:\n  network:\n    port: eighty\n");
+    if (res == 0 && load_config(&config, "test_config.yaml") != 2) {
+        printf("test_config: invalid value accepted\n");
+        res = 7;
+    }
+    if (res == 0 && load_config(&config, "test_config_missing.yaml") != 1) {
+        printf("test_config: missing file not reported\n");
+        res = 8;
+    }
+    remove("test_config.yaml");
+    return res;
+}
+
+#define WHEEL_TIMERS 200000
+
+// Test the timer wheel: timers across every level fire no earlier than their
+// deadline and within a tick after it; cancelled and re-armed ones do not fire
+// at their old deadline
+int test_wheel() {
+    Timer* timers = (Timer*)malloc(WHEEL_TIMERS * sizeof(Timer));
+    int64_t* deadlines = (int64_t*)malloc(WHEEL_TIMERS * sizeof(int64_t));
+    int64_t now = 1000;
+    Wheel* wheel = new_wheel(now);
+    srand(7);
+    for (int i = 0; i < WHEEL_TIMERS; ++i) {
+        init_timer(&timers[i]);
+        // Spread over 1 ms .. about 73 minutes so all four levels are used
+        int64_t delay = 1 + ((int64_t)rand() * 4096 + rand() % 4096) % ((int64_t)1 << 22);
+        deadlines[i] = now + delay;
+        add_wheel(wheel, &timers[i], deadlines[i]);
+    }
+    for (int i = 0; i < WHEEL_TIMERS; i += 10) {
+        del_wheel(wheel, &timers[i]); // Cancelled
+        deadlines[i] = -1;
+    }
+    for (int i = 5; i < WHEEL_TIMERS; i += 10) {
+        deadlines[i] += 777; // Re-armed later
+        add_wheel(wheel, &timers[i], deadlines[i]);
+    }
+    size_t armed = count_wheel(wheel);
+    size_t fired = 0;
+    int res = armed == WHEEL_TIMERS - WHEEL_TIMERS / 10 ? 0 : 1;
+    while (res == 0 && count_wheel(wheel) > 0) {
+        int wait = wait_wheel(wheel, now);
+        if (wait < 0) {
+            res = 2;
+            break;
+        }
+        now += wait > 0 ? wait : 1;
+        for (Timer* timer = expire_wheel(wheel, now); timer != NULL; timer = timer->next) {
+            size_t i = (size_t)(timer - timers);
+            fired += 1;
+            if (deadlines[i] < 0 || deadlines[i] > now || now - deadlines[i] >= 2 * WHEEL_TICK) {
+                printf("test_wheel: timer %zu due %lld fired at %lld\n", i, (long long)deadlines[i], (long long)now);
+                res = 3;
+                break;
+            }
+            deadlines[i] = -1;
+        }
+    }
+    if (res == 0 && fired != armed) {
+        printf("test_wheel: %zu of %zu timers fired\n", fired, armed);
+        res = 4;
+    } else if (res == 1 || res == 2) {
+        printf("test_wheel: bookkeeping wrong (%d)\n", res);
+    }
+    free_wheel(wheel);
+    free(deadlines);
+    free(timers);
+    return res;
+}
+
+// Test that histogram buckets keep values to within 1/HIST_SUB and that
+// powers of two are exact bucket edges
+int test_histogram() {
+    Histogram* hist = (Histogram*)calloc(1, sizeof(Histogram));
+    for (uint64_t v = 1; v <= 100000; ++v) {
+        record_histogram(hist, v);
+    }
+    uint64_t counts[HIST_BUCKETS] = {0};
+    uint64_t sum = 0;
+    merge_histogram(counts, &sum, hist);
+    int res = 0;
+    for (uint64_t v = 1; v < (1 << 20) && res == 0; v += v / 7 + 1) {
+        if (bucket_histogram(v) < bucket_histogram(v - 1) || bucket_histogram(v) >= HIST_BUCKETS) {
+            printf("test_histogram: bucket of %llu out of order\n", (unsigned long long)v);
+            res = 1;
+        }
+    }
+    if (res == 0 && (sum != 5000050000ULL || below_histogram(counts, 10) != 1023 || below_histogram(counts, 2) != 3)) {
+        printf("test_histogram: sum or counts below a power of two wrong\n");
+        res = 2;
+    }
+    double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+    for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]) && res == 0; ++i) {
+        double want = qs[i] * 100000;
+        double got = (double)quantile_histogram(counts, qs[i]);
+        if (got < want || got > want * (1 + 1.0 / HIST_SUB)) {
+            printf("test_histogram: quantile %g is %.0f, want about %.0f\n", qs[i], got, want);
+            res = 3;
+        }
+    }
+    if (res == 0 && bucket_histogram(UINT64_MAX) != HIST_BUCKETS - 1) {
+        printf("test_histogram: huge value not clamped\n");
+        res = 4;
+    }
+    free(hist);
+    return res;
+}
+
+#ifdef __linux__
+#define TIMEOUT_ADDRESS "127.0.0.1:18094"
+
+// Server for the timeout test, runs until the process exits
+static void* timeout_server(void* arg) {
+    listen_http((HTTP*)arg);
+    return NULL;
+}
+
+// Handler of the timeout test
+static void timeout_page(int conn, HTTPrequests *req) {
+    (void)req;
+    HTTPresponse* res = start_response(conn, 200, "OK");
+    static_response(res, "ok", 2);
+    end_response(res);
+}
+
+// Monotonic time in milliseconds
+static int64_t test_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Milliseconds until the server closes the connection after raw was sent
+// With trickle, a header line follows every 250 ms. -1 on error
+static int64_t timeout_close(char* raw, int8_t trickle) {
+    int fd = connect_net(TIMEOUT_ADDRESS);
+    if (fd < 0 || send_net(fd, raw, strlen(raw)) < 0 || nonblock_net(fd) != 0) {
+        return -1;
+    }
+    int64_t start = test_ms();
+    char buf[256];
+    while (test_ms() - start < 5000) {
+        usleep(trickle ? 250000 : 10000);
+        if (trickle && send_net(fd, "X-Slow: 1\r\n", 11) < 0) {
+            break; // Reset by the server
+        }
+        int n = recv_net(fd, buf, sizeof(buf));
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            break;
+        }
+    }
+    int64_t took = test_ms() - start;
+    close_net(fd);
+    return took;
+}
+
+// Test that a head trickling in past the request timeout is dropped, while
+// idle keep-alive connections get their own, longer timeout
+int test_timeouts() {
+    HTTP* server = new_http(TIMEOUT_ADDRESS);
+    workers_http(server, 1);
+    keepalive_http(server, 2, 100);
+    timeout_http(server, 1);
+    handle_http(server, "/", timeout_page);
+    pthread_t thread;
+    pthread_create(&thread, NULL, timeout_server, server);
+    pthread_detach(thread);
+    int fd = -1;
+    for (int i = 0; i < 200 && fd < 0; ++i) {
+        fd = connect_net(TIMEOUT_ADDRESS);
+        if (fd < 0) {
+            usleep(10000);
+        }
+    }
+    close_net(fd);
+    int res = 0;
+    int64_t head = timeout_close("GET / HTTP/1.1\r\nHost: a\r\n", 1);
+    if (head < 900 || head > 1500) {
+        printf("test_timeouts: partial head closed after %lld ms\n", (long long)head);
+        res = 1;
+    }
+    int64_t idle = timeout_close("GET / HTTP/1.1\r\nHost: a\r\n\r\n", 0);
+    if (res == 0 && (idle < 1900 || idle > 2500)) {
+        printf("test_timeouts: idle connection closed after %lld ms\n", (long long)idle);
+        res = 2;
+    }
+    return res;
+}
+#else
+// The timeout test needs the epoll server
+int test_timeouts() {
+    return 0;
+}
+#endif
+
+#ifdef __linux__
+#define ADMISSION_ADDRESS "127.0.0.1:18095"
+#define ADMISSION_SLOW    20 // Ms each request of the overload test takes
+
+// Handler of the overload test, slow enough to build a queue
+static void admission_page(int conn, HTTPrequests *req) {
+    (void)req;
+    usleep(ADMISSION_SLOW * 1000);
+    HTTPresponse* res = start_response(conn, 200, "OK");
+    static_response(res, "ok", 2);
+    end_response(res);
+}
+
+// Read from a non-blocking socket until count responses arrived or wait ms
+// passed, returns the bytes read into buf (NUL-terminated)
+static size_t admission_read(int fd, char* buf, size_t size, int count, int wait) {
+    size_t len = 0;
+    int64_t start = test_ms();
+    buf[0] = '\0';
+    while (test_ms() - start < wait) {
+        int n = recv_net(fd, buf + len, size - len - 1);
+        if (n > 0) {
+            len += n;
+            buf[len] = '\0';
+            int seen = 0;
+            for (char* p = strstr(buf, "HTTP/1.1 "); p != NULL; p = strstr(p + 1, "HTTP/1.1 ")) {
+                seen += 1;
+            }
+            if (seen >= count) {
+                break;
+            }
+            continue;
+        }
+        if (n == 0) {
+            break;
+        }
+        usleep(5000);
+    }
+    return len;
+}
+
+// Test that a worker at its connection limit leaves new clients in the
+// backlog until one closes, and that requests queueing past the latency
+// target are shed with a 503 carrying Retry-After
+int test_admission() {
+    HTTP* server = new_http(ADMISSION_ADDRESS);
+    workers_http(server, 1);
+    connections_http(server, 2);
+    overload_http(server, 5, 7);
+    handle_http(server, "/", admission_page);
+    pthread_t thread;
+    pthread_create(&thread, NULL, timeout_server, server);
+    pthread_detach(thread);
+    int fds[3] = { -1, -1, -1 };
+    for (int i = 0; i < 200 && fds[0] < 0; ++i) {
+        fds[0] = connect_net(ADMISSION_ADDRESS);
+        if (fds[0] < 0) {
+            usleep(10000);
+        }
+    }
+    char buf[16384];
+    char* get = "GET / HTTP/1.1\r\nHost: a\r\n\r\n";
+    int res = 0;
+    for (int i = 0; i < 3; ++i) {
+        if (i > 0) {
+            fds[i] = connect_net(ADMISSION_ADDRESS); // The third waits in the backlog
+        }
+        if (fds[i] < 0 || nonblock_net(fds[i]) != 0 || send_net(fds[i], get, strlen(get)) < 0) {
+            printf("test_admission: connection %d failed\n", i);
+            res = 1;
+            break;
+        }
+        admission_read(fds[i], buf, sizeof(buf), 1, i < 2 ? 1000 : 300);
+        if ((i < 2) != (strstr(buf, "200 OK") != NULL)) {
+            printf("test_admission: connection %d %s\n", i, i < 2 ? "not served" : "served over the limit");
+            res = 2;
+            break;
+        }
+    }
+    if (res == 0) {
+        close_net(fds[0]);
+        fds[0] = -1;
+        admission_read(fds[2], buf, sizeof(buf), 1, 1000);
+        if (strstr(buf, "200 OK") == NULL) {
+            printf("test_admission: waiting connection not served after a close\n");
+            res = 3;
+        }
+    }
+    // Ten slow pipelined requests queue up to 180 ms: the first round is
+    // served whole, the limit then drops and most of the second round is shed
+    char pipeline[512] = "";
+    for (int i = 0; i < 10; ++i) {
+        strcat(pipeline, get);
+    }
+    int shed = 0;
+    for (int round = 0; round < 2 && res == 0; ++round) {
+        send_net(fds[2], pipeline, strlen(pipeline));
+        admission_read(fds[2], buf, sizeof(buf), 10, 3000);
+        for (char* p = strstr(buf, " 503 "); p != NULL; p = strstr(p + 1, " 503 ")) {
+            shed += 1;
+        }
+        if (round == 0 && shed > 0) {
+            printf("test_admission: requests shed without a queue\n");
+            res = 4;
+        }
+    }
+    if (res == 0 && (shed == 0 || shed == 10 || strstr(buf, "Retry-After: 7\r\n") == NULL)) {
+        printf("test_admission: %d of 10 queued requests shed\n", shed);
+        res = 5;
+    }
+    uint64_t admitted = 0;
+    uint64_t counted = 0;
+    for (int i = 0; i < 100 && res == 0 && counted != (uint64_t)shed; ++i) {
+        usleep(10000); // Counters are published once per loop iteration
+        admission_http(server, &admitted, &counted);
+    }
+    if (res == 0 && (counted != (uint64_t)shed || admitted != 23 - (uint64_t)shed)) {
+        printf("test_admission: counters say %llu admitted, %llu shed\n",
+            (unsigned long long)admitted, (unsigned long long)counted);
+        res = 6;
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (fds[i] >= 0) {
+            close_net(fds[i]);
+        }
+    }
+    return res;
+}
+
+#define METRICS_ADDRESS "127.0.0.1:18096"
+
+// Handlers of the metrics test
+static void metrics_page(int conn, HTTPrequests *req) {
+    (void)req;
+    metrics_http(conn);
+}
+
+static void metrics_status(int conn, HTTPrequests *req) {
+    (void)req;
+    status_http(conn);
+}
+
+// Test that requests are counted per route and status class and show up,
+// with their latency histograms, in the Prometheus and JSON exports
+int test_metrics() {
+    HTTP* server = new_http(METRICS_ADDRESS);
+    workers_http(server, 2);
+    handle_http(server, "/a", timeout_page);
+    handle_http(server, "/metrics", metrics_page);
+    handle_http(server, "/status", metrics_status);
+    pthread_t thread;
+    pthread_create(&thread, NULL, timeout_server, server);
+    pthread_detach(thread);
+    int fd = -1;
+    for (int i = 0; i < 200 && fd < 0; ++i) {
+        fd = connect_net(METRICS_ADDRESS);
+        if (fd < 0) {
+            usleep(10000);
+        }
+    }
+    static char buf[1 << 17];
+    char* raw = "GET /a HTTP/1.1\r\nHost: a\r\n\r\nGET /a HTTP/1.1\r\nHost: a\r\n\r\n"
+        "GET /a HTTP/1.1\r\nHost: a\r\n\r\nGET /b HTTP/1.1\r\nHost: a\r\n\r\n"
+        "GET /metrics HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n";
+    if (fd < 0 || nonblock_net(fd) != 0 || send_net(fd, raw, strlen(raw)) < 0) {
+        printf("test_metrics: server unreachable\n");
+        return 1;
+    }
+    admission_read(fd, buf, sizeof(buf), 99, 3000); // Until the close
+    close_net(fd);
+    // A route added while serving gets its own metrics slot
+    handle_http(server, "/late", timeout_page);
+    fd = connect_net(METRICS_ADDRESS);
+    raw = "GET /late HTTP/1.1\r\nHost: a\r\n\r\nGET /metrics HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n";
+    if (fd < 0 || nonblock_net(fd) != 0 || send_net(fd, raw, strlen(raw)) < 0) {
+        printf("test_metrics: server unreachable\n");
+        return 1;
+    }
+    admission_read(fd, buf, sizeof(buf), 99, 3000);
+    close_net(fd);
+    char* want[] = {
+        "Content-Type: text/plain; version=0.0.4\r\n",
+        "proda_requests_total{route=\"/a\",code=\"2xx\"} 3\n",
+        "proda_requests_total{route=\"unmatched\",code=\"4xx\"} 1\n",
+        "proda_request_duration_seconds_count{route=\"/a\",phase=\"handler\"} 3\n",
+        "proda_request_duration_seconds_bucket{route=\"/a\",phase=\"parse\",le=\"+Inf\"} 3\n",
+        "# TYPE proda_request_duration_seconds histogram\n",
+        "proda_requests_total{route=\"/late\",code=\"2xx\"} 1\n",
+    };
+    int res = 0;
+    for (size_t i = 0; i < sizeof(want) / sizeof(want[0]) && res == 0; ++i) {
+        if (strstr(buf, want[i]) == NULL) {
+            printf("test_metrics: export lacks %s", want[i]);
+            res = 2;
+        }
+    }
+    fd = connect_net(METRICS_ADDRESS);
+    raw = "GET /status HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n";
+    if (res == 0 && (fd < 0 || nonblock_net(fd) != 0 || send_net(fd, raw, strlen(raw)) < 0)) {
+        res = 3;
+    }
+    if (res == 0) {
+        admission_read(fd, buf, sizeof(buf), 99, 3000);
+        if (strstr(buf, "\"requests\":7,") == NULL || strstr(buf, "\"handler\":{\"p50\":") == NULL) {
+            printf("test_metrics: status wrong: %s\n", buf);
+            res = 4;
+        }
+    }
+    if (fd >= 0) {
+        close_net(fd);
+    }
+    return res;
+}
+
+#define HEAD_ADDRESS "127.0.0.1:18097"
+
+// Handler serving a cached static file for the HEAD test
+static void head_file(int conn, HTTPrequests *req) {
+    (void)req;
+    htmlparse_http(conn, "test_head.html");
+}
+
+// Test that HEAD on a cached file sends its headers without the body, so
+// the next pipelined response starts where the client expects it
+int test_head() {
+    write_file("test_head.html", "<p>head</p>");
+    HTTP* server = new_http(HEAD_ADDRESS);
+    workers_http(server, 1);
+    handle_http(server, "/file", head_file);
+    pthread_t thread;
+    pthread_create(&thread, NULL, timeout_server, server);
+    pthread_detach(thread);
+    int fd = -1;
+    for (int i = 0; i < 200 && fd < 0; ++i) {
+        fd = connect_net(HEAD_ADDRESS);
+        if (fd < 0) {
+            usleep(10000);
+        }
+    }
+    // The first GET loads the file into the cache, HEAD and GET then hit it
+    char* raw = "GET /file HTTP/1.1\r\nHost: a\r\n\r\nHEAD /file HTTP/1.1\r\nHost: a\r\n\r\n"
+        "GET /file HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n";
+    char buf[4096];
+    int res = 0;
+    if (fd < 0 || nonblock_net(fd) != 0 || send_net(fd, raw, strlen(raw)) < 0) {
+        printf("test_head: server unreachable\n");
+        res = 1;
+    }
+    if (res == 0) {
+        size_t len = admission_read(fd, buf, sizeof(buf), 99, 3000); // Until the close
+        char* head = strstr(buf, "HTTP/1.1 200");
+        head = head != NULL ? strstr(head + 1, "HTTP/1.1 200") : NULL;
+        char* next = head != NULL ? strstr(head, "\r\n\r\n") : NULL;
+        if (next == NULL || strstr(head, "Content-Length: 11\r\n") == NULL || strncmp(next + 4, "HTTP/1.1 200", 12) != 0
+                || len < 11 || strcmp(buf + len - 11, "<p>head</p>") != 0) {
+            printf("test_head: responses wrong: %s\n", buf);
+            res = 2;
+        }
+    }
+    if (fd >= 0) {
+        close_net(fd);
+    }
+    remove("test_head.html");
+    return res;
+}
+
+#define STARVE_ADDRESS "127.0.0.1:18098"
+#define STARVE_PORT    18098
+#define STARVE_CLIENTS 3
+#define STARVE_FILL    256
+
+// Test that a worker out of descriptors closes waiting clients rather than
+// leaving them in the backlog, and serves again once descriptors are freed
+int test_starve() {
+    HTTP* server = new_http(STARVE_ADDRESS);
+    workers_http(server, 1);
+    handle_http(server, "/", timeout_page);
+    pthread_t thread;
+    pthread_create(&thread, NULL, timeout_server, server);
+    pthread_detach(thread);
+    int fd = -1;
+    for (int i = 0; i < 200 && fd < 0; ++i) {
+        fd = connect_net(STARVE_ADDRESS);
+        if (fd < 0) {
+            usleep(10000);
+        }
+    }
+    if (fd < 0) {
+        printf("test_starve: server unreachable\n");
+        return 1;
+    }
+    close_net(fd);
+    // Client sockets first, then every descriptor left under a lowered limit
+    int clients[STARVE_CLIENTS];
+    for (int i = 0; i < STARVE_CLIENTS; ++i) {
+        clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+    }
+    struct rlimit old;
+    getrlimit(RLIMIT_NOFILE, &old);
+    struct rlimit low = old;
+    int probe = open("/dev/null", O_RDONLY);
+    close(probe);
+    low.rlim_cur = (rlim_t)probe + STARVE_FILL / 2;
+    setrlimit(RLIMIT_NOFILE, &low);
+    int fill[STARVE_FILL];
+    int filled = 0;
+    while (filled < STARVE_FILL && (fill[filled] = open("/dev/null", O_RDONLY)) >= 0) {
+        filled += 1;
+    }
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(STARVE_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int res = 0;
+    for (int i = 0; i < STARVE_CLIENTS && res == 0; ++i) {
+        if (connect(clients[i], (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            printf("test_starve: connect failed\n");
+            res = 2;
+            break;
+        }
+        // The server has no descriptor for the client and closes it
+        struct pollfd pfd = { .fd = clients[i], .events = POLLIN };
+        char byte;
+        if (poll(&pfd, 1, 2000) != 1 || recv(clients[i], &byte, 1, 0) > 0) {
+            printf("test_starve: client %d left waiting\n", i);
+            res = 3;
+        }
+    }
+    for (int i = 0; i < filled; ++i) {
+        close(fill[i]);
+    }
+    setrlimit(RLIMIT_NOFILE, &old);
+    for (int i = 0; i < STARVE_CLIENTS; ++i) {
+        close(clients[i]);
+    }
+    fd = connect_net(STARVE_ADDRESS);
+    char* raw = "GET / HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n";
+    char buf[1024];
+    if (res == 0 && (fd < 0 || nonblock_net(fd) != 0 || send_net(fd, raw, strlen(raw)) < 0)) {
+        printf("test_starve: server unreachable after the descriptors were freed\n");
+        res = 4;
+    }
+    if (res == 0 && (admission_read(fd, buf, sizeof(buf), 1, 3000) == 0 || strncmp(buf, "HTTP/1.1 200", 12) != 0)) {
+        printf("test_starve: no response after the descriptors were freed\n");
+        res = 5;
+    }
+    if (fd >= 0) {
+        close_net(fd);
+    }
+    return res;
+}
+#else
+// The admission, metrics, HEAD and descriptor tests need the epoll server
+int test_admission() {
+    return 0;
+}
+
+int test_head() {
+    return 0;
+}
+
+int test_starve() {
+    return 0;
+}
+
+int test_metrics() {
+    return 0;
+}
+#endif
+
+// Object of the epoch test, counts its destruction
+static int epoch_freed = 0;
+static void epoch_destroy(void* ptr) {
+    (void)ptr;
+    epoch_freed += 1;
+}
+
+// Test that a retired object outlives the read sections that may hold it
+// and is destroyed by the first reclaim after they end
+int test_epoch() {
+    Epoch* epoch = new_epoch();
+    EpochReader* reader = reader_epoch(epoch);
+    int res = 0;
+    epoch_freed = 0;
+    if (reader_epoch(epoch) != reader) {
+        printf("test_epoch: thread got a second reader record\n");
+        res = 1;
+    }
+    enter_epoch(epoch, reader);
+    retire_epoch(epoch, &epoch_freed, epoch_destroy);
+    if (res == 0 && (reclaim_epoch(epoch) != 1 || epoch_freed != 0)) {
+        printf("test_epoch: object freed under a reader\n");
+        res = 2;
+    }
+    leave_epoch(reader);
+    // Sections entered after the retirement do not hold the object back
+    enter_epoch(epoch, reader);
+    if (res == 0 && (reclaim_epoch(epoch) != 0 || epoch_freed != 1)) {
+        printf("test_epoch: object kept after its readers left\n");
+        res = 3;
+    }
+    leave_epoch(reader);
+    retire_epoch(epoch, &epoch_freed, epoch_destroy);
+    free_epoch(epoch);
+    if (res == 0 && epoch_freed != 2) {
+        printf("test_epoch: free_epoch left a retired object\n");
+        res = 4;
+    }
+    return res;
+}
+
+#ifdef __linux__
+#define HOTSWAP_CHANGES 2000
+#define HOTSWAP_READERS 3
+
+// Shared state of the hot swap test
+static HTTP* hotswap_server = NULL;
+static _Atomic int hotswap_stop = 0;
+static _Atomic long hotswap_calls = 0;
+static _Atomic long hotswap_bad = 0;
+
+// Handlers the writer alternates between, both check the parameter
+static void hotswap_first(int conn, HTTPrequests *req) {
+    (void)conn;
+    hotswap_calls += 1;
+    hotswap_bad += !equal_view(param_request(req, "id"), "42");
+}
+
+static void hotswap_second(int conn, HTTPrequests *req) {
+    (void)conn;
+    hotswap_calls += 1;
+    hotswap_bad += !equal_view(param_request(req, "id"), "42");
+}
+
+// Reader thread: looks the route up until the writer is done
+static void* hotswap_reader(void* arg) {
+    (void)arg;
+    char path[] = "/items/42";
+    while (!hotswap_stop) {
+        HTTPrequests req;
+        reset_request(&req, NULL);
+        req.path = (HTTPview){path, strlen(path)};
+        switch_http(hotswap_server, -1, &req);
+    }
+    return NULL;
+}
+
+// Test replacing, removing and adding routes while other threads look them
+// up: every lookup sees a whole table and parameters stay readable
+int test_hotswap() {
+    hotswap_server = new_http("127.0.0.1:0");
+    hotswap_stop = 0;
+    hotswap_calls = 0;
+    hotswap_bad = 0;
+    handle_http(hotswap_server, "/items/:id", hotswap_first);
+    pthread_t threads[HOTSWAP_READERS];
+    for (int i = 0; i < HOTSWAP_READERS; ++i) {
+        pthread_create(&threads[i], NULL, hotswap_reader, NULL);
+    }
+    char pattern[32];
+    int res = 0;
+    for (int i = 0; i < HOTSWAP_CHANGES; ++i) {
+        handle_http(hotswap_server, "/items/:id", i % 2 ? hotswap_first : hotswap_second);
+        snprintf(pattern, sizeof(pattern), "/other%d", i % 16);
+        if (i % 3 == 0) {
+            unhandle_http(hotswap_server, "/items/:id");
+            handle_http(hotswap_server, pattern, hotswap_first);
+        } else {
+            unhandle_http(hotswap_server, pattern);
+        }
+        if (i % 64 == 0) {
+            usleep(100); // Let the readers run between bursts of changes
+        }
+    }
+    hotswap_stop = 1;
+    for (int i = 0; i < HOTSWAP_READERS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    if (hotswap_calls == 0 || hotswap_bad != 0) {
+        printf("test_hotswap: %ld calls, %ld with a wrong parameter\n", (long)hotswap_calls, (long)hotswap_bad);
+        res = 1;
+    }
+    if (res == 0 && unhandle_http(hotswap_server, "/never") != -1) {
+        printf("test_hotswap: removed a route that was never added\n");
+        res = 2;
+    }
+    freehttp(hotswap_server);
+    return res;
+}
+#else
+// The hot swap test needs threads
+int test_hotswap() {
+    return 0;
+}
+#endif
+
 // Test HTTP routing logic
 int test_routing() {
     HTTP *server = new_http("127.0.0.1:8080");
     handle_http(server, "/test", fake_handler);
     HTTPrequests req = {0};
-    strcpy(req.path, "/test");
+    req.path = (HTTPview){"/test", 5};
     called = 0;
     int res =  switch_http(server, 0, &req);
     freehttp(server);
@@ -53,6 +1779,62 @@ int run_all_tests(void) {
     int fails = 0;
     printf("Running test_parse_request...\n");
     fails += test_parse_request();
+    printf("Running test_parse_partial...\n");
+    fails += test_parse_partial();
+    printf("Running test_parse_limits...\n");
+    fails += test_parse_limits();
+    printf("Running test_parse_framing...\n");
+    fails += test_parse_framing();
+    printf("Running test_parse_pipeline...\n");
+    fails += test_parse_pipeline();
+    printf("Running test_parse_views...\n");
+    fails += test_parse_views();
+    printf("Running test_parse_body...\n");
+    fails += test_parse_body();
+    printf("Running test_hashtab...\n");
+    fails += test_hashtab();
+    printf("Running test_strhash...\n");
+    fails += test_strhash();
+    printf("Running test_tree...\n");
+    fails += test_tree();
+    printf("Running test_intern...\n");
+    fails += test_intern();
+    printf("Running test_cache...\n");
+    fails += test_cache();
+    printf("Running test_arena...\n");
+    fails += test_arena();
+    printf("Running test_allocs...\n");
+    fails += test_allocs();
+    printf("Running test_logger...\n");
+    fails += test_logger();
+    printf("Running test_clock...\n");
+    fails += test_clock();
+    printf("Running test_response...\n");
+    fails += test_response();
+    printf("Running test_uring...\n");
+    fails += test_uring();
+    printf("Running test_config...\n");
+    fails += test_config();
+    printf("Running test_wheel...\n");
+    fails += test_wheel();
+    printf("Running test_timeouts...\n");
+    fails += test_timeouts();
+    printf("Running test_admission...\n");
+    fails += test_admission();
+    printf("Running test_histogram...\n");
+    fails += test_histogram();
+    printf("Running test_metrics...\n");
+    fails += test_metrics();
+    printf("Running test_head...\n");
+    fails += test_head();
+    printf("Running test_starve...\n");
+    fails += test_starve();
+    printf("Running test_router...\n");
+    fails += test_router();
+    printf("Running test_epoch...\n");
+    fails += test_epoch();
+    printf("Running test_hotswap...\n");
+    fails += test_hotswap();
     printf("Running test_routing...\n");
     fails += test_routing();
     if (fails == 0) printf("All tests passed!\n");
@@ -1,7 +1,10 @@
 /*
  * BORROWED CODE - Binary Search Tree Implementation
- * This file contains a generic binary search tree implementation
- * borrowed from external library code.
+ * The interface comes from external library code; the tree behind it is a
+ * red-black tree, so depth stays O(log n) for any insertion order. Insert,
+ * lookup and delete are iterative and nodes come from slabs owned by the tree.
+ * Short string keys and values are stored inside their node, longer keys
+ * may come from an interning table shared by several trees.
  */
 
 #include <stdio.h>
@@ -9,8 +12,16 @@
 #include <stdlib.h>
 
 #include "tree.h"
+#include "hash.h"
 #include "type.h"
 
+#define TREE_SLAB_MIN 16   // Nodes in the first slab of a tree
+#define TREE_SLAB_MAX 1024 // Slabs double in size up to this many nodes
+#define TREE_INLINE   24   // Bytes of a node buffer, strings shorter than this live in it
+
+#define TREE_RED   0
+#define TREE_BLACK 1
+
 // Tree node structure containing key-value pair and tree pointers
 typedef struct tree_node {
     struct {
@@ -18,11 +29,20 @@ typedef struct tree_node {
         value_t value;  // Value stored in the node
     } data;
     _Bool exist;        // Flag indicating if node contains valid data
+    uint8_t color;      // TREE_RED or TREE_BLACK
     struct tree_node *left;   // Pointer to left child
-    struct tree_node *right;  // Pointer to right child
+    struct tree_node *right;  // Pointer to right child, next free node in the pool
     struct tree_node *parent; // Pointer to parent node
+    char buffer[];      // TREE_INLINE bytes for a string key, then for a string value
 } tree_node;
 
+// Block of nodes handed out in order, freed together with the tree
+typedef struct tree_slab {
+    struct tree_slab *next; // Previously allocated slab
+    size_t size;            // Number of nodes in this slab
+    char nodes[];           // Nodes of Tree.stride bytes each
+} tree_slab;
+
 // Main tree structure containing type information and root node
 typedef struct Tree {
     struct {
@@ -31,32 +51,44 @@ typedef struct Tree {
     } type;
     size_t size;        // Number of nodes in the tree
     struct tree_node *node; // Root node of the tree
+    tree_slab *slabs;   // Newest slab first
+    size_t used;        // Nodes handed out from the newest slab
+    tree_node *free;    // Deleted nodes ready for reuse, linked through right
+    size_t stride;      // Bytes per node, buffers included
+    Intern *intern;     // Shared copies of long string keys, NULL if keys are owned
 } Tree;
 
 // Function prototypes for internal tree operations
-static tree_node *_new_node(vtype_t tkey, vtype_t tvalue, void *key, void *value);
-static void _set_tree(Tree *tree, tree_node *node, vtype_t tkey, vtype_t tvalue, void *key, void *value);
-static void _set_key(tree_node *node, vtype_t tkey, void *key);
-static void _set_value(tree_node *node, vtype_t tvalue, void *value);
-static void _free_tree(Tree *tree, tree_node *node);
-static void _free_key_tree(vtype_t type, tree_node *node);
-static void _free_value_tree(vtype_t type, tree_node *node);
-static void _print_tree(Tree *tree, tree_node *node, vtype_t tkey, vtype_t tvalue);
-static void _print_branches_tree(Tree *tree, tree_node *node, vtype_t tkey, vtype_t tvalue);
-static void _print_node_tree(Tree *tree, tree_node *node, vtype_t tkey, vtype_t tvalue);
+static int8_t _put_tree(Tree *tree, void *key, void *value);
+static tree_node *_new_node(Tree *tree, void *key, void *value);
+static void _put_node(Tree *tree, tree_node *node);
+static void _set_key(Tree *tree, tree_node *node, void *key);
+static void _set_value(Tree *tree, tree_node *node, void *value);
+static char *_value_buffer(Tree *tree, tree_node *node);
+static void _free_key_tree(Tree *tree, tree_node *node);
+static void _free_value_tree(Tree *tree, tree_node *node);
+static void _print_branches_tree(tree_node *node, vtype_t tkey, vtype_t tvalue);
+static void _print_node_tree(tree_node *node, vtype_t tkey, vtype_t tvalue);
 static tree_node *_get_tree(tree_node *node, vtype_t tkey, void *key);
 static int8_t _cmp_tkey_tree(tree_node *node, vtype_t tkey, void *key);
 static int8_t _cmp_int32(int32_t x, int32_t y);
-static tree_node *_del1_tree(Tree *tree, vtype_t tkey, void *key);
-static void _del2_tree(Tree *tree, tree_node *node);
-static void _del3_tree(Tree *tree, tree_node *node);
-static _Bool _eq_tree(vtype_t tkey, vtype_t tvalue, tree_node *x, tree_node *y);
+static tree_node *_min_tree(tree_node *node);
+static tree_node *_next_tree(tree_node *node);
+static void _rotate_left(Tree *tree, tree_node *node);
+static void _rotate_right(Tree *tree, tree_node *node);
+static void _insert_fixup(Tree *tree, tree_node *node);
+static void _delete_fixup(Tree *tree, tree_node *node, tree_node *parent);
+static void _replace_tree(Tree *tree, tree_node *node, tree_node *child);
+static _Bool _eq_node(vtype_t tkey, vtype_t tvalue, tree_node *x, tree_node *y);
+
+// Color of a node, missing leaves are black
+#define _color(node) ((node) == NULL ? TREE_BLACK : (node)->color)
 
 // Create a new tree with specified key and value types
 extern Tree *new_tree(vtype_t key, vtype_t value) {
     // Validate key type - only decimal and string types are supported
     switch(key){
-        case DECIMAL_TYPE: 
+        case DECIMAL_TYPE:
         case STRING_TYPE:
             break;
         default:
@@ -65,26 +97,55 @@ extern Tree *new_tree(vtype_t key, vtype_t value) {
     }
     // Validate value type - decimal, real, and string types are supported
     switch(value) {
-        case DECIMAL_TYPE: 
-        case REAL_TYPE: 
-        case STRING_TYPE: 
+        case DECIMAL_TYPE:
+        case REAL_TYPE:
+        case STRING_TYPE:
             break;
         default:
             fprintf(stderr, "%s\n", "value type not supported");
             return NULL;
     }
-    // Allocate and initialize new tree structure
+    // Allocate and initialize new tree structure, slabs come with the first insert
     Tree *tree = (Tree*)malloc(sizeof(Tree));
     tree->type.key = key;
     tree->type.value = value;
     tree->node = NULL;
     tree->size = 0;
+    tree->slabs = NULL;
+    tree->used = 0;
+    tree->free = NULL;
+    tree->intern = NULL;
+    // String types widen every node by a buffer, rounded to keep nodes aligned
+    size_t stride = sizeof(tree_node);
+    stride += key == STRING_TYPE ? TREE_INLINE : 0;
+    stride += value == STRING_TYPE ? TREE_INLINE : 0;
+    tree->stride = (stride + _Alignof(tree_node) - 1) / _Alignof(tree_node) * _Alignof(tree_node);
     return tree;
 }
 
+// Take long string keys from an interning table instead of copying them
+// The table must outlive the tree; only an empty tree can switch
+extern int8_t intern_tree(Tree *tree, Intern *intern) {
+    if (tree->type.key != STRING_TYPE || tree->size != 0) {
+        fprintf(stderr, "%s\n", "tree can not intern keys");
+        return 1;
+    }
+    tree->intern = intern;
+    return 0;
+}
+
 // Free all memory allocated for the tree
 extern void free_tree(Tree *tree) {
-    _free_tree(tree, tree->node);
+    // Owned strings are freed in order, the nodes go with their slabs
+    for (tree_node *node = _min_tree(tree->node); node != NULL; node = _next_tree(node)) {
+        _free_key_tree(tree, node);
+        _free_value_tree(tree, node);
+    }
+    while (tree->slabs != NULL) {
+        tree_slab *next = tree->slabs->next;
+        free(tree->slabs);
+        tree->slabs = next;
+    }
     free(tree);
 }
 
@@ -107,34 +168,98 @@ extern value_t get_tree(Tree *tree, void *key) {
 }
 
 // Set or update a key-value pair in the tree
+// A real value comes boxed from real() and the box is freed here
 extern int8_t set_tree(Tree *tree, void *key, void *value) {
-    if (tree->node == NULL) {
-        // Create root node if tree is empty
-        tree->node = _new_node(tree->type.key, tree->type.value, key, value);
-        tree->size += 1;
-        return 0;
+    int8_t rc = _put_tree(tree, key, value);
+    if (tree->type.value == REAL_TYPE) {
+        free(value);
     }
-    _set_tree(tree, tree->node, tree->type.key, tree->type.value, key, value);
+    return rc;
+}
+
+// Set or update a real value without boxing it
+extern int8_t set_real_tree(Tree *tree, void *key, double value) {
+    if (tree->type.value != REAL_TYPE) {
+        fprintf(stderr, "%s\n", "value type is not real");
+        return 1;
+    }
+    return _put_tree(tree, key, &value);
+}
+
+// Store a pair, a real value is read through a pointer it does not own
+static int8_t _put_tree(Tree *tree, void *key, void *value) {
+    tree_node *parent = NULL;
+    tree_node *node = tree->node;
+    int8_t cond = 0;
+    // Walk down to the key or to the empty place it belongs
+    while (node != NULL) {
+        cond = _cmp_tkey_tree(node, tree->type.key, key);
+        if (cond == 0) {
+            // Key already exists - update value
+            _set_value(tree, node, value);
+            return 0;
+        }
+        parent = node;
+        node = cond > 0 ? node->right : node->left;
+    }
+    node = _new_node(tree, key, value);
+    node->parent = parent;
+    if (parent == NULL) {
+        tree->node = node;
+    } else if (cond > 0) {
+        parent->right = node;
+    } else {
+        parent->left = node;
+    }
+    tree->size += 1;
+    _insert_fixup(tree, node);
     return 0;
 }
 
 // Delete a key-value pair from the tree
 extern void del_tree(Tree *tree, void *key) {
-    tree_node *node = _del1_tree(tree, tree->type.key, key);
+    tree_node *node = _get_tree(tree->node, tree->type.key, key);
     if (node == NULL) {
         return;
     }
-    if (node->left != NULL && node->right != NULL) {
-        // Node has two children - use successor replacement
-        _del3_tree(tree, node);
-        return;
+    // The deleted pair always gives up its strings
+    _free_key_tree(tree, node);
+    _free_value_tree(tree, node);
+    tree_node *child;
+    tree_node *parent;
+    uint8_t color = node->color;
+    if (node->left == NULL || node->right == NULL) {
+        child = node->left != NULL ? node->left : node->right;
+        parent = node->parent;
+        _replace_tree(tree, node, child);
+    } else {
+        // Node has two children - the successor node, which has no left
+        // child, is relinked in its place. Pairs never move between nodes,
+        // so inline strings stay where get_tree pointed
+        tree_node *next = _min_tree(node->right);
+        color = next->color;
+        child = next->right;
+        if (next->parent == node) {
+            parent = next;
+        } else {
+            parent = next->parent;
+            _replace_tree(tree, next, child);
+            next->right = node->right;
+            next->right->parent = next;
+        }
+        _replace_tree(tree, node, next);
+        next->left = node->left;
+        next->left->parent = next;
+        next->color = node->color;
     }
-    // Node has zero or one child - simple removal
-    _del2_tree(tree, node);
-    return;
+    if (color == TREE_BLACK) {
+        _delete_fixup(tree, child, parent);
+    }
+    tree->size -= 1;
+    _put_node(tree, node);
 }
 
-// Compare two trees for equality
+// Compare two trees for equality: same types and the same pairs in order
 extern _Bool eq_tree(Tree *x, Tree *y) {
     if (x->type.key != y->type.key) {
         return 0;
@@ -145,44 +270,44 @@ extern _Bool eq_tree(Tree *x, Tree *y) {
     if (x->size != y->size) {
         return 0;
     }
-    return _eq_tree(x->type.key, x->type.value, x->node, y->node);
+    tree_node *a = _min_tree(x->node);
+    tree_node *b = _min_tree(y->node);
+    for (; a != NULL && b != NULL; a = _next_tree(a), b = _next_tree(b)) {
+        if (!_eq_node(x->type.key, x->type.value, a, b)) {
+            return 0;
+        }
+    }
+    return a == NULL && b == NULL;
 }
 
-// Recursive function to compare two trees for equality
-static _Bool _eq_tree(vtype_t tkey, vtype_t tvalue, tree_node *x, tree_node *y) {
-    if (x == NULL && y == NULL) {
-        return 1;
+// Compare the pairs of two nodes
+static _Bool _eq_node(vtype_t tkey, vtype_t tvalue, tree_node *x, tree_node *y) {
+    _Bool fkey = 0;
+    _Bool fval = 0;
+    // Compare keys based on their type
+    switch(tkey) {
+        case DECIMAL_TYPE:
+            fkey = x->data.key.decimal == y->data.key.decimal;
+        break;
+        case STRING_TYPE:
+            fkey = strcmp((char*)x->data.key.string, (char*)y->data.key.string) == 0;
+        break;
+        default: ;
     }
-    if (x != NULL && y != NULL) {
-        _Bool fkey = 0;
-        _Bool fval = 0;
-        // Compare keys based on their type
-        switch(tkey) {
-            case DECIMAL_TYPE:
-                fkey = x->data.key.decimal == y->data.key.decimal;
-            break;
-            case STRING_TYPE:
-                fkey = strcmp((char*)x->data.key.string, (char*)y->data.key.string) == 0;
-            break;
-            default: ;
-        }
-        // Compare values based on their type
-        switch(tvalue) {
-            case DECIMAL_TYPE:
-                fval = x->data.value.decimal == y->data.value.decimal;
-            break;
-            case REAL_TYPE:
-                fval = x->data.value.real == y->data.value.real;
-            break;
-            case STRING_TYPE:
-                fval = strcmp((char*)x->data.value.string, (char*)y->data.value.string) == 0;
-            break;
-            default: ;
-        }
-        // Recursively compare left and right subtrees
-        return fkey && fval && _eq_tree(tkey, tvalue, x->left, y->left) && _eq_tree(tkey, tvalue, x->right, y->right);
+    // Compare values based on their type
+    switch(tvalue) {
+        case DECIMAL_TYPE:
+            fval = x->data.value.decimal == y->data.value.decimal;
+        break;
+        case REAL_TYPE:
+            fval = x->data.value.real == y->data.value.real;
+        break;
+        case STRING_TYPE:
+            fval = strcmp((char*)x->data.value.string, (char*)y->data.value.string) == 0;
+        break;
+        default: ;
     }
-    return 0;
+    return fkey && fval;
 }
 
 // Get the number of nodes in the tree
@@ -198,7 +323,9 @@ extern size_t sizeof_tree(void) {
 // Print tree contents in order traversal
 extern void print_tree(Tree *tree) {
     printf("#T[ ");
-    _print_tree(tree, tree->node, tree->type.key, tree->type.value);
+    for (tree_node *node = _min_tree(tree->node); node != NULL; node = _next_tree(node)) {
+        _print_node_tree(node, tree->type.key, tree->type.value);
+    }
     putchar(']');
 }
 
@@ -210,110 +337,122 @@ extern void println_tree(Tree *tree) {
 
 // Print tree structure showing branches
 extern void print_tree_branches(Tree *tree) {
-    _print_branches_tree(tree, tree->node, tree->type.key, tree->type.value);
+    _print_branches_tree(tree->node, tree->type.key, tree->type.value);
 }
 
 // Print tree structure with newline
 extern void println_tree_branches(Tree *tree) {
-    _print_branches_tree(tree, tree->node, tree->type.key, tree->type.value);
+    _print_branches_tree(tree->node, tree->type.key, tree->type.value);
     putchar('\n');
 }
 
-// Create a new tree node with given key and value
-static tree_node *_new_node(vtype_t tkey, vtype_t tvalue, void *key, void *value) {
-    tree_node *node = (tree_node*)malloc(sizeof(tree_node));
+// Take a node from the pool and store a new red key-value pair in it
+static tree_node *_new_node(Tree *tree, void *key, void *value) {
+    tree_node *node = tree->free;
+    if (node != NULL) {
+        tree->free = node->right;
+    } else {
+        if (tree->slabs == NULL || tree->used == tree->slabs->size) {
+            size_t size = tree->slabs == NULL ? TREE_SLAB_MIN : tree->slabs->size * 2;
+            if (size > TREE_SLAB_MAX) {
+                size = TREE_SLAB_MAX;
+            }
+            tree_slab *slab = (tree_slab*)malloc(sizeof(tree_slab) + size * tree->stride);
+            slab->next = tree->slabs;
+            slab->size = size;
+            tree->slabs = slab;
+            tree->used = 0;
+        }
+        node = (tree_node*)(tree->slabs->nodes + tree->used++ * tree->stride);
+    }
     node->exist = 0;
-    _set_key(node, tkey, key);
-    _set_value(node, tvalue, value);
+    _set_key(tree, node, key);
+    _set_value(tree, node, value);
+    node->color = TREE_RED;
     node->left = NULL;
     node->right = NULL;
     node->parent = NULL;
     return node;
 }
 
-// Set the key value for a tree node
-static void _set_key(tree_node *node, vtype_t tkey, void *key) {
-    if (node->exist) {
-        _free_key_tree(tkey, node);
-    }
-    switch(tkey) {
+// Return an unlinked node to the pool, its strings are already freed
+static void _put_node(Tree *tree, tree_node *node) {
+    node->exist = 0;
+    node->right = tree->free;
+    tree->free = node;
+}
+
+// Set the key value for a new tree node
+// Short strings go to the node buffer, long ones to the interning table or
+// to an owned copy
+static void _set_key(Tree *tree, tree_node *node, void *key) {
+    switch(tree->type.key) {
         case DECIMAL_TYPE:
             node->data.key.decimal = (int32_t)(intptr_t)key;
         break;
         case STRING_TYPE: {
             size_t size = strlen((char*)key);
-            node->data.key.string = (char*)malloc(sizeof(char)*size+1);
-            strcpy(node->data.key.string, (char*)key);
+            if (size < TREE_INLINE) {
+                node->data.key.string = node->buffer;
+            } else if (tree->intern != NULL) {
+                node->data.key.string = get_intern(tree->intern, (char*)key);
+                break;
+            } else {
+                node->data.key.string = (char*)malloc(sizeof(char)*size+1);
+            }
+            memcpy(node->data.key.string, (char*)key, size+1);
         }
         break;
         default: ;
     }
 }
 
-// Set the value for a tree node
-static void _set_value(tree_node *node, vtype_t tvalue, void *value) {
-    if (node->exist) {
-        _free_value_tree(tvalue, node);
+// Set the value for a tree node, short strings go to the node buffer
+// The old string is freed only after the copy, value may point into it
+static void _set_value(Tree *tree, tree_node *node, void *value) {
+    char *old = NULL;
+    if (node->exist && tree->type.value == STRING_TYPE &&
+        node->data.value.string != _value_buffer(tree, node)) {
+        old = node->data.value.string;
     }
-    switch(tvalue) {
+    switch(tree->type.value) {
         case DECIMAL_TYPE:
             node->data.value.decimal = (int32_t)(intptr_t)value;
         break;
         case REAL_TYPE:
             node->data.value.real = *(double*)value;
-            free((double*)value);
         break;
         case STRING_TYPE: {
             size_t size = strlen((char*)value);
-            node->data.value.string = (char*)malloc(sizeof(char)*size+1);
-            strcpy(node->data.value.string, (char*)value);
+            if (size < TREE_INLINE) {
+                node->data.value.string = _value_buffer(tree, node);
+            } else {
+                node->data.value.string = (char*)malloc(sizeof(char)*size+1);
+            }
+            memmove(node->data.value.string, (char*)value, size+1);
         }
         break;
         default: ;
     }
+    free(old);
     node->exist = 1;
 }
 
-// Recursively insert or update a key-value pair in the tree
-static void _set_tree(Tree *tree, tree_node *node, vtype_t tkey, vtype_t tvalue, void *key, void *value) {
-    int8_t cond = _cmp_tkey_tree(node, tkey, key);
-    if (cond > 0) {
-        // Key is greater - go to right subtree
-        if (node->right == NULL) {
-            node->right = _new_node(tkey, tvalue, key, value);
-            node->right->parent = node;
-            tree->size += 1;
-        } else {
-            _set_tree(tree, node->right, tkey, tvalue, key, value);
-        }
-    } else if (cond < 0) {
-        // Key is less - go to left subtree
-        if (node->left == NULL) {
-            node->left = _new_node(tkey, tvalue, key, value);
-            node->left->parent = node;
-            tree->size += 1;
-        } else {
-            _set_tree(tree, node->left, tkey, tvalue, key, value);
-        }
-    } else {
-        // Key already exists - update value
-        _set_key(node, tkey, key);
-        _set_value(node, tvalue, value);
-    }
+// Buffer of a node holding a short string value, after the key's
+static char *_value_buffer(Tree *tree, tree_node *node) {
+    return node->buffer + (tree->type.key == STRING_TYPE ? TREE_INLINE : 0);
 }
 
-// Recursively search for a key in the tree
+// Search for a key in the tree
 static tree_node *_get_tree(tree_node *node, vtype_t tkey, void *key) {
-    if (node == NULL) {
-        return NULL;
-    }
-    int8_t cond = _cmp_tkey_tree(node, tkey, key);
-    if (cond > 0) {
-        return _get_tree(node->right, tkey, key);
-    } else if (cond < 0) {
-        return _get_tree(node->left, tkey, key);
+    while (node != NULL) {
+        int8_t cond = _cmp_tkey_tree(node, tkey, key);
+        if (cond == 0) {
+            return node;
+        }
+        node = cond > 0 ? node->right : node->left;
     }
-    return node;
+    return NULL;
 }
 
 // Compare a key with the key stored in a tree node
@@ -323,8 +462,10 @@ static int8_t _cmp_tkey_tree(tree_node *node, vtype_t tkey, void *key) {
         case DECIMAL_TYPE:
             cond = _cmp_int32((int32_t)(intptr_t)key, node->data.key.decimal);
         break;
-        case STRING_TYPE:
-            cond = strcmp((char*)key, node->data.key.string);
+        case STRING_TYPE: {
+            int cmp = strcmp((char*)key, node->data.key.string);
+            cond = (cmp > 0) - (cmp < 0);
+        }
         break;
         default: ;
     }
@@ -341,79 +482,176 @@ static int8_t _cmp_int32(int32_t x, int32_t y) {
     return 0;
 }
 
-// First step of deletion - find node and handle leaf node case
-static tree_node *_del1_tree(Tree *tree, vtype_t tkey, void *key) {
-    tree_node *node = tree->node;
-    node =  _get_tree(node, tkey, key);
+// Leftmost node of a subtree, NULL for an empty one
+static tree_node *_min_tree(tree_node *node) {
     if (node == NULL) {
         return NULL;
     }
-    if (node->left != NULL || node->right != NULL) {
-        return node;
+    while (node->left != NULL) {
+        node = node->left;
+    }
+    return node;
+}
+
+// Next node in key order, NULL after the last one
+static tree_node *_next_tree(tree_node *node) {
+    if (node->right != NULL) {
+        return _min_tree(node->right);
     }
-    // Handle leaf node deletion
     tree_node *parent = node->parent;
-    if (parent == NULL) {
-        tree->node = NULL;
-    } else if (parent->left == node) {
-        parent->left = NULL;
-    } else {
-        parent->right = NULL;
+    while (parent != NULL && node == parent->right) {
+        node = parent;
+        parent = parent->parent;
     }
-    tree->size -= 1;
-    _free_key_tree(tree->type.key, node);
-    _free_value_tree(tree->type.value, node);
-    free(node);
-    return NULL;
+    return parent;
 }
 
-// Second step of deletion - handle nodes with one child
-static void _del2_tree(Tree *tree, tree_node *node) {
+// Put child in the place of node under node's parent
+static void _replace_tree(Tree *tree, tree_node *node, tree_node *child) {
     tree_node *parent = node->parent;
-    tree_node *temp;
-    if (node->right != NULL) {
-        temp = node->right;
-    } else {
-        temp = node->left;
-    }
     if (parent == NULL) {
-        tree->node = temp;
+        tree->node = child;
     } else if (parent->left == node) {
-        parent->left = temp;
+        parent->left = child;
     } else {
-        parent->right = temp;
+        parent->right = child;
     }
-    tree->size -= 1;
-    temp->parent = parent;
-    _free_key_tree(tree->type.key, node);
-    _free_value_tree(tree->type.value, node);
-    free(node);
-}
-
-// Third step of deletion - handle nodes with two children using successor
-static void _del3_tree(Tree *tree, tree_node *node) {
-    // Find the inorder successor (leftmost node in right subtree)
-    tree_node *ptr = node->right;
-    while (ptr->left != NULL) {
-        ptr = ptr->left;
-    }
-    // Copy successor's data to current node
-    node->data.key = ptr->data.key;
-    node->data.value = ptr->data.value;
-    tree_node *parent = ptr->parent;
-    if (parent->left == ptr) {
-        parent->left = NULL;
-    } else {
-        parent->right = NULL;
+    if (child != NULL) {
+        child->parent = parent;
+    }
+}
+
+// Rotate so the right child of node takes its place
+static void _rotate_left(Tree *tree, tree_node *node) {
+    tree_node *pivot = node->right;
+    node->right = pivot->left;
+    if (pivot->left != NULL) {
+        pivot->left->parent = node;
+    }
+    _replace_tree(tree, node, pivot);
+    pivot->left = node;
+    node->parent = pivot;
+}
+
+// Rotate so the left child of node takes its place
+static void _rotate_right(Tree *tree, tree_node *node) {
+    tree_node *pivot = node->left;
+    node->left = pivot->right;
+    if (pivot->right != NULL) {
+        pivot->right->parent = node;
+    }
+    _replace_tree(tree, node, pivot);
+    pivot->right = node;
+    node->parent = pivot;
+}
+
+// Restore red-black properties after a red node was linked in
+static void _insert_fixup(Tree *tree, tree_node *node) {
+    while (_color(node->parent) == TREE_RED) {
+        // A red parent is never the root, so the grandparent exists
+        tree_node *parent = node->parent;
+        tree_node *grand = parent->parent;
+        if (parent == grand->left) {
+            tree_node *uncle = grand->right;
+            if (_color(uncle) == TREE_RED) {
+                parent->color = TREE_BLACK;
+                uncle->color = TREE_BLACK;
+                grand->color = TREE_RED;
+                node = grand;
+                continue;
+            }
+            if (node == parent->right) {
+                _rotate_left(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = TREE_BLACK;
+            grand->color = TREE_RED;
+            _rotate_right(tree, grand);
+        } else {
+            tree_node *uncle = grand->left;
+            if (_color(uncle) == TREE_RED) {
+                parent->color = TREE_BLACK;
+                uncle->color = TREE_BLACK;
+                grand->color = TREE_RED;
+                node = grand;
+                continue;
+            }
+            if (node == parent->left) {
+                _rotate_right(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = TREE_BLACK;
+            grand->color = TREE_RED;
+            _rotate_left(tree, grand);
+        }
+    }
+    tree->node->color = TREE_BLACK;
+}
+
+// Restore red-black properties after a black node was unlinked
+// node took its place (possibly NULL) under parent and is one black short
+static void _delete_fixup(Tree *tree, tree_node *node, tree_node *parent) {
+    while (node != tree->node && _color(node) == TREE_BLACK) {
+        if (node == parent->left) {
+            tree_node *sibling = parent->right;
+            if (_color(sibling) == TREE_RED) {
+                sibling->color = TREE_BLACK;
+                parent->color = TREE_RED;
+                _rotate_left(tree, parent);
+                sibling = parent->right;
+            }
+            if (_color(sibling->left) == TREE_BLACK && _color(sibling->right) == TREE_BLACK) {
+                sibling->color = TREE_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (_color(sibling->right) == TREE_BLACK) {
+                sibling->left->color = TREE_BLACK;
+                sibling->color = TREE_RED;
+                _rotate_right(tree, sibling);
+                sibling = parent->right;
+            }
+            sibling->color = parent->color;
+            parent->color = TREE_BLACK;
+            sibling->right->color = TREE_BLACK;
+            _rotate_left(tree, parent);
+        } else {
+            tree_node *sibling = parent->left;
+            if (_color(sibling) == TREE_RED) {
+                sibling->color = TREE_BLACK;
+                parent->color = TREE_RED;
+                _rotate_right(tree, parent);
+                sibling = parent->left;
+            }
+            if (_color(sibling->left) == TREE_BLACK && _color(sibling->right) == TREE_BLACK) {
+                sibling->color = TREE_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (_color(sibling->left) == TREE_BLACK) {
+                sibling->right->color = TREE_BLACK;
+                sibling->color = TREE_RED;
+                _rotate_left(tree, sibling);
+                sibling = parent->left;
+            }
+            sibling->color = parent->color;
+            parent->color = TREE_BLACK;
+            sibling->left->color = TREE_BLACK;
+            _rotate_right(tree, parent);
+        }
+        node = tree->node;
+    }
+    if (node != NULL) {
+        node->color = TREE_BLACK;
     }
-    tree->size -= 1;
-    // _free_key_tree(tree->type.key, node);
-    // _free_value_tree(tree->type.value, ptr);
-    free(ptr);
 }
 
 // Print a single tree node
-static void _print_node_tree(Tree *tree, tree_node *node, vtype_t tkey, vtype_t tvalue) {
+static void _print_node_tree(tree_node *node, vtype_t tkey, vtype_t tvalue) {
     putchar('{');
     switch(tkey) {
         case DECIMAL_TYPE:
@@ -440,57 +678,40 @@ static void _print_node_tree(Tree *tree, tree_node *node, vtype_t tkey, vtype_t
     printf("} ");
 }
 
-// Print tree structure showing branches recursively
-static void _print_branches_tree(Tree *tree, tree_node *node, vtype_t tkey, vtype_t tvalue) {
+// Print tree structure showing branches recursively (depth is O(log n))
+static void _print_branches_tree(tree_node *node, vtype_t tkey, vtype_t tvalue) {
     if (node == NULL) {
         printf("null");
         return;
     }
     putchar('(');
-    _print_branches_tree(tree, node->left, tkey, tvalue);
+    _print_branches_tree(node->left, tkey, tvalue);
     putchar(' ');
-    _print_node_tree(tree, node, tkey, tvalue);
-    _print_branches_tree(tree, node->right, tkey, tvalue);
+    _print_node_tree(node, tkey, tvalue);
+    _print_branches_tree(node->right, tkey, tvalue);
     putchar(')');
 }
 
-// Print tree contents using inorder traversal
-static void _print_tree(Tree *tree, tree_node *node, vtype_t tkey, vtype_t tvalue) {
-    if (node == NULL) {
-        return;
-    }
-    _print_tree(tree, node->left, tkey, tvalue);
-    _print_node_tree(tree, node, tkey, tvalue);
-    _print_tree(tree, node->right, tkey, tvalue);
-}
-
-// Recursively free all nodes in the tree
-static void _free_tree(Tree *tree, tree_node *node) {
-    if (node == NULL) {
-        return;
-    }
-    _free_tree(tree, node->left);
-    _free_tree(tree, node->right);
-    _free_key_tree(tree->type.key, node);
-    _free_value_tree(tree->type.value, node);
-    free(node);
-}
-
 // Free memory allocated for key based on its type
-static void _free_key_tree(vtype_t type, tree_node *node) {
-    switch(type) {
+// Keys in the node buffer or in an interning table are not owned
+static void _free_key_tree(Tree *tree, tree_node *node) {
+    switch(tree->type.key) {
         case STRING_TYPE:
-            free(node->data.key.string);
+            if (node->data.key.string != node->buffer && tree->intern == NULL) {
+                free(node->data.key.string);
+            }
         break;
         default: ;
     }
 }
 
 // Free memory allocated for value based on its type
-static void _free_value_tree(vtype_t type, tree_node *node) {
-    switch(type) {
+static void _free_value_tree(Tree *tree, tree_node *node) {
+    switch(tree->type.value) {
         case STRING_TYPE:
-            free(node->data.value.string);
+            if (node->data.value.string != _value_buffer(tree, node)) {
+                free(node->data.value.string);
+            }
         break;
         default: ;
     }
@@ -0,0 +1,220 @@
+// Hierarchical timer wheel
+// Level 0 has one slot per tick for the next WHEEL_SLOTS ticks, each higher
+// level one slot per full rotation of the level below. A timer goes into the
+// lowest level whose range covers its deadline; when the wheel reaches a
+// higher slot, its timers cascade into the levels below. Arming, cancelling
+// and firing are O(1) per timer, and empty stretches of time are skipped with
+// the per-level occupancy masks instead of visiting every tick.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include "wheel.h"
+
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4 // 64^4 ticks of 16 ms, about three days
+#define WHEEL_RANGE  ((int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+// Wheel structure: slot lists per level and which of them hold timers
+typedef struct Wheel {
+    int64_t tick;       // Next tick to process
+    size_t count;       // Armed timers
+    uint64_t used[WHEEL_LEVELS];
+    Timer* slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} Wheel;
+
+// Function prototypes for internal wheel operations
+static void link_wheel(Wheel* wheel, Timer* timer);
+static void unlink_wheel(Wheel* wheel, Timer* timer);
+static void cascade_wheel(Wheel* wheel);
+static int64_t next_wheel(Wheel* wheel);
+static uint64_t rotate_mask(uint64_t mask, unsigned shift);
+
+// Create an empty wheel starting at now (ms)
+extern Wheel* new_wheel(int64_t now) {
+    Wheel* wheel = (Wheel*)calloc(1, sizeof(Wheel));
+    wheel->tick = now / WHEEL_TICK;
+    return wheel;
+}
+
+// Free the wheel, timers still armed are left untouched
+extern void free_wheel(Wheel* wheel) {
+    free(wheel);
+}
+
+// Prepare a timer that is not armed yet
+extern void init_timer(Timer* timer) {
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->expires = 0;
+    timer->where = 0;
+}
+
+// Arm a timer to fire once the clock reaches deadline (ms), re-arming it
+// if it is already armed. Deadlines already passed fire on the next expiry
+extern void add_wheel(Wheel* wheel, Timer* timer, int64_t deadline) {
+    if (timer->where != 0) {
+        unlink_wheel(wheel, timer);
+    } else {
+        wheel->count += 1;
+    }
+    timer->expires = (deadline + WHEEL_TICK - 1) / WHEEL_TICK;
+    link_wheel(wheel, timer);
+}
+
+// Disarm a timer, nothing happens if it is not armed
+extern void del_wheel(Wheel* wheel, Timer* timer) {
+    if (timer->where == 0) {
+        return;
+    }
+    unlink_wheel(wheel, timer);
+    wheel->count -= 1;
+}
+
+// Advance the wheel to now (ms) and return the timers that fired, linked
+// through next and disarmed. Read next before re-arming one of them
+extern Timer* expire_wheel(Wheel* wheel, int64_t now) {
+    int64_t target = now / WHEEL_TICK;
+    Timer* fired = NULL;
+    while (wheel->tick <= target) {
+        if (wheel->count == 0) {
+            wheel->tick = target + 1;
+            break;
+        }
+        unsigned index = (unsigned)(wheel->tick & WHEEL_MASK);
+        if (index == 0) {
+            cascade_wheel(wheel);
+        }
+        Timer* timer = wheel->slots[0][index];
+        wheel->slots[0][index] = NULL;
+        wheel->used[0] &= ~((uint64_t)1 << index);
+        while (timer != NULL) {
+            Timer* next = timer->next;
+            timer->where = 0;
+            timer->prev = NULL;
+            timer->next = fired;
+            fired = timer;
+            wheel->count -= 1;
+            timer = next;
+        }
+        wheel->tick += 1;
+        if (wheel->used[0] == 0) {
+            // Nothing left on level 0: jump to where the next cascade happens
+            int64_t boundary = (wheel->tick + WHEEL_MASK) & ~(int64_t)WHEEL_MASK;
+            wheel->tick = boundary < target + 1 ? boundary : target + 1;
+        }
+    }
+    return fired;
+}
+
+// Milliseconds from now until expire_wheel has work to do, -1 if no timer
+// is armed. Timers on higher levels wake the loop when they cascade
+extern int wait_wheel(Wheel* wheel, int64_t now) {
+    if (wheel->count == 0) {
+        return -1;
+    }
+    int64_t ms = next_wheel(wheel) * WHEEL_TICK - now;
+    if (ms < 0) {
+        return 0;
+    }
+    return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+// Number of armed timers
+extern size_t count_wheel(Wheel* wheel) {
+    return wheel->count;
+}
+
+// Put a timer into the slot covering its expiry tick
+static void link_wheel(Wheel* wheel, Timer* timer) {
+    if (timer->expires < wheel->tick) {
+        timer->expires = wheel->tick;
+    }
+    if (timer->expires - wheel->tick >= WHEEL_RANGE) {
+        timer->expires = wheel->tick + WHEEL_RANGE - 1; // Past the top level
+    }
+    int64_t delta = timer->expires - wheel->tick;
+    unsigned level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= ((int64_t)1 << (WHEEL_BITS * (level + 1)))) {
+        level += 1;
+    }
+    unsigned slot = (unsigned)((timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    Timer** head = &wheel->slots[level][slot];
+    timer->prev = NULL;
+    timer->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = timer;
+    }
+    *head = timer;
+    timer->where = (uint16_t)(1 + level * WHEEL_SLOTS + slot);
+    wheel->used[level] |= (uint64_t)1 << slot;
+}
+
+// Take a timer out of its slot
+static void unlink_wheel(Wheel* wheel, Timer* timer) {
+    unsigned level = (timer->where - 1) / WHEEL_SLOTS;
+    unsigned slot = (timer->where - 1) % WHEEL_SLOTS;
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel->slots[level][slot] = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    if (wheel->slots[level][slot] == NULL) {
+        wheel->used[level] &= ~((uint64_t)1 << slot);
+    }
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->where = 0;
+}
+
+// Move the timers of the higher slots the wheel just reached down a level
+// Called when the level 0 index wraps; each further level only on its wrap
+static void cascade_wheel(Wheel* wheel) {
+    for (unsigned level = 1; level < WHEEL_LEVELS; ++level) {
+        unsigned index = (unsigned)((wheel->tick >> (WHEEL_BITS * level)) & WHEEL_MASK);
+        Timer* timer = wheel->slots[level][index];
+        wheel->slots[level][index] = NULL;
+        wheel->used[level] &= ~((uint64_t)1 << index);
+        while (timer != NULL) {
+            Timer* next = timer->next;
+            link_wheel(wheel, timer);
+            timer = next;
+        }
+        if (index != 0) {
+            break;
+        }
+    }
+}
+
+// Earliest tick at which a level 0 slot fires or a higher slot cascades
+static int64_t next_wheel(Wheel* wheel) {
+    int64_t best = INT64_MAX;
+    if (wheel->used[0] != 0) {
+        uint64_t mask = rotate_mask(wheel->used[0], (unsigned)(wheel->tick & WHEEL_MASK));
+        best = wheel->tick + __builtin_ctzll(mask);
+    }
+    for (unsigned level = 1; level < WHEEL_LEVELS; ++level) {
+        if (wheel->used[level] == 0) {
+            continue;
+        }
+        // Cascades happen on multiples of the level's span, from the next one on
+        unsigned shift = WHEEL_BITS * level;
+        int64_t first = (wheel->tick + ((int64_t)1 << shift) - 1) >> shift;
+        uint64_t mask = rotate_mask(wheel->used[level], (unsigned)(first & WHEEL_MASK));
+        int64_t at = (first + __builtin_ctzll(mask)) << shift;
+        if (at < best) {
+            best = at;
+        }
+    }
+    return best;
+}
+
+// Rotate mask right so bit shift becomes bit 0
+static uint64_t rotate_mask(uint64_t mask, unsigned shift) {
+    return shift == 0 ? mask : (mask >> shift) | (mask << (64 - shift));
+}